@@ -64,8 +64,10 @@ void EXTI5_IRQHandler(void);
 void EXTI13_IRQHandler(void);
 void EXTI14_IRQHandler(void);
 void EXTI15_IRQHandler(void);
+void ADC1_IRQHandler(void);
 void LPTIM1_IRQHandler(void);
 void RTC_IRQHandler(void);
+void PWR_IRQHandler(void);
 /* USER CODE BEGIN EFP */
 
 /* USER CODE END EFP */
@@ -45,9 +45,9 @@ int main(void)
     case KEY_ON:
       if (shift)
       {
-        LCD_power_off(1);
-        // also blocking call -> wait for ON
-        sys_sleep(1);
+        draw_power_off_image(1);
+        // Blocks in Stop 3 until ON is pressed again
+        sys_power_off();
       }
       if (!LCD_is_on())
       {
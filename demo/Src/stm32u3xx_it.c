@@ -59,6 +59,7 @@
 /* USER CODE END 0 */
 
 /* External variables --------------------------------------------------------*/
+extern ADC_HandleTypeDef hadc1;
 extern LPTIM_HandleTypeDef hlptim1;
 extern RTC_HandleTypeDef hrtc;
 
@@ -210,11 +211,11 @@ void SysTick_Handler(void)
 void EXTI0_IRQHandler(void)
 {
   /* USER CODE BEGIN EXTI0_IRQn 0 */
-
+  sys_power_irq_enter(SYS_WAKE_EXTI(0));
   /* USER CODE END EXTI0_IRQn 0 */
   HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_0);
   /* USER CODE BEGIN EXTI0_IRQn 1 */
-
+  sys_power_irq_exit();
   /* USER CODE END EXTI0_IRQn 1 */
 }
 
@@ -224,11 +225,11 @@ void EXTI0_IRQHandler(void)
 void EXTI1_IRQHandler(void)
 {
   /* USER CODE BEGIN EXTI1_IRQn 0 */
-
+  sys_power_irq_enter(SYS_WAKE_EXTI(1));
   /* USER CODE END EXTI1_IRQn 0 */
   HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_1);
   /* USER CODE BEGIN EXTI1_IRQn 1 */
-
+  sys_power_irq_exit();
   /* USER CODE END EXTI1_IRQn 1 */
 }
 
@@ -238,11 +239,11 @@ void EXTI1_IRQHandler(void)
 void EXTI2_IRQHandler(void)
 {
   /* USER CODE BEGIN EXTI2_IRQn 0 */
-
+  sys_power_irq_enter(SYS_WAKE_EXTI(2));
   /* USER CODE END EXTI2_IRQn 0 */
   HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_2);
   /* USER CODE BEGIN EXTI2_IRQn 1 */
-
+  sys_power_irq_exit();
   /* USER CODE END EXTI2_IRQn 1 */
 }
 
@@ -252,11 +253,11 @@ void EXTI2_IRQHandler(void)
 void EXTI3_IRQHandler(void)
 {
   /* USER CODE BEGIN EXTI3_IRQn 0 */
-
+  sys_power_irq_enter(SYS_WAKE_EXTI(3));
   /* USER CODE END EXTI3_IRQn 0 */
   HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_3);
   /* USER CODE BEGIN EXTI3_IRQn 1 */
-
+  sys_power_irq_exit();
   /* USER CODE END EXTI3_IRQn 1 */
 }
 
@@ -266,11 +267,11 @@ void EXTI3_IRQHandler(void)
 void EXTI4_IRQHandler(void)
 {
   /* USER CODE BEGIN EXTI4_IRQn 0 */
-
+  sys_power_irq_enter(SYS_WAKE_EXTI(4));
   /* USER CODE END EXTI4_IRQn 0 */
   HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_4);
   /* USER CODE BEGIN EXTI4_IRQn 1 */
-
+  sys_power_irq_exit();
   /* USER CODE END EXTI4_IRQn 1 */
 }
 
@@ -280,11 +281,11 @@ void EXTI4_IRQHandler(void)
 void EXTI5_IRQHandler(void)
 {
   /* USER CODE BEGIN EXTI5_IRQn 0 */
-
+  sys_power_irq_enter(SYS_WAKE_EXTI(5));
   /* USER CODE END EXTI5_IRQn 0 */
   HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_5);
   /* USER CODE BEGIN EXTI5_IRQn 1 */
-
+  sys_power_irq_exit();
   /* USER CODE END EXTI5_IRQn 1 */
 }
 
@@ -294,11 +295,11 @@ void EXTI5_IRQHandler(void)
 void EXTI13_IRQHandler(void)
 {
   /* USER CODE BEGIN EXTI13_IRQn 0 */
-
+  sys_power_irq_enter(SYS_WAKE_EXTI(13));
   /* USER CODE END EXTI13_IRQn 0 */
   HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_13);
   /* USER CODE BEGIN EXTI13_IRQn 1 */
-
+  sys_power_irq_exit();
   /* USER CODE END EXTI13_IRQn 1 */
 }
 
@@ -308,11 +309,11 @@ void EXTI13_IRQHandler(void)
 void EXTI14_IRQHandler(void)
 {
   /* USER CODE BEGIN EXTI14_IRQn 0 */
-
+  sys_power_irq_enter(SYS_WAKE_EXTI(14));
   /* USER CODE END EXTI14_IRQn 0 */
   HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_14);
   /* USER CODE BEGIN EXTI14_IRQn 1 */
-
+  sys_power_irq_exit();
   /* USER CODE END EXTI14_IRQn 1 */
 }
 
@@ -322,25 +323,35 @@ void EXTI14_IRQHandler(void)
 void EXTI15_IRQHandler(void)
 {
   /* USER CODE BEGIN EXTI15_IRQn 0 */
-
+  sys_power_irq_enter(SYS_WAKE_EXTI(15));
   /* USER CODE END EXTI15_IRQn 0 */
   HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_15);
   /* USER CODE BEGIN EXTI15_IRQn 1 */
-
+  sys_power_irq_exit();
   /* USER CODE END EXTI15_IRQn 1 */
 }
 
+/**
+ * @brief This function handles ADC1 global interrupt: the end of a battery
+ * sample.  Taken in Sleep, not STOP2, so it is no wakeup, and its time is
+ * priced with the conversion.
+ */
+void ADC1_IRQHandler(void)
+{
+  HAL_ADC_IRQHandler(&hadc1);
+}
+
 /**
  * @brief This function handles LPTIM1 global interrupt.
  */
 void LPTIM1_IRQHandler(void)
 {
   /* USER CODE BEGIN LPTIM1_IRQn 0 */
-
+  sys_power_irq_enter(SYS_WAKE_LPTIM);
   /* USER CODE END LPTIM1_IRQn 0 */
   HAL_LPTIM_IRQHandler(&hlptim1);
   /* USER CODE BEGIN LPTIM1_IRQn 1 */
-
+  sys_power_irq_exit();
   /* USER CODE END LPTIM1_IRQn 1 */
 }
 
@@ -349,6 +360,18 @@ void LPTIM1_IRQHandler(void)
  */
 void RTC_IRQHandler(void)
 {
+  if (__HAL_RTC_WAKEUPTIMER_GET_FLAG(&hrtc, RTC_FLAG_WUTF))
+  {
+    sys_power_irq_enter(SYS_WAKE_RTC_WAKEUP);
+  }
+  else if (__HAL_RTC_ALARM_GET_FLAG(&hrtc, RTC_FLAG_ALRAF) || __HAL_RTC_ALARM_GET_FLAG(&hrtc, RTC_FLAG_ALRBF))
+  {
+    sys_power_irq_enter(SYS_WAKE_RTC_ALARM);
+  }
+  else
+  {
+    sys_power_irq_enter(SYS_WAKE_OTHER);
+  }
 
   if (__HAL_RTC_WAKEUPTIMER_GET_FLAG(&hrtc, RTC_FLAG_WUTF))
   {
@@ -357,8 +380,8 @@ void RTC_IRQHandler(void)
   }
   if (__HAL_RTC_ALARM_GET_FLAG(&hrtc, RTC_FLAG_ALRAF))
   {
-    DEBUG_PRINT("RTC Alarm A IRQ\n");
-    __HAL_RTC_ALARM_CLEAR_FLAG(&hrtc, RTC_FLAG_ALRAF);
+    // Auto-off, see reset_auto_off()
+    HAL_RTC_AlarmIRQHandler(&hrtc);
   }
   if (__HAL_RTC_ALARM_GET_FLAG(&hrtc, RTC_FLAG_ALRBF))
   {
@@ -375,6 +398,18 @@ void RTC_IRQHandler(void)
     DEBUG_PRINT("RTC Timestamp IRQ\n");
     __HAL_RTC_TIMESTAMP_CLEAR_FLAG(&hrtc, RTC_FLAG_TSF);
   }
+  sys_power_irq_exit();
+}
+
+/**
+ * @brief This function handles PWR non-secure interrupt: the ON key's wakeup
+ * pin in sys_power_off().
+ */
+void PWR_IRQHandler(void)
+{
+  sys_power_irq_enter(SYS_WAKE_WKUP);
+  HAL_PWR_WKUP_IRQHandler();
+  sys_power_irq_exit();
 }
 
 /* USER CODE BEGIN 1 */
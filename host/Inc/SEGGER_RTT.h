@@ -0,0 +1,12 @@
+/*
+ * SEGGER_RTT.h (host)
+ *
+ * RTT channel 0 is mapped to stderr on the host.
+ */
+
+#ifndef SEGGER_RTT_H
+#define SEGGER_RTT_H
+
+int SEGGER_RTT_printf(unsigned BufferIndex, const char *sFormat, ...);
+
+#endif /* SEGGER_RTT_H */
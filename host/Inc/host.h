@@ -0,0 +1,106 @@
+/*
+ * host.h
+ *
+ * Simulation hooks available to programs linked against the host build
+ * of liborcos.
+ */
+
+#ifndef HOST_H
+#define HOST_H
+
+#include "stm32u3xx_hal.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Virtual Sharp memory LCD (sharp_panel.c) ---------------------------------*/
+
+#define SHARP_PANEL_WIDTH 400
+#define SHARP_PANEL_HEIGHT 240
+#define SHARP_PANEL_LINE_SIZE (SHARP_PANEL_WIDTH / 8)
+
+/// Clear panel memory (all white) and reset the SPI decoder
+void sharp_panel_reset(void);
+
+/// Chip select edge: the Sharp SCS line is active high
+void sharp_panel_cs(int level);
+
+/// Feed bytes clocked out on SPI2 while chip select is high
+void sharp_panel_write(const uint8_t *data, size_t len);
+
+/// Panel memory for gate line 1..240, LSB is the first pixel, '1' is white
+const uint8_t *sharp_panel_line(int line);
+
+/// Number of gate lines written since the last reset
+uint32_t sharp_panel_lines_written(void);
+
+/// Number of bytes received on SPI since the last reset
+uint32_t sharp_panel_bytes_received(void);
+
+/// Dump panel contents as binary PBM (P4).  Returns 0 on success.
+int sharp_panel_write_pbm(const char *path);
+
+/// Dump panel contents as 1-bit grayscale PNG.  Returns 0 on success.
+int sharp_panel_write_png(const char *path);
+
+/* Keyboard matrix (hal_shim.c) ---------------------------------------------*/
+
+/// Close the matrix contact for keycode (1..54, see KEYCODES)
+void host_key_down(uint16_t keycode);
+
+/// Open the matrix contact for keycode
+void host_key_up(uint16_t keycode);
+
+/// Release all keys
+void host_key_up_all(void);
+
+/// Number of BRR writes to port since start-up, to count column probes
+uint32_t host_port_resets(const GPIO_TypeDef *port);
+
+/* Virtual time (hal_shim.c) ------------------------------------------------*/
+
+/// Microseconds of virtual time since HAL_Init()
+uint32_t host_time_us(void);
+
+/// Number of LPTIM interrupts taken since start-up
+uint32_t host_lptim_interrupts(void);
+
+/**
+ * Called with the current virtual time for every step spent in STOP mode,
+ * so a test can script key presses and releases while the firmware sleeps.
+ * NULL removes the hook.
+ */
+void host_set_idle_hook(void (*hook)(uint32_t now_us));
+
+/* RTC (hal_shim.c) --------------------------------------------------------*/
+
+/// Make the next calls to HAL_RTC_SetAlarm_IT() find the RTC locked (HAL_BUSY)
+void host_set_rtc_busy(int calls);
+
+/// Number of HAL_RTC_GetTime() and HAL_RTC_GetDate() calls since start-up
+uint32_t host_rtc_hal_reads(void);
+
+/* Battery (hal_shim.c) ----------------------------------------------------*/
+
+/// Set VDDA, which the VREFINT conversions measure (3300 mV at start-up)
+void host_set_vdda_mv(uint32_t mv);
+
+/// Number of ADC conversions started since start-up
+uint32_t host_adc_conversions(void);
+
+/* Clock tree (hal_shim.c) -------------------------------------------------*/
+
+/**
+ * Number of clock tree changes since start-up that left it outside the
+ * datasheet limits: HCLK above the voltage range maximum, above 24 MHz
+ * without the EPOD booster or with too few flash wait states, or the MSIS
+ * reconfigured while it clocks the core or selected while STOP left it
+ * stopped, or SPI2 or the ADC used with their bus clock gated.  Each is also
+ * logged to stderr.
+ */
+uint32_t host_clock_violations(void);
+
+/// Number of times the EPOD booster was enabled from off since start-up
+uint32_t host_booster_starts(void);
+
+#endif /* HOST_H */
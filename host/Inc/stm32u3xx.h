@@ -0,0 +1,12 @@
+/*
+ * stm32u3xx.h (host)
+ *
+ * Forwards to the host HAL stand-in, see stm32u3xx_hal.h.
+ */
+
+#ifndef __STM32U3XX_H
+#define __STM32U3XX_H
+
+#include "stm32u3xx_hal.h"
+
+#endif /* __STM32U3XX_H */
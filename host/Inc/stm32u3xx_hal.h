@@ -0,0 +1,596 @@
+/*
+ * stm32u3xx_hal.h (host)
+ *
+ * Minimal stand-in for the STM32U3xx HAL used by the host (Linux) build of
+ * liborcos.  Only the types, constants and functions referenced by the
+ * liborcos sources are provided.  Peripherals are simulated in hal_shim.c:
+ *
+ *  - GPIO keeps per-port output/input state and models the keyboard matrix
+ *  - EXTI and NVIC enable registers gate the row interrupts, as on the MCU
+ *  - SPI2 traffic is fed to a virtual Sharp memory LCD (sharp_panel.c)
+ *  - The DWT cycle counter advances by a few cycles on every read
+ *  - RTC returns a fixed date, and a time starting at 12:34:56 that follows
+ *    virtual time, through the HAL and its TR, DR and SSR registers; alarm A
+ *    fires on the time of day
+ *  - RCC and PWR keep the clock tree state and check its frequency limits
+ *  - STOP mode advances virtual time, running LPTIM ticks and the idle hook
+ *    from host.h until an interrupt ends the sleep (sleep-on-exit honoured);
+ *    HAL_Delay() does the same for a fixed time, as a busy main loop, and
+ *    SLEEP mode until the next interrupt
+ */
+
+#ifndef __STM32U3xx_HAL_H
+#define __STM32U3xx_HAL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Generic HAL types ---------------------------------------------------------*/
+typedef enum
+{
+  HAL_OK = 0x00U,
+  HAL_ERROR = 0x01U,
+  HAL_BUSY = 0x02U,
+  HAL_TIMEOUT = 0x03U
+} HAL_StatusTypeDef;
+
+#define HAL_MAX_DELAY 0xFFFFFFFFU
+
+#define __NOP() do { } while (0)
+#define __disable_irq() do { } while (0)
+#define __enable_irq() do { } while (0)
+#define __get_PRIMASK() 0U
+#define __set_PRIMASK(x) ((void)(x))
+#define __DMB() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define __DSB() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define __ISB() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+extern uint32_t SystemCoreClock;
+
+/*
+ * CMSIS register access.  Writes go through host_reg_written() so that
+ * port-wide GPIO accesses (BSRR/BRR) reach the simulated pins.
+ */
+void host_reg_written(volatile uint32_t *reg);
+#define WRITE_REG(REG, VAL) do { (REG) = (VAL); host_reg_written(&(REG)); } while (0)
+#define READ_REG(REG) ((REG))
+#define MODIFY_REG(REG, CLEARMASK, SETMASK) WRITE_REG((REG), (((READ_REG(REG)) & (~(CLEARMASK))) | (SETMASK)))
+
+/* GPIO ----------------------------------------------------------------------*/
+typedef struct
+{
+  volatile uint32_t MODER;
+  volatile uint32_t OTYPER;
+  volatile uint32_t OSPEEDR;
+  volatile uint32_t PUPDR;
+  volatile uint32_t IDR;
+  volatile uint32_t ODR;
+  volatile uint32_t BSRR;
+  volatile uint32_t LCKR;
+  volatile uint32_t AFR[2];
+  volatile uint32_t BRR;
+} GPIO_TypeDef;
+
+extern GPIO_TypeDef host_gpio[8];
+#define GPIOA (&host_gpio[0])
+#define GPIOB (&host_gpio[1])
+#define GPIOC (&host_gpio[2])
+#define GPIOD (&host_gpio[3])
+#define GPIOH (&host_gpio[7])
+
+typedef enum
+{
+  GPIO_PIN_RESET = 0U,
+  GPIO_PIN_SET
+} GPIO_PinState;
+
+typedef struct
+{
+  uint32_t Pin;
+  uint32_t Mode;
+  uint32_t Pull;
+  uint32_t Speed;
+  uint32_t Alternate;
+} GPIO_InitTypeDef;
+
+#define GPIO_PIN_0 ((uint16_t)0x0001)
+#define GPIO_PIN_1 ((uint16_t)0x0002)
+#define GPIO_PIN_2 ((uint16_t)0x0004)
+#define GPIO_PIN_3 ((uint16_t)0x0008)
+#define GPIO_PIN_4 ((uint16_t)0x0010)
+#define GPIO_PIN_5 ((uint16_t)0x0020)
+#define GPIO_PIN_6 ((uint16_t)0x0040)
+#define GPIO_PIN_7 ((uint16_t)0x0080)
+#define GPIO_PIN_8 ((uint16_t)0x0100)
+#define GPIO_PIN_9 ((uint16_t)0x0200)
+#define GPIO_PIN_10 ((uint16_t)0x0400)
+#define GPIO_PIN_11 ((uint16_t)0x0800)
+#define GPIO_PIN_12 ((uint16_t)0x1000)
+#define GPIO_PIN_13 ((uint16_t)0x2000)
+#define GPIO_PIN_14 ((uint16_t)0x4000)
+#define GPIO_PIN_15 ((uint16_t)0x8000)
+
+#define GPIO_MODE_INPUT 0x00000000U
+#define GPIO_MODE_OUTPUT_PP 0x00000001U
+#define GPIO_MODE_OUTPUT_OD 0x00000011U
+#define GPIO_MODE_ANALOG 0x00000003U
+#define GPIO_MODE_IT_RISING 0x10110000U
+#define GPIO_MODE_IT_FALLING 0x10210000U
+#define GPIO_MODE_IT_RISING_FALLING 0x10310000U
+
+#define GPIO_NOPULL 0x00000000U
+#define GPIO_PULLUP 0x00000001U
+#define GPIO_PULLDOWN 0x00000002U
+
+#define GPIO_SPEED_FREQ_LOW 0x00000000U
+#define GPIO_SPEED_FREQ_MEDIUM 0x00000001U
+#define GPIO_SPEED_FREQ_HIGH 0x00000002U
+#define GPIO_SPEED_FREQ_VERY_HIGH 0x00000003U
+
+#define GPIO_MODER_MODE0 0x00000003U
+#define GPIO_PUPDR_PUPD0 0x00000003U
+
+/* EXTI ----------------------------------------------------------------------*/
+typedef struct
+{
+  volatile uint32_t RTSR1;
+  volatile uint32_t FTSR1;
+  volatile uint32_t SWIER1;
+  volatile uint32_t RPR1; /* Write 1 to clear */
+  volatile uint32_t FPR1; /* Write 1 to clear */
+  volatile uint32_t EXTICR[4];
+  volatile uint32_t IMR1;
+  volatile uint32_t EMR1;
+} EXTI_TypeDef;
+
+extern EXTI_TypeDef host_exti;
+#define EXTI (&host_exti)
+
+void HAL_GPIO_Init(GPIO_TypeDef *GPIOx, const GPIO_InitTypeDef *pGPIO_Init);
+GPIO_PinState HAL_GPIO_ReadPin(const GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+void HAL_GPIO_TogglePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+void HAL_GPIO_EXTI_Rising_Callback(uint16_t GPIO_Pin);
+void HAL_GPIO_EXTI_Falling_Callback(uint16_t GPIO_Pin);
+#define __HAL_GPIO_EXTI_CLEAR_FALLING_IT(__EXTI_LINE__) WRITE_REG(EXTI->FPR1, (__EXTI_LINE__))
+
+/* Cortex / NVIC -------------------------------------------------------------*/
+typedef enum
+{
+  EXTI0_IRQn = 11,
+  EXTI1_IRQn = 12,
+  EXTI2_IRQn = 13,
+  EXTI3_IRQn = 14,
+  EXTI4_IRQn = 15,
+  EXTI5_IRQn = 16,
+  EXTI13_IRQn = 24,
+  EXTI14_IRQn = 25,
+  EXTI15_IRQn = 26,
+  RTC_IRQn = 2,
+  ADC1_IRQn = 37,
+  LPTIM1_IRQn = 47,
+  PWR_IRQn = 123
+} IRQn_Type;
+
+typedef struct
+{
+  volatile uint32_t ISER[4]; /* Reads back the enabled interrupts */
+  volatile uint32_t ICER[4];
+  volatile uint32_t ISPR[4];
+  volatile uint32_t ICPR[4];
+} NVIC_Type;
+
+extern NVIC_Type host_nvic;
+#define NVIC (&host_nvic)
+
+/* SLEEPDEEP picks STOP over SLEEP for the WFI and sleep-on-exit */
+typedef struct
+{
+  volatile uint32_t SCR;
+} SCB_Type;
+
+#define SCB_SCR_SLEEPDEEP_Msk (1UL << 2)
+extern SCB_Type host_scb;
+#define SCB (&host_scb)
+
+typedef struct
+{
+  volatile uint32_t DEMCR;
+} DCB_Type;
+
+typedef struct
+{
+  volatile uint32_t CTRL;
+  volatile uint32_t CYCCNT;
+} DWT_Type;
+
+#define DCB_DEMCR_TRCENA_Msk (1UL << 24)
+#define DWT_CTRL_CYCCNTENA_Msk (1UL << 0)
+
+extern DCB_Type host_dcb;
+#define DCB (&host_dcb)
+
+/* Once enabled, CYCCNT advances by HOST_DWT_CYCLES_PER_READ on every access */
+#define HOST_DWT_CYCLES_PER_READ 8
+DWT_Type *host_dwt(void);
+#define DWT (host_dwt())
+
+/* Non-zero while the shim delivers an interrupt */
+uint32_t host_ipsr(void);
+#define __get_IPSR() host_ipsr()
+
+void HAL_NVIC_SetPriority(IRQn_Type IRQn, uint32_t PreemptPriority, uint32_t SubPriority);
+void HAL_NVIC_EnableIRQ(IRQn_Type IRQn);
+void HAL_NVIC_DisableIRQ(IRQn_Type IRQn);
+void HAL_NVIC_SystemReset(void);
+uint32_t HAL_SYSTICK_Config(uint32_t TicksNumb);
+
+/* HAL core ------------------------------------------------------------------*/
+HAL_StatusTypeDef HAL_Init(void);
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t Delay);
+void HAL_SuspendTick(void);
+void HAL_ResumeTick(void);
+void HAL_DBGMCU_EnableDBGStopMode(void);
+
+/* RCC -----------------------------------------------------------------------*/
+typedef struct
+{
+  uint32_t OscillatorType;
+  uint32_t MSISState;
+  uint32_t MSISSource;
+  uint32_t MSISDiv;
+} RCC_OscInitTypeDef;
+
+typedef struct
+{
+  uint32_t ClockType;
+  uint32_t SYSCLKSource;
+  uint32_t AHBCLKDivider;
+  uint32_t APB1CLKDivider;
+  uint32_t APB2CLKDivider;
+  uint32_t APB3CLKDivider;
+} RCC_ClkInitTypeDef;
+
+#define RCC_OSCILLATORTYPE_MSIS 0x00000020U
+#define RCC_MSI_ON 0x00000001U
+#define RCC_MSI_RC0 0x00000000U /* 96 MHz */
+#define RCC_MSI_RC1 0x00000100U /* 24 MHz */
+#define RCC_MSI_DIV1 0x00000000U
+#define RCC_MSI_DIV2 0x00000001U
+#define RCC_MSI_DIV4 0x00000002U
+#define RCC_MSI_DIV8 0x00000003U
+
+#define RCC_CLOCKTYPE_SYSCLK 0x00000001U
+#define RCC_CLOCKTYPE_HCLK 0x00000002U
+#define RCC_CLOCKTYPE_PCLK1 0x00000004U
+#define RCC_CLOCKTYPE_PCLK2 0x00000008U
+#define RCC_CLOCKTYPE_PCLK3 0x00000010U
+#define RCC_SYSCLKSOURCE_MSIS 0x00000000U
+#define RCC_SYSCLKSOURCE_HSI 0x00000001U
+#define RCC_SYSCLK_DIV1 0x00000000U
+#define RCC_HCLK_DIV1 0x00000000U
+
+#define RCC_EPODBOOSTER_SOURCE_NONE 0x00000000U
+#define RCC_EPODBOOSTER_SOURCE_MSIS 0x00000001U
+#define RCC_EPODBOOSTER_SOURCE_HSI 0x00000002U
+#define RCC_EPODBOOSTER_DIV1 0x00000000U
+#define RCC_EPODBOOSTER_DIV2 0x00000001U
+
+#define RCC_STOP_WKUP_SYSCLK_MSIS 0x00000000U
+#define RCC_STOP_WKUP_SYSCLK_HSI 0x00000010U
+
+/* ADC kernel clock dividers are stored as the division factor itself */
+#define RCC_ADCDACCLK_DIV1 1U
+#define RCC_ADCDACCLK_DIV2 2U
+#define RCC_ADCDACCLK_DIV4 4U
+#define RCC_ADCDACCLK_DIV8 8U
+#define RCC_ADCDACCLK_DIV16 16U
+#define RCC_ADCDACCLK_DIV32 32U
+#define RCC_ADCDACCLK_DIV64 64U
+#define RCC_ADCDACCLK_DIV128 128U
+#define RCC_ADCDACCLK_DIV256 256U
+#define RCC_ADCDACCLK_DIV512 512U
+extern uint32_t host_adcdac_div;
+#define __HAL_RCC_ADCDAC_DIV_CONFIG(__ADCDAC_CLKDIV__) (host_adcdac_div = (__ADCDAC_CLKDIV__))
+
+/* Peripheral bus clocks, as HOST_CLK_* bits; both on after the MspInit()s.
+ * SPI2 transfers and ADC conversions check theirs. */
+#define HOST_CLK_SPI2 0x1U
+#define HOST_CLK_ADC 0x2U
+extern uint32_t host_rcc_clocks;
+#define __HAL_RCC_SPI2_CLK_ENABLE() (host_rcc_clocks |= HOST_CLK_SPI2)
+#define __HAL_RCC_SPI2_CLK_DISABLE() (host_rcc_clocks &= ~HOST_CLK_SPI2)
+#define __HAL_RCC_ADC12_CLK_ENABLE() (host_rcc_clocks |= HOST_CLK_ADC)
+#define __HAL_RCC_ADC12_CLK_DISABLE() (host_rcc_clocks &= ~HOST_CLK_ADC)
+
+#define FLASH_LATENCY_0 0U
+#define FLASH_LATENCY_1 1U
+#define FLASH_LATENCY_2 2U
+
+/* The simulated clock tree checks every step against the frequency limits
+ * of the voltage range, the EPOD booster and the flash wait states. */
+HAL_StatusTypeDef HAL_RCC_OscConfig(const RCC_OscInitTypeDef *RCC_OscInitStruct);
+HAL_StatusTypeDef HAL_RCC_ClockConfig(const RCC_ClkInitTypeDef *RCC_ClkInitStruct, uint32_t FLatency);
+uint32_t HAL_RCC_GetHCLKFreq(void);
+uint32_t HAL_RCC_GetSysClockFreq(void);
+HAL_StatusTypeDef HAL_RCCEx_EpodBoosterClkConfig(uint32_t Source, uint32_t Divider);
+void HAL_RCCEx_StopWakeupSysclkConfig(uint32_t WakeupClk);
+
+/* PWR -----------------------------------------------------------------------*/
+#define PWR_LOWPOWERMODE_STOP2 0x00000002U
+#define PWR_LOWPOWERMODE_STOP3 0x00000003U
+#define PWR_STOPENTRY_WFI 0x01U
+#define PWR_REGULATOR_VOLTAGE_SCALE1 0x00010000U
+#define PWR_REGULATOR_VOLTAGE_SCALE2 0x00020000U
+
+HAL_StatusTypeDef HAL_PWREx_ControlVoltageScaling(uint32_t VoltageScaling);
+HAL_StatusTypeDef HAL_PWREx_EnableEpodBooster(void);
+HAL_StatusTypeDef HAL_PWREx_DisableEpodBooster(void);
+
+#define PWR_MAINREGULATOR_ON 0U
+#define PWR_SLEEPENTRY_WFI 1U
+
+void HAL_PWR_EnterSLEEPMode(uint32_t Regulator, uint8_t SLEEPEntry);
+void HAL_PWR_EnterSTOPMode(uint32_t Regulator, uint8_t STOPEntry);
+void HAL_PWR_EnableSleepOnExit(void);
+void HAL_PWR_DisableSleepOnExit(void);
+
+/* Only WKUP7 exists: PB15, the ON key row.  Stop 3 suspends the LPTIM and
+   EXTI; its wakeup pin edges raise PWR_IRQn, in any mode. */
+#define PWR_WAKEUP_LINE7 (1U << 6)
+#define PWR_WAKEUP_SELECT_0 0U
+#define PWR_WAKEUP_POLARITY_HIGH 0U
+#define PWR_WAKEUP_POLARITY_LOW 1U
+
+void HAL_PWR_EnableWakeUpLine(uint32_t WakeUpLine, uint32_t Selection, uint32_t Polarity);
+void HAL_PWR_DisableWakeUpLine(uint32_t WakeUpLine);
+void HAL_PWR_WKUP_IRQHandler(void);
+void HAL_PWR_WKUP7_Callback(void);
+
+#define PWR_SRAM1_FULL_STOP_RETENTION 0x0000007FU
+#define PWR_SRAM2_FULL_STOP_RETENTION 0x00000380U
+
+void HAL_PWREx_EnableRAMsContentStopRetention(uint32_t RAMSelection);
+void HAL_PWREx_DisableRAMsContentStopRetention(uint32_t RAMSelection);
+
+/* LPTIM ---------------------------------------------------------------------*/
+typedef struct
+{
+  volatile uint32_t ARR;
+} LPTIM_TypeDef;
+
+typedef struct
+{
+  uint32_t Period;
+} LPTIM_InitTypeDef;
+
+typedef struct
+{
+  LPTIM_TypeDef *Instance;
+  LPTIM_InitTypeDef Init;
+} LPTIM_HandleTypeDef;
+
+extern LPTIM_TypeDef host_lptim1;
+#define LPTIM1 (&host_lptim1)
+
+/* The simulated LPTIM counts the 32.768 kHz LSE from zero up to ARR and fires
+ * the auto-reload match callback when it wraps, while the CPU is in STOP mode.
+ * An ARR write takes effect at once; if the counter is already past it, the
+ * counter runs on to 0xFFFF first, as on the MCU. */
+HAL_StatusTypeDef HAL_LPTIM_Init(LPTIM_HandleTypeDef *hlptim);
+HAL_StatusTypeDef HAL_LPTIM_Counter_Start_IT(LPTIM_HandleTypeDef *hlptim);
+HAL_StatusTypeDef HAL_LPTIM_Counter_Stop_IT(LPTIM_HandleTypeDef *hlptim);
+uint32_t HAL_LPTIM_ReadCounter(const LPTIM_HandleTypeDef *hlptim);
+void HAL_LPTIM_AutoReloadMatchCallback(LPTIM_HandleTypeDef *hlptim);
+
+#define __HAL_LPTIM_AUTORELOAD_SET(__HANDLE__, __VALUE__) WRITE_REG((__HANDLE__)->Instance->ARR, (__VALUE__))
+
+/* Interrupts are delivered as soon as they are raised, never left pending */
+#define LPTIM_FLAG_ARRM 0x00000002U
+#define __HAL_LPTIM_GET_FLAG(__HANDLE__, __FLAG__) ((void)(__HANDLE__), (void)(__FLAG__), 0)
+
+/* SPI -----------------------------------------------------------------------*/
+typedef struct
+{
+  uint32_t Mode;
+  uint32_t Direction;
+  uint32_t DataSize;
+  uint32_t CLKPolarity;
+  uint32_t CLKPhase;
+  uint32_t NSS;
+  uint32_t BaudRatePrescaler;
+  uint32_t FirstBit;
+  uint32_t TIMode;
+  uint32_t CRCCalculation;
+  uint32_t CRCPolynomial;
+  uint32_t NSSPMode;
+  uint32_t NSSPolarity;
+  uint32_t FifoThreshold;
+  uint32_t MasterSSIdleness;
+  uint32_t MasterInterDataIdleness;
+  uint32_t MasterReceiverAutoSusp;
+  uint32_t MasterKeepIOState;
+  uint32_t IOSwap;
+  uint32_t ReadyMasterManagement;
+  uint32_t ReadyPolarity;
+} SPI_InitTypeDef;
+
+typedef struct
+{
+  void *Instance;
+  SPI_InitTypeDef Init;
+} SPI_HandleTypeDef;
+
+typedef struct
+{
+  uint32_t TriggerState;
+  uint32_t TriggerSelection;
+  uint32_t TriggerPolarity;
+} SPI_AutonomousModeConfTypeDef;
+
+#define SPI2 ((void *)0x40003800UL)
+#define SPI_MODE_MASTER 0x00400000U
+#define SPI_DIRECTION_1LINE 0x00060000U
+#define SPI_DATASIZE_8BIT 0x00000007U
+#define SPI_POLARITY_LOW 0x00000000U
+#define SPI_PHASE_1EDGE 0x00000000U
+#define SPI_NSS_SOFT 0x04000000U
+#define SPI_BAUDRATEPRESCALER_2 0x00000000U
+#define SPI_BAUDRATEPRESCALER_4 0x10000000U
+#define SPI_BAUDRATEPRESCALER_8 0x20000000U
+#define SPI_BAUDRATEPRESCALER_16 0x30000000U
+#define SPI_BAUDRATEPRESCALER_32 0x40000000U
+#define SPI_BAUDRATEPRESCALER_64 0x50000000U
+#define SPI_BAUDRATEPRESCALER_128 0x60000000U
+#define SPI_BAUDRATEPRESCALER_256 0x70000000U
+#define SPI_FIRSTBIT_LSB 0x00800000U
+#define SPI_TIMODE_DISABLE 0x00000000U
+#define SPI_CRCCALCULATION_DISABLE 0x00000000U
+#define SPI_NSS_PULSE_DISABLE 0x00000000U
+#define SPI_NSS_POLARITY_LOW 0x00000000U
+#define SPI_FIFO_THRESHOLD_01DATA 0x00000000U
+#define SPI_MASTER_SS_IDLENESS_00CYCLE 0x00000000U
+#define SPI_MASTER_INTERDATA_IDLENESS_00CYCLE 0x00000000U
+#define SPI_MASTER_RX_AUTOSUSP_DISABLE 0x00000000U
+#define SPI_MASTER_KEEP_IO_STATE_DISABLE 0x00000000U
+#define SPI_IO_SWAP_DISABLE 0x00000000U
+#define SPI_RDY_MASTER_MANAGEMENT_INTERNALLY 0x00000000U
+#define SPI_RDY_POLARITY_HIGH 0x00000000U
+#define SPI_AUTO_MODE_DISABLE 0x00000000U
+#define SPI_GRP1_GPDMA_CH0_TCF_TRG 0x00000000U
+#define SPI_TRIG_POLARITY_RISING 0x00000000U
+
+HAL_StatusTypeDef HAL_SPI_Init(SPI_HandleTypeDef *hspi);
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, const uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPIEx_SetConfigAutonomousMode(SPI_HandleTypeDef *hspi, const SPI_AutonomousModeConfTypeDef *sConfig);
+
+/* RTC -----------------------------------------------------------------------*/
+typedef struct __RTC_HandleTypeDef
+{
+  void *Instance;
+  void (*WakeUpTimerEventCallback)(struct __RTC_HandleTypeDef *hrtc);
+  void (*AlarmAEventCallback)(struct __RTC_HandleTypeDef *hrtc);
+} RTC_HandleTypeDef;
+
+typedef struct
+{
+  uint8_t Hours;
+  uint8_t Minutes;
+  uint8_t Seconds;
+  uint8_t TimeFormat;
+  uint32_t SubSeconds;
+  uint32_t SecondFraction;
+} RTC_TimeTypeDef;
+
+typedef struct
+{
+  uint8_t WeekDay;
+  uint8_t Month;
+  uint8_t Date;
+  uint8_t Year;
+} RTC_DateTypeDef;
+
+/* Calendar registers as read with the shadow registers bypassed: every
+   access returns the counters at that point of virtual time */
+typedef struct
+{
+  uint32_t TR;
+  uint32_t DR;
+  uint32_t SSR;
+} RTC_TypeDef;
+
+RTC_TypeDef *host_rtc(void);
+#define RTC (host_rtc())
+
+#define RTC_TR_SU_Pos 0U
+#define RTC_TR_SU 0x0000000FU
+#define RTC_TR_ST 0x00000070U
+#define RTC_TR_MNU_Pos 8U
+#define RTC_TR_MNU 0x00000F00U
+#define RTC_TR_MNT 0x00007000U
+#define RTC_TR_HU_Pos 16U
+#define RTC_TR_HU 0x000F0000U
+#define RTC_TR_HT 0x00300000U
+#define RTC_DR_DU_Pos 0U
+#define RTC_DR_DU 0x0000000FU
+#define RTC_DR_DT 0x00000030U
+#define RTC_DR_MU_Pos 8U
+#define RTC_DR_MU 0x00000F00U
+#define RTC_DR_MT 0x00001000U
+#define RTC_DR_WDU_Pos 13U
+#define RTC_DR_WDU 0x0000E000U
+#define RTC_DR_YU_Pos 16U
+#define RTC_DR_YU 0x000F0000U
+#define RTC_DR_YT 0x00F00000U
+
+typedef struct
+{
+  RTC_TimeTypeDef AlarmTime;
+  uint32_t AlarmMask;
+  uint32_t AlarmSubSecondMask;
+  uint32_t AlarmDateWeekDaySel;
+  uint8_t AlarmDateWeekDay;
+  uint32_t Alarm;
+} RTC_AlarmTypeDef;
+
+typedef enum
+{
+  HAL_RTC_ALARM_A_EVENT_CB_ID = 0x00U,
+  HAL_RTC_WAKEUPTIMER_EVENT_CB_ID = 0x04U
+} HAL_RTC_CallbackIDTypeDef;
+
+typedef void (*pRTC_CallbackTypeDef)(RTC_HandleTypeDef *hrtc);
+
+#define RTC_FORMAT_BIN 0x00000000U
+#define RTC_WAKEUPCLOCK_RTCCLK_DIV16 0x00000000U
+#define RTC_WAKEUPCLOCK_RTCCLK_DIV8 0x00000001U
+#define RTC_ALARM_A 0x00000100U
+#define RTC_ALARMMASK_DATEWEEKDAY 0x80000000U
+#define RTC_ALARMSUBSECONDMASK_ALL 0x00000000U
+#define RTC_ALARMDATEWEEKDAYSEL_DATE 0x00000000U
+
+HAL_StatusTypeDef HAL_RTC_GetTime(RTC_HandleTypeDef *hrtc, RTC_TimeTypeDef *sTime, uint32_t Format);
+HAL_StatusTypeDef HAL_RTC_GetDate(RTC_HandleTypeDef *hrtc, RTC_DateTypeDef *sDate, uint32_t Format);
+HAL_StatusTypeDef HAL_RTC_RegisterCallback(RTC_HandleTypeDef *hrtc, HAL_RTC_CallbackIDTypeDef CallbackID,
+                                           pRTC_CallbackTypeDef pCallback);
+HAL_StatusTypeDef HAL_RTCEx_SetWakeUpTimer_IT(RTC_HandleTypeDef *hrtc, uint32_t WakeUpCounter, uint32_t WakeUpClock,
+                                              uint32_t WakeUpAutoClr);
+HAL_StatusTypeDef HAL_RTCEx_DeactivateWakeUpTimer(RTC_HandleTypeDef *hrtc);
+
+/* Alarm A fires when the time of day reaches the alarm time (date masked),
+   waking up STOP and SLEEP mode like the other interrupts */
+HAL_StatusTypeDef HAL_RTC_SetAlarm_IT(RTC_HandleTypeDef *hrtc, const RTC_AlarmTypeDef *sAlarm, uint32_t Format);
+HAL_StatusTypeDef HAL_RTC_DeactivateAlarm(RTC_HandleTypeDef *hrtc, uint32_t Alarm);
+
+/* ADC -----------------------------------------------------------------------*/
+typedef struct
+{
+  void *Instance;
+} ADC_HandleTypeDef;
+
+/* HAL_ADC_Start() completes the conversion at once.  HAL_ADC_Start_IT() ends
+   it HOST_ADC_CONV_NS later with the conversion complete callback, and needs
+   HCLK meanwhile: entering STOP with it running is a clock violation. */
+#define ADC_FLAG_EOC 0x04U
+#define __HAL_ADC_GET_FLAG(__HANDLE__, __FLAG__) (host_adc_flags & (__FLAG__) ? 1U : 0U)
+extern uint32_t host_adc_flags;
+#define HOST_ADC_CONV_NS 600000ULL
+
+HAL_StatusTypeDef HAL_ADC_Start(ADC_HandleTypeDef *hadc);
+HAL_StatusTypeDef HAL_ADC_Stop(ADC_HandleTypeDef *hadc);
+HAL_StatusTypeDef HAL_ADC_Start_IT(ADC_HandleTypeDef *hadc);
+HAL_StatusTypeDef HAL_ADC_Stop_IT(ADC_HandleTypeDef *hadc);
+HAL_StatusTypeDef HAL_ADC_PollForConversion(ADC_HandleTypeDef *hadc, uint32_t Timeout);
+uint32_t HAL_ADC_GetValue(const ADC_HandleTypeDef *hadc);
+void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef *hadc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __STM32U3xx_HAL_H */
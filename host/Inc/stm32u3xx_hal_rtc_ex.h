@@ -0,0 +1,12 @@
+/*
+ * stm32u3xx_hal_rtc_ex.h (host)
+ *
+ * Forwards to the host HAL stand-in, see stm32u3xx_hal.h.
+ */
+
+#ifndef __STM32U3XX_HAL_RTC_EX_H
+#define __STM32U3XX_HAL_RTC_EX_H
+
+#include "stm32u3xx_hal.h"
+
+#endif /* __STM32U3XX_HAL_RTC_EX_H */
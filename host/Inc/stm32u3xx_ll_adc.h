@@ -0,0 +1,15 @@
+/*
+ * stm32u3xx_ll_adc.h (host)
+ *
+ * Only provides the factory calibration address used by vbat_sample().
+ */
+
+#ifndef __STM32U3xx_LL_ADC_H
+#define __STM32U3xx_LL_ADC_H
+
+#include "stm32u3xx_hal.h"
+
+extern uint16_t host_vrefint_cal;
+#define VREFINT_CAL_ADDR (&host_vrefint_cal)
+
+#endif /* __STM32U3xx_LL_ADC_H */
@@ -0,0 +1,1051 @@
+/*
+ * hal_shim.c
+ *
+ * Host (Linux) implementation of the subset of the STM32U3xx HAL used by
+ * liborcos.  See host/Inc/stm32u3xx_hal.h for what is being simulated.
+ */
+
+#include "stm32u3xx_hal.h"
+#include "host.h"
+#include "pin_definitions.h"
+#include "orcos.h"
+#include "io.h"
+#include "keyboard.h"
+#include "power.h"
+#include "sharp_lowlevel.h"
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+uint32_t SystemCoreClock = 16000000U;
+GPIO_TypeDef host_gpio[8];
+EXTI_TypeDef host_exti;
+NVIC_Type host_nvic;
+SCB_Type host_scb;
+uint16_t host_vrefint_cal = 1650;
+
+/* Handles normally owned by orcos.c, which is not part of the host build */
+ADC_HandleTypeDef hadc1;
+RTC_HandleTypeDef hrtc;
+
+static uint64_t time_ns;
+static bool sleep_on_exit;
+static bool irq_taken;
+static void (*idle_hook)(uint32_t now_us);
+static LPTIM_HandleTypeDef *lptim_running;
+static uint64_t lptim_start_ns; // Counter at zero
+static uint64_t lptim_next_ns;  // Counter wraps
+static uint32_t lptim_interrupts;
+static void lptim_schedule(void);
+static uint32_t nvic_enabled[4];
+static uint32_t exti_rising_pending;
+static uint32_t exti_falling_pending;
+static bool key_down[NUM_ROW_PINS][NUM_COLUMN_PINS];
+static uint32_t port_resets[8];
+static uint32_t irq_active; // Nesting of interrupts being delivered
+static bool stop3;                   // In Stop 3: no LPTIM, no EXTI
+static uint32_t wakeup_lines;        // PWR_WAKEUP_LINEx enabled
+static uint32_t wakeup_low;          // Of those, active on a falling edge
+static uint32_t wakeup_flags;        // Edges seen, until HAL_PWR_WKUP_IRQHandler()
+static uint32_t ram_stop_retained = PWR_SRAM1_FULL_STOP_RETENTION | PWR_SRAM2_FULL_STOP_RETENTION;
+static RTC_HandleTypeDef *rtc_alarm; // Alarm A armed on this handle
+static uint64_t rtc_alarm_ns;        // Next match of alarm A
+static RTC_HandleTypeDef *rtc_wakeup; // Wakeup timer running on this handle
+static uint64_t rtc_wakeup_ns;       // Its next event
+static uint64_t rtc_wakeup_period_ns;
+static int rtc_busy;                 // HAL_RTC_SetAlarm_IT() calls left to fail
+static ADC_HandleTypeDef *adc_running; // HAL_ADC_Start_IT() conversion on this handle
+static uint64_t adc_done_ns;         // Its end of conversion
+
+/* GPIO ----------------------------------------------------------------------*/
+
+static int port_index(const GPIO_TypeDef *GPIOx)
+{
+  return (int)(GPIOx - host_gpio);
+}
+
+static int pin_index(uint16_t pin)
+{
+  return __builtin_ctz(pin);
+}
+
+static bool irq_enabled(int irq)
+{
+  return (nvic_enabled[irq >> 5] >> (irq & 31)) & 1;
+}
+
+static bool column_driven_low(size_t column)
+{
+  const gpio_pin_t *col = &column_pin_array[column];
+  uint32_t mode = (col->port->MODER >> (2 * pin_index(col->pin))) & GPIO_MODER_MODE0;
+  return mode == 1 && (col->port->ODR & col->pin) == 0; // General purpose output
+}
+
+/**
+ * An edge sets the EXTI pending flag of its line if the line is routed to the
+ * pin's port and the edge is selected; the callback runs if the line is
+ * unmasked in EXTI and its interrupt is enabled in the NVIC.
+ */
+static void exti_raise(const gpio_pin_t *pin, bool falling)
+{
+  int line = pin_index(pin->pin);
+  uint32_t bit = 1U << line;
+  uint32_t port = (EXTI->EXTICR[line >> 2] >> (8 * (line & 3))) & 0xFF;
+
+  if (stop3 || port != (uint32_t)port_index(pin->port) || !((falling ? EXTI->FTSR1 : EXTI->RTSR1) & bit))
+    return;
+  if (falling)
+    EXTI->FPR1 = exti_falling_pending |= bit;
+  else
+    EXTI->RPR1 = exti_rising_pending |= bit;
+  if (!(EXTI->IMR1 & bit) || !irq_enabled(EXTI0_IRQn + line))
+    return;
+
+  // HAL_GPIO_EXTI_IRQHandler(): clear the flag, then call back
+  irq_taken = true;
+  irq_active++;
+  sys_power_irq_enter(SYS_WAKE_EXTI(line));
+  if (falling)
+  {
+    EXTI->FPR1 = exti_falling_pending &= ~bit;
+    HAL_GPIO_EXTI_Falling_Callback(pin->pin);
+  }
+  else
+  {
+    EXTI->RPR1 = exti_rising_pending &= ~bit;
+    HAL_GPIO_EXTI_Rising_Callback(pin->pin);
+  }
+  sys_power_irq_exit();
+  irq_active--;
+}
+
+/**
+ * Recompute every IDR from the output latches and the keyboard matrix.
+ * A row reads low when a closed key connects it to a column driven low.
+ * Rising/falling row edges are delivered to the EXTI callbacks when the
+ * pin is in interrupt mode and its NVIC line is enabled.
+ */
+static void gpio_update(void)
+{
+  uint32_t old_rows = GPIOB->IDR;
+
+  for (int p = 0; p < 8; p++)
+    host_gpio[p].IDR = host_gpio[p].ODR;
+
+  for (size_t row = 0; row < NUM_ROW_PINS; row++)
+  {
+    const gpio_pin_t *r = &row_pin_array[row];
+    bool low = false;
+    for (size_t column = 0; column < NUM_COLUMN_PINS; column++)
+    {
+      if (key_down[row][column] && column_driven_low(column))
+        low = true;
+    }
+    if (low)
+      r->port->IDR &= ~(uint32_t)r->pin;
+    else
+      r->port->IDR |= r->pin;
+  }
+
+  for (size_t row = 0; row < NUM_ROW_PINS; row++)
+  {
+    const gpio_pin_t *r = &row_pin_array[row];
+    uint32_t was = old_rows & r->pin;
+    uint32_t now = r->port->IDR & r->pin;
+    if (was && !now)
+      exti_raise(r, true);
+    else if (!was && now)
+      exti_raise(r, false);
+  }
+
+  // WKUP7 is the ON key row
+  uint32_t was = old_rows & GPIO_PIN_15;
+  uint32_t now = GPIOB->IDR & GPIO_PIN_15;
+  if ((wakeup_lines & PWR_WAKEUP_LINE7) && was != now && !now == !!(wakeup_low & PWR_WAKEUP_LINE7))
+  {
+    wakeup_flags |= PWR_WAKEUP_LINE7;
+    if (irq_enabled(PWR_IRQn))
+    {
+      irq_taken = true;
+      irq_active++;
+      sys_power_irq_enter(SYS_WAKE_WKUP);
+      HAL_PWR_WKUP_IRQHandler();
+      sys_power_irq_exit();
+      irq_active--;
+    }
+  }
+}
+
+/* Fields of the HAL GPIO_MODE_* values */
+#define GPIO_MODE_MASK 0x00000003U
+#define GPIO_OUTPUT_TYPE 0x00000010U
+#define GPIO_EXTI_MODE 0x10000000U
+#define GPIO_EXTI_IT 0x00010000U
+#define GPIO_TRIGGER_RISING 0x00100000U
+#define GPIO_TRIGGER_FALLING 0x00200000U
+
+/* Same register programming as the HAL: EXTI is only touched for IT modes */
+void HAL_GPIO_Init(GPIO_TypeDef *GPIOx, const GPIO_InitTypeDef *pGPIO_Init)
+{
+  uint32_t mode = pGPIO_Init->Mode;
+
+  for (int i = 0; i < 16; i++)
+  {
+    uint32_t bit = 1U << i;
+    if (!(pGPIO_Init->Pin & bit))
+      continue;
+
+    GPIOx->MODER = (GPIOx->MODER & ~(GPIO_MODER_MODE0 << (2 * i))) | ((mode & GPIO_MODE_MASK) << (2 * i));
+    GPIOx->OTYPER = (GPIOx->OTYPER & ~bit) | ((mode & GPIO_OUTPUT_TYPE) ? bit : 0);
+    GPIOx->PUPDR = (GPIOx->PUPDR & ~(GPIO_PUPDR_PUPD0 << (2 * i))) | (pGPIO_Init->Pull << (2 * i));
+
+    if (mode & GPIO_EXTI_MODE)
+    {
+      uint32_t shift = 8 * (i & 3);
+      EXTI->EXTICR[i >> 2] = (EXTI->EXTICR[i >> 2] & ~(0xFFU << shift)) | ((uint32_t)port_index(GPIOx) << shift);
+      EXTI->RTSR1 = (mode & GPIO_TRIGGER_RISING) ? (EXTI->RTSR1 | bit) : (EXTI->RTSR1 & ~bit);
+      EXTI->FTSR1 = (mode & GPIO_TRIGGER_FALLING) ? (EXTI->FTSR1 | bit) : (EXTI->FTSR1 & ~bit);
+      EXTI->IMR1 = (mode & GPIO_EXTI_IT) ? (EXTI->IMR1 | bit) : (EXTI->IMR1 & ~bit);
+    }
+  }
+  gpio_update();
+}
+
+void host_reg_written(volatile uint32_t *reg)
+{
+  // Write-1-to-set/clear registers keep their state in a shadow
+  for (int i = 0; i < 4; i++)
+  {
+    if (reg == &NVIC->ISER[i] || reg == &NVIC->ICER[i])
+    {
+      if (reg == &NVIC->ISER[i])
+        nvic_enabled[i] |= *reg;
+      else
+        nvic_enabled[i] &= ~*reg;
+      NVIC->ISER[i] = NVIC->ICER[i] = nvic_enabled[i];
+      return;
+    }
+    if (reg == &NVIC->ISPR[i] || reg == &NVIC->ICPR[i])
+    {
+      *reg = 0; // Interrupts are never left pending
+      return;
+    }
+  }
+  if (reg == &LPTIM1->ARR)
+  {
+    if (lptim_running)
+      lptim_schedule();
+    return;
+  }
+  if (reg == &EXTI->RPR1)
+  {
+    EXTI->RPR1 = exti_rising_pending &= ~*reg;
+    return;
+  }
+  if (reg == &EXTI->FPR1)
+  {
+    EXTI->FPR1 = exti_falling_pending &= ~*reg;
+    return;
+  }
+
+  for (int p = 0; p < 8; p++)
+  {
+    GPIO_TypeDef *port = &host_gpio[p];
+    if (reg == &port->BSRR)
+    {
+      // Set bits win over reset bits, as on the real port
+      port->ODR = (port->ODR & ~(port->BSRR >> 16)) | (port->BSRR & 0xFFFF);
+      port->BSRR = 0;
+    }
+    else if (reg == &port->BRR)
+    {
+      port_resets[p]++;
+      port->ODR &= ~port->BRR;
+      port->BRR = 0;
+    }
+    else
+      continue;
+    gpio_update();
+    return;
+  }
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(const GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+  return (GPIOx->IDR & GPIO_Pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+  uint32_t old = GPIOx->ODR;
+
+  if (PinState == GPIO_PIN_SET)
+    GPIOx->ODR |= GPIO_Pin;
+  else
+    GPIOx->ODR &= ~(uint32_t)GPIO_Pin;
+
+  if (GPIOx == display_cs.port && (GPIO_Pin & display_cs.pin) &&
+      ((old ^ GPIOx->ODR) & display_cs.pin))
+    sharp_panel_cs(PinState == GPIO_PIN_SET);
+
+  gpio_update();
+}
+
+void HAL_GPIO_TogglePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+  GPIOx->ODR ^= GPIO_Pin;
+  gpio_update();
+}
+
+void host_key_down(uint16_t keycode)
+{
+  if (keycode == 0 || keycode > NUM_ROW_PINS * NUM_COLUMN_PINS)
+    return;
+  key_down[(keycode - 1) / NUM_COLUMN_PINS][(keycode - 1) % NUM_COLUMN_PINS] = true;
+  gpio_update();
+}
+
+void host_key_up(uint16_t keycode)
+{
+  if (keycode == 0 || keycode > NUM_ROW_PINS * NUM_COLUMN_PINS)
+    return;
+  key_down[(keycode - 1) / NUM_COLUMN_PINS][(keycode - 1) % NUM_COLUMN_PINS] = false;
+  gpio_update();
+}
+
+uint32_t host_port_resets(const GPIO_TypeDef *port)
+{
+  return port_resets[port_index(port)];
+}
+
+void host_key_up_all(void)
+{
+  for (size_t row = 0; row < NUM_ROW_PINS; row++)
+    for (size_t column = 0; column < NUM_COLUMN_PINS; column++)
+      key_down[row][column] = false;
+  gpio_update();
+}
+
+/* Cortex / NVIC -------------------------------------------------------------*/
+
+void HAL_NVIC_SetPriority(IRQn_Type IRQn, uint32_t PreemptPriority, uint32_t SubPriority)
+{
+  (void)IRQn;
+  (void)PreemptPriority;
+  (void)SubPriority;
+}
+
+void HAL_NVIC_EnableIRQ(IRQn_Type IRQn)
+{
+  WRITE_REG(NVIC->ISER[IRQn >> 5], 1U << (IRQn & 31));
+}
+
+void HAL_NVIC_DisableIRQ(IRQn_Type IRQn)
+{
+  WRITE_REG(NVIC->ICER[IRQn >> 5], 1U << (IRQn & 31));
+}
+
+void HAL_NVIC_SystemReset(void)
+{
+  fprintf(stderr, "orcos_host: system reset requested\n");
+  exit(0);
+}
+
+uint32_t HAL_SYSTICK_Config(uint32_t TicksNumb)
+{
+  (void)TicksNumb;
+  return 0;
+}
+
+/* HAL core ------------------------------------------------------------------*/
+
+HAL_StatusTypeDef HAL_Init(void)
+{
+  time_ns = 0;
+  return HAL_OK;
+}
+
+uint32_t HAL_GetTick(void)
+{
+  return time_ns / 1000000;
+}
+
+static void time_step(uint64_t limit);
+
+/* Busy wait: virtual time passes and interrupts are taken meanwhile */
+void HAL_Delay(uint32_t Delay)
+{
+  uint64_t end = time_ns + (uint64_t)Delay * 1000000;
+  while (time_ns < end)
+    time_step(end);
+}
+
+void HAL_SuspendTick(void) {}
+void HAL_ResumeTick(void) {}
+void HAL_DBGMCU_EnableDBGStopMode(void) {}
+
+uint32_t host_time_us(void)
+{
+  return time_ns / 1000;
+}
+
+void host_set_idle_hook(void (*hook)(uint32_t now_us))
+{
+  idle_hook = hook;
+}
+
+/* RCC -----------------------------------------------------------------------*/
+
+/* Clock tree as left by SystemClock_Config(): HSI16, range 1, no wait state,
+   waking up from STOP on HSI16 */
+static uint32_t sysclk_source = RCC_SYSCLKSOURCE_HSI;
+static uint32_t msis_hz = 12000000U;
+static bool msis_on = true;
+static uint32_t flash_latency = FLASH_LATENCY_0;
+static uint32_t voltage_scale = PWR_REGULATOR_VOLTAGE_SCALE1;
+static uint32_t booster_source = RCC_EPODBOOSTER_SOURCE_NONE;
+static bool booster_on;
+static uint32_t booster_starts;
+static uint32_t stop_wakeup = RCC_STOP_WKUP_SYSCLK_HSI;
+static uint32_t clock_violations;
+uint32_t host_adcdac_div = RCC_ADCDACCLK_DIV16;
+uint32_t host_rcc_clocks = HOST_CLK_SPI2 | HOST_CLK_ADC;
+
+static void clock_violation(const char *what)
+{
+  fprintf(stderr, "orcos_host: clock tree: %s at %u Hz\n", what, (unsigned)SystemCoreClock);
+  clock_violations++;
+}
+
+/* Every intermediate state must be within the limits of the datasheet */
+static void clock_check(void)
+{
+  bool range1 = voltage_scale == PWR_REGULATOR_VOLTAGE_SCALE1;
+  uint32_t max_hz = range1 ? 96000000U : 48000000U;
+  uint32_t per_ws_hz = range1 ? 32000000U : 16000000U;
+
+  if (SystemCoreClock > max_hz)
+    clock_violation("HCLK above the voltage range maximum");
+  if (SystemCoreClock > 24000000U && !booster_on)
+    clock_violation("HCLK above 24 MHz without the EPOD booster");
+  if (SystemCoreClock > (flash_latency + 1) * per_ws_hz)
+    clock_violation("too few flash wait states");
+}
+
+static void sysclk_select(uint32_t source)
+{
+  if (source == RCC_SYSCLKSOURCE_MSIS && !msis_on)
+    clock_violation("MSIS selected while stopped");
+  sysclk_source = source;
+  SystemCoreClock = source == RCC_SYSCLKSOURCE_MSIS ? msis_hz : 16000000U;
+  clock_check();
+}
+
+HAL_StatusTypeDef HAL_RCC_OscConfig(const RCC_OscInitTypeDef *RCC_OscInitStruct)
+{
+  if (!(RCC_OscInitStruct->OscillatorType & RCC_OSCILLATORTYPE_MSIS))
+    return HAL_OK;
+  if (sysclk_source == RCC_SYSCLKSOURCE_MSIS)
+  {
+    clock_violation("MSIS reconfigured while it is SYSCLK");
+    return HAL_ERROR;
+  }
+  uint32_t rc_hz = RCC_OscInitStruct->MSISSource == RCC_MSI_RC0 ? 96000000U : 24000000U;
+  msis_hz = rc_hz >> RCC_OscInitStruct->MSISDiv;
+  msis_on = true;
+  return HAL_OK;
+}
+
+/* Wait states go up before a faster clock and down after a slower one */
+HAL_StatusTypeDef HAL_RCC_ClockConfig(const RCC_ClkInitTypeDef *RCC_ClkInitStruct, uint32_t FLatency)
+{
+  if (FLatency > flash_latency)
+  {
+    flash_latency = FLatency;
+    clock_check();
+  }
+  if (RCC_ClkInitStruct->ClockType & RCC_CLOCKTYPE_SYSCLK)
+    sysclk_select(RCC_ClkInitStruct->SYSCLKSource);
+  if (FLatency < flash_latency)
+  {
+    flash_latency = FLatency;
+    clock_check();
+  }
+  return HAL_OK;
+}
+
+uint32_t HAL_RCC_GetHCLKFreq(void)
+{
+  return SystemCoreClock;
+}
+
+/* From the clock tree itself, not SystemCoreClock */
+uint32_t HAL_RCC_GetSysClockFreq(void)
+{
+  return sysclk_source == RCC_SYSCLKSOURCE_MSIS ? msis_hz : 16000000U;
+}
+
+HAL_StatusTypeDef HAL_RCCEx_EpodBoosterClkConfig(uint32_t Source, uint32_t Divider)
+{
+  (void)Divider;
+  if (booster_on)
+  {
+    clock_violation("EPOD booster clock changed while enabled");
+    return HAL_ERROR;
+  }
+  booster_source = Source;
+  return HAL_OK;
+}
+
+void HAL_RCCEx_StopWakeupSysclkConfig(uint32_t WakeupClk)
+{
+  stop_wakeup = WakeupClk;
+}
+
+uint32_t host_clock_violations(void)
+{
+  return clock_violations;
+}
+
+uint32_t host_booster_starts(void)
+{
+  return booster_starts;
+}
+
+/* PWR -----------------------------------------------------------------------*/
+
+HAL_StatusTypeDef HAL_PWREx_ControlVoltageScaling(uint32_t VoltageScaling)
+{
+  voltage_scale = VoltageScaling;
+  clock_check();
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PWREx_EnableEpodBooster(void)
+{
+  if (booster_source == RCC_EPODBOOSTER_SOURCE_NONE)
+    return HAL_ERROR;
+  if (!booster_on)
+    booster_starts++;
+  booster_on = true;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PWREx_DisableEpodBooster(void)
+{
+  booster_on = false;
+  clock_check();
+  return HAL_OK;
+}
+
+#define SLEEP_STEP_NS 100000ULL                  // idle hook granularity
+#define SLEEP_LIMIT_NS (25 * 3600 * 1000000000ULL) // give up on a sleep nothing ends, past a daily alarm
+
+/**
+ * Advance virtual time by one step, at most to limit: up to the next LPTIM
+ * tick, RTC alarm or RTC wakeup, and by no more than SLEEP_STEP_NS while an
+ * idle hook is set.  Runs the idle hook and the LPTIM and RTC interrupts.
+ */
+static void time_step(uint64_t limit)
+{
+  uint64_t next = time_ns + (idle_hook ? SLEEP_STEP_NS : SLEEP_LIMIT_NS);
+  if (lptim_running && lptim_next_ns < next)
+    next = lptim_next_ns;
+  if (rtc_alarm && rtc_alarm_ns < next)
+    next = rtc_alarm_ns;
+  if (rtc_wakeup && rtc_wakeup_ns < next)
+    next = rtc_wakeup_ns;
+  if (adc_running && adc_done_ns < next)
+    next = adc_done_ns;
+  if (limit < next)
+    next = limit;
+  time_ns = next;
+
+  if (idle_hook)
+    idle_hook(host_time_us());
+  if (lptim_running && time_ns >= lptim_next_ns)
+  {
+    lptim_start_ns = lptim_next_ns;
+    lptim_schedule();
+    lptim_interrupts++;
+    irq_taken = true;
+    irq_active++;
+    sys_power_irq_enter(SYS_WAKE_LPTIM);
+    HAL_LPTIM_AutoReloadMatchCallback(lptim_running);
+    sys_power_irq_exit();
+    irq_active--;
+  }
+  if (rtc_alarm && time_ns >= rtc_alarm_ns)
+  {
+    RTC_HandleTypeDef *hrtc = rtc_alarm;
+    rtc_alarm_ns += 86400 * 1000000000ULL; // Same time tomorrow, date masked
+    irq_taken = true;
+    irq_active++;
+    sys_power_irq_enter(SYS_WAKE_RTC_ALARM);
+    if (hrtc->AlarmAEventCallback)
+      hrtc->AlarmAEventCallback(hrtc);
+    sys_power_irq_exit();
+    irq_active--;
+  }
+  if (rtc_wakeup && time_ns >= rtc_wakeup_ns)
+  {
+    RTC_HandleTypeDef *hrtc = rtc_wakeup;
+    rtc_wakeup_ns += rtc_wakeup_period_ns;
+    irq_taken = true;
+    irq_active++;
+    sys_power_irq_enter(SYS_WAKE_RTC_WAKEUP);
+    if (hrtc->WakeUpTimerEventCallback)
+      hrtc->WakeUpTimerEventCallback(hrtc);
+    sys_power_irq_exit();
+    irq_active--;
+  }
+  if (adc_running && time_ns >= adc_done_ns)
+  {
+    // Taken in SLEEP: no wakeup for the power statistics
+    ADC_HandleTypeDef *hadc = adc_running;
+    adc_running = NULL;
+    host_adc_flags |= ADC_FLAG_EOC;
+    irq_taken = true;
+    irq_active++;
+    HAL_ADC_ConvCpltCallback(hadc);
+    irq_active--;
+  }
+}
+
+uint32_t host_ipsr(void)
+{
+  return irq_active ? 16 : 0; // Any exception number will do
+}
+
+/* WFI in SLEEP mode: step virtual time up to the next interrupt */
+void HAL_PWR_EnterSLEEPMode(uint32_t Regulator, uint8_t SLEEPEntry)
+{
+  uint64_t start = time_ns;
+
+  (void)Regulator;
+  (void)SLEEPEntry;
+  host_scb.SCR &= ~SCB_SCR_SLEEPDEEP_Msk;
+  irq_taken = false;
+  while (!irq_taken)
+  {
+    time_step(UINT64_MAX);
+    if (time_ns - start > SLEEP_LIMIT_NS)
+    {
+      fprintf(stderr, "orcos_host: nothing ended SLEEP mode, waking up\n");
+      break;
+    }
+  }
+}
+
+/**
+ * WFI: step virtual time, letting the idle hook and the LPTIM raise
+ * interrupts.  Returns after an interrupt, unless sleep-on-exit sends the
+ * core straight back to sleep when the handler completes.
+ */
+void HAL_PWR_EnterSTOPMode(uint32_t StopMode, uint8_t STOPEntry)
+{
+  uint64_t start = time_ns;
+  LPTIM_HandleTypeDef *lptim_frozen = NULL;
+
+  (void)STOPEntry;
+  if (!(ram_stop_retained & PWR_SRAM1_FULL_STOP_RETENTION))
+    fprintf(stderr, "orcos_host: STOP entered with SRAM1 not retained\n");
+
+  // Stop 3 runs nothing but the RTC: the LPTIM counter holds its value
+  stop3 = StopMode == PWR_LOWPOWERMODE_STOP3;
+  if (stop3)
+  {
+    lptim_frozen = lptim_running;
+    lptim_running = NULL;
+  }
+
+  // The core wakes up on the STOP wakeup clock, with the rest of the tree
+  // kept but the MSIS stopped unless it is that clock
+  sysclk_select(stop_wakeup == RCC_STOP_WKUP_SYSCLK_HSI ? RCC_SYSCLKSOURCE_HSI : RCC_SYSCLKSOURCE_MSIS);
+  msis_on = stop_wakeup == RCC_STOP_WKUP_SYSCLK_MSIS;
+  host_scb.SCR |= SCB_SCR_SLEEPDEEP_Msk;
+  do
+  {
+    // Back from a handler with SLEEPDEEP clear, the core is in SLEEP instead
+    if (adc_running && (host_scb.SCR & SCB_SCR_SLEEPDEEP_Msk))
+      clock_violation("ADC conversion left running in STOP");
+    irq_taken = false;
+    time_step(UINT64_MAX);
+
+    if (time_ns - start > SLEEP_LIMIT_NS)
+    {
+      fprintf(stderr, "orcos_host: nothing ended STOP mode, waking up\n");
+      break;
+    }
+  } while (!irq_taken || sleep_on_exit);
+
+  if (lptim_frozen)
+  {
+    lptim_start_ns += time_ns - start;
+    lptim_next_ns += time_ns - start;
+    lptim_running = lptim_frozen;
+  }
+  stop3 = false;
+  host_scb.SCR &= ~SCB_SCR_SLEEPDEEP_Msk;
+}
+
+void HAL_PWR_EnableWakeUpLine(uint32_t WakeUpLine, uint32_t Selection, uint32_t Polarity)
+{
+  (void)Selection;
+  wakeup_lines |= WakeUpLine;
+  wakeup_low = Polarity == PWR_WAKEUP_POLARITY_LOW ? wakeup_low | WakeUpLine : wakeup_low & ~WakeUpLine;
+}
+
+void HAL_PWR_DisableWakeUpLine(uint32_t WakeUpLine)
+{
+  wakeup_lines &= ~WakeUpLine;
+}
+
+void HAL_PWR_WKUP_IRQHandler(void)
+{
+  uint32_t flags = wakeup_flags;
+  wakeup_flags = 0;
+  if (flags & PWR_WAKEUP_LINE7)
+    HAL_PWR_WKUP7_Callback();
+}
+
+void HAL_PWREx_EnableRAMsContentStopRetention(uint32_t RAMSelection)
+{
+  ram_stop_retained |= RAMSelection;
+}
+
+void HAL_PWREx_DisableRAMsContentStopRetention(uint32_t RAMSelection)
+{
+  ram_stop_retained &= ~RAMSelection;
+}
+
+void HAL_PWR_EnableSleepOnExit(void)
+{
+  sleep_on_exit = true;
+}
+
+void HAL_PWR_DisableSleepOnExit(void)
+{
+  sleep_on_exit = false;
+}
+
+/* LPTIM ---------------------------------------------------------------------*/
+
+LPTIM_TypeDef host_lptim1;
+
+static uint64_t lptim_cycles_ns(uint64_t cycles)
+{
+  return cycles * 1000000000ULL / 32768;
+}
+
+// Next wrap of the running counter, from its start and ARR
+static void lptim_schedule(void)
+{
+  lptim_next_ns = lptim_start_ns + lptim_cycles_ns(lptim_running->Instance->ARR + 1ULL);
+  if (lptim_next_ns <= time_ns)
+    lptim_next_ns = lptim_start_ns + lptim_cycles_ns(0x10000); // Missed: full range
+}
+
+HAL_StatusTypeDef HAL_LPTIM_Init(LPTIM_HandleTypeDef *hlptim)
+{
+  hlptim->Instance->ARR = hlptim->Init.Period;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_LPTIM_Counter_Start_IT(LPTIM_HandleTypeDef *hlptim)
+{
+  lptim_running = hlptim;
+  lptim_start_ns = time_ns;
+  lptim_schedule();
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_LPTIM_Counter_Stop_IT(LPTIM_HandleTypeDef *hlptim)
+{
+  if (lptim_running == hlptim)
+    lptim_running = NULL;
+  return HAL_OK;
+}
+
+uint32_t HAL_LPTIM_ReadCounter(const LPTIM_HandleTypeDef *hlptim)
+{
+  if (lptim_running != hlptim)
+    return 0;
+  return (time_ns - lptim_start_ns) * 32768 / 1000000000ULL;
+}
+
+uint32_t host_lptim_interrupts(void)
+{
+  return lptim_interrupts;
+}
+
+/* DWT -----------------------------------------------------------------------*/
+
+DCB_Type host_dcb;
+static DWT_Type dwt;
+
+DWT_Type *host_dwt(void)
+{
+  if ((host_dcb.DEMCR & DCB_DEMCR_TRCENA_Msk) && (dwt.CTRL & DWT_CTRL_CYCCNTENA_Msk))
+    dwt.CYCCNT += HOST_DWT_CYCLES_PER_READ;
+  return &dwt;
+}
+
+/* SPI -----------------------------------------------------------------------*/
+
+HAL_StatusTypeDef HAL_SPI_Init(SPI_HandleTypeDef *hspi)
+{
+  (void)hspi;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, const uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+  (void)Timeout;
+  if (!(host_rcc_clocks & HOST_CLK_SPI2))
+    clock_violation("SPI2 used with its clock gated");
+  if (hspi->Instance == SPI2)
+    sharp_panel_write(pData, Size);
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPIEx_SetConfigAutonomousMode(SPI_HandleTypeDef *hspi, const SPI_AutonomousModeConfTypeDef *sConfig)
+{
+  (void)hspi;
+  (void)sConfig;
+  return HAL_OK;
+}
+
+/* RTC -----------------------------------------------------------------------*/
+
+#define HOST_RTC_PREDIV_S 249 // As RTC_SYNCH_PREDIV: 250 sub-second steps
+
+/* The clock starts at 12:34:56 and follows virtual time */
+static uint32_t rtc_now(uint32_t *subseconds)
+{
+  uint64_t steps = time_ns * (HOST_RTC_PREDIV_S + 1) / 1000000000ULL;
+  *subseconds = HOST_RTC_PREDIV_S - steps % (HOST_RTC_PREDIV_S + 1); // Down-counter
+  return (12 * 3600 + 34 * 60 + 56 + steps / (HOST_RTC_PREDIV_S + 1)) % 86400;
+}
+
+static uint32_t bcd(uint32_t value)
+{
+  return value / 10 << 4 | value % 10;
+}
+
+RTC_TypeDef *host_rtc(void)
+{
+  static RTC_TypeDef rtc;
+  uint32_t sec = rtc_now(&rtc.SSR);
+
+  rtc.TR = bcd(sec / 3600) << RTC_TR_HU_Pos | bcd(sec / 60 % 60) << RTC_TR_MNU_Pos | bcd(sec % 60) << RTC_TR_SU_Pos;
+  // As HAL_RTC_GetDate()
+  rtc.DR = bcd(25) << RTC_DR_YU_Pos | 5U << RTC_DR_WDU_Pos | bcd(6) << RTC_DR_MU_Pos | bcd(6) << RTC_DR_DU_Pos;
+  return &rtc;
+}
+
+static uint32_t rtc_hal_reads;
+
+uint32_t host_rtc_hal_reads(void)
+{
+  return rtc_hal_reads;
+}
+
+HAL_StatusTypeDef HAL_RTC_GetTime(RTC_HandleTypeDef *hrtc, RTC_TimeTypeDef *sTime, uint32_t Format)
+{
+  (void)hrtc;
+  (void)Format;
+  rtc_hal_reads++;
+  uint32_t sec = rtc_now(&sTime->SubSeconds);
+  sTime->Hours = sec / 3600;
+  sTime->Minutes = sec / 60 % 60;
+  sTime->Seconds = sec % 60;
+  sTime->SecondFraction = HOST_RTC_PREDIV_S;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_RTC_GetDate(RTC_HandleTypeDef *hrtc, RTC_DateTypeDef *sDate, uint32_t Format)
+{
+  (void)hrtc;
+  (void)Format;
+  rtc_hal_reads++;
+  sDate->WeekDay = 5;
+  sDate->Month = 6;
+  sDate->Date = 6;
+  sDate->Year = 25;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_RTC_RegisterCallback(RTC_HandleTypeDef *hrtc, HAL_RTC_CallbackIDTypeDef CallbackID,
+                                           pRTC_CallbackTypeDef pCallback)
+{
+  if (CallbackID == HAL_RTC_WAKEUPTIMER_EVENT_CB_ID)
+    hrtc->WakeUpTimerEventCallback = pCallback;
+  else if (CallbackID == HAL_RTC_ALARM_A_EVENT_CB_ID)
+    hrtc->AlarmAEventCallback = pCallback;
+  return HAL_OK;
+}
+
+void host_set_rtc_busy(int calls)
+{
+  rtc_busy = calls;
+}
+
+HAL_StatusTypeDef HAL_RTC_SetAlarm_IT(RTC_HandleTypeDef *hrtc, const RTC_AlarmTypeDef *sAlarm, uint32_t Format)
+{
+  (void)Format;
+
+  if (rtc_busy > 0)
+  {
+    rtc_busy--;
+    return HAL_BUSY;
+  }
+
+  uint32_t subseconds;
+  uint32_t now_sec = rtc_now(&subseconds);
+  uint32_t alarm_sec = (sAlarm->AlarmTime.Hours * 60 + sAlarm->AlarmTime.Minutes) * 60 + sAlarm->AlarmTime.Seconds;
+  uint32_t ahead = (alarm_sec + 86400 - now_sec) % 86400;
+
+  // Matches at the start of the alarm second, the next time it comes round
+  rtc_alarm = hrtc;
+  rtc_alarm_ns = time_ns - time_ns % 1000000000ULL + (ahead ? ahead : 86400) * 1000000000ULL;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_RTC_DeactivateAlarm(RTC_HandleTypeDef *hrtc, uint32_t Alarm)
+{
+  (void)hrtc;
+  (void)Alarm;
+  rtc_alarm = NULL;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_RTCEx_SetWakeUpTimer_IT(RTC_HandleTypeDef *hrtc, uint32_t WakeUpCounter, uint32_t WakeUpClock,
+                                              uint32_t WakeUpAutoClr)
+{
+  (void)WakeUpAutoClr;
+
+  // (WakeUpCounter + 1) periods of RTCCLK / 16, 8, 4 or 2, from now
+  rtc_wakeup = hrtc;
+  rtc_wakeup_period_ns = (WakeUpCounter + 1ULL) * (16U >> WakeUpClock) * 1000000000ULL / 32768;
+  rtc_wakeup_ns = time_ns + rtc_wakeup_period_ns;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_RTCEx_DeactivateWakeUpTimer(RTC_HandleTypeDef *hrtc)
+{
+  (void)hrtc;
+  rtc_wakeup = NULL;
+  return HAL_OK;
+}
+
+/* ADC -----------------------------------------------------------------------*/
+
+uint32_t host_adc_flags;
+static uint32_t vdda_mv = 3300;
+static uint32_t adc_conversions;
+
+void host_set_vdda_mv(uint32_t mv)
+{
+  vdda_mv = mv;
+}
+
+uint32_t host_adc_conversions(void)
+{
+  return adc_conversions;
+}
+
+HAL_StatusTypeDef HAL_ADC_Start(ADC_HandleTypeDef *hadc)
+{
+  (void)hadc;
+  if (!(host_rcc_clocks & HOST_CLK_ADC))
+    clock_violation("ADC started with its clock gated");
+  adc_conversions++;
+  host_adc_flags |= ADC_FLAG_EOC;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADC_Stop(ADC_HandleTypeDef *hadc)
+{
+  (void)hadc;
+  host_adc_flags = 0;
+  adc_running = NULL;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADC_Start_IT(ADC_HandleTypeDef *hadc)
+{
+  if (adc_running)
+    return HAL_BUSY;
+  if (!(host_rcc_clocks & HOST_CLK_ADC))
+    clock_violation("ADC started with its clock gated");
+  adc_conversions++;
+  host_adc_flags = 0;
+  adc_running = hadc;
+  adc_done_ns = time_ns + HOST_ADC_CONV_NS;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADC_Stop_IT(ADC_HandleTypeDef *hadc)
+{
+  return HAL_ADC_Stop(hadc);
+}
+
+HAL_StatusTypeDef HAL_ADC_PollForConversion(ADC_HandleTypeDef *hadc, uint32_t Timeout)
+{
+  (void)hadc;
+  (void)Timeout;
+  return HAL_OK;
+}
+
+/* VREFINT reads cal * 3.000 V / VDDA, 1500 at the default 3.300 V */
+uint32_t HAL_ADC_GetValue(const ADC_HandleTypeDef *hadc)
+{
+  (void)hadc;
+  host_adc_flags &= ~ADC_FLAG_EOC;
+  return (host_vrefint_cal * 3000U + vdda_mv / 2) / vdda_mv;
+}
+
+/* RTT -----------------------------------------------------------------------*/
+
+int SEGGER_RTT_printf(unsigned BufferIndex, const char *sFormat, ...)
+{
+  va_list args;
+  int r;
+
+  (void)BufferIndex;
+  va_start(args, sFormat);
+  r = vfprintf(stderr, sFormat, args);
+  va_end(args);
+  return r;
+}
+
+/* ORCOS init ----------------------------------------------------------------*/
+
+/**
+ * Host replacement for orcos_init() (orcos.c owns the clock tree and MX_*
+ * peripheral setup, none of which exists here).  Brings up the keyboard
+ * pins the way MX_GPIO_Init() does and initializes the LCD path.
+ */
+void orcos_init()
+{
+  HAL_Init();
+  sharp_panel_reset();
+  sys_power_stats_reset();
+  delay_init();
+  vbat_sample();
+
+  GPIO_INIT_SINGLE(display_cs, GPIO_MODE_OUTPUT_PP, GPIO_NOPULL, GPIO_SPEED_FREQ_LOW);
+  GPIO_INIT_ARRAY(column_pin_array, GPIO_MODE_OUTPUT_OD, GPIO_PULLUP, GPIO_SPEED_FREQ_LOW);
+  GPIO_INIT_ARRAY(row_pin_array, GPIO_MODE_INPUT, GPIO_PULLUP, GPIO_SPEED_FREQ_LOW);
+  HAL_NVIC_EnableIRQ(EXTI15_IRQn);
+
+  hlptim1.Instance = LPTIM1;
+  hlptim1.Init.Period = 0xFFFF;
+  HAL_LPTIM_Init(&hlptim1);
+
+  __lcd_init();
+  power_domains_init();
+}
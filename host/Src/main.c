@@ -0,0 +1,155 @@
+/*
+ * main.c (host)
+ *
+ * Host runner for liborcos: renders the built-in test screens through the
+ * real refresh path into the virtual Sharp panel and dumps them as images,
+ * or runs the drawing primitives in a loop for profiling.
+ *
+ *   orcos_host dump [DIR]       write DIR/screen_N.pbm and DIR/screen_N.png
+ *   orcos_host bench [ITERS]    time each primitive, ITERS calls per case
+ *
+ * Profile with e.g.
+ *   valgrind --tool=callgrind build/host/orcos_host bench 200
+ *   perf record build/host/orcos_host bench 20000
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "assets.h"
+#include "host.h"
+#include "orcos.h"
+#include "sharp.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NUM_OF_TEST_SCREENS 9
+
+static int dump_screens(const char *dir)
+{
+    char path[512];
+
+    for (int i = 0; i < NUM_OF_TEST_SCREENS; i++)
+    {
+        LCD_test_screen(i);
+
+        snprintf(path, sizeof(path), "%s/screen_%d.pbm", dir, i);
+        if (sharp_panel_write_pbm(path) != 0)
+        {
+            perror(path);
+            return 1;
+        }
+        snprintf(path, sizeof(path), "%s/screen_%d.png", dir, i);
+        if (sharp_panel_write_png(path) != 0)
+        {
+            perror(path);
+            return 1;
+        }
+        printf("%s\n", path);
+    }
+    return 0;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bench_putsAt(int i)
+{
+    lcd_putsAt("1234567890.12345678", FONT_16x26, i % 8, 40, LCD_SET_VALUE);
+}
+
+static void bench_putsAt_small(int i)
+{
+    lcd_putsAt("The quick brown fox jumps over", FONT_6x8, i % 8, 10, LCD_SET_VALUE);
+}
+
+static void bench_draw_img_full(int i)
+{
+    const asset_t *a = asset_lookup(ASSET_OPENRPNCALC);
+    (void)i;
+    lcd_draw_img(a->data, a->width, a->height, 0, 0, LCD_SET_VALUE);
+}
+
+static void bench_draw_img_sprite(int i)
+{
+    const asset_t *a = asset_lookup(ASSET_ROOK);
+    lcd_draw_img(a->data, a->width, a->height, (i * 7) % 368, (i * 13) % 208, LCD_SET_VALUE);
+}
+
+static void bench_fill_rect(int i)
+{
+    lcd_fill_rect(i % 13, i % 11, 300, 150, (i & 1) ? LCD_SET_VALUE : LCD_EMPTY_VALUE);
+}
+
+static void bench_bitblt24(int i)
+{
+    for (int y = 0; y < 40; y++)
+        bitblt24(100 + (i % 8), 24, 100 + y, 0xFFFFFFFF, BLT_XOR, BLT_NONE);
+}
+
+static void bench_invert(int i)
+{
+    (void)i;
+    lcd_invert_framebuffer();
+}
+
+static void bench_refresh(int i)
+{
+    (void)i;
+    lcd_refresh();
+}
+
+static const struct
+{
+    const char *name;
+    void (*fn)(int);
+} bench_cases[] = {
+    {"lcd_putsAt 16x26 x19", bench_putsAt},
+    {"lcd_putsAt 6x8 x30", bench_putsAt_small},
+    {"lcd_draw_img 400x240", bench_draw_img_full},
+    {"lcd_draw_img 32x32", bench_draw_img_sprite},
+    {"lcd_fill_rect 300x150", bench_fill_rect},
+    {"bitblt24 x40 rows", bench_bitblt24},
+    {"lcd_invert_framebuffer", bench_invert},
+    {"lcd_refresh", bench_refresh},
+};
+
+static int bench(int iterations)
+{
+    printf("%-28s %12s\n", "primitive", "ns/call");
+    for (size_t c = 0; c < sizeof(bench_cases) / sizeof(bench_cases[0]); c++)
+    {
+        lcd_clear_buffer();
+        double t0 = now_ns();
+        for (int i = 0; i < iterations; i++)
+            bench_cases[c].fn(i);
+        double t1 = now_ns();
+        printf("%-28s %12.0f\n", bench_cases[c].name, (t1 - t0) / iterations);
+    }
+    return 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: orcos_host dump [DIR] | bench [ITERS]\n");
+}
+
+int main(int argc, char **argv)
+{
+    orcos_init();
+    LCD_power_on();
+
+    if (argc >= 2 && strcmp(argv[1], "dump") == 0)
+        return dump_screens(argc >= 3 ? argv[2] : ".");
+    if (argc >= 2 && strcmp(argv[1], "bench") == 0)
+        return bench(argc >= 3 ? atoi(argv[2]) : 1000);
+
+    usage();
+    return 2;
+}
@@ -0,0 +1,243 @@
+/*
+ * sharp_panel.c
+ *
+ * Virtual LS027B7DH01 Sharp memory LCD for the host build.
+ *
+ * Decodes the byte stream that liborcos clocks out on SPI2 (LSB first) while
+ * SCS is high:
+ *
+ *     [mode] { [gate line 1..240] [50 data bytes] [dummy] } [dummy]
+ *
+ * Mode bit M0 selects data update, M2 clears the whole panel.  Panel memory
+ * uses the wire format: bit 0 of each data byte is the leftmost pixel and
+ * a '1' bit is a white pixel.
+ */
+
+#include "host.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define MODE_UPDATE 0x01
+#define MODE_CLEAR 0x04
+
+typedef enum
+{
+    PANEL_IDLE,
+    PANEL_MODE,
+    PANEL_ADDRESS,
+    PANEL_DATA,
+    PANEL_DUMMY,
+    PANEL_IGNORE
+} panel_state_t;
+
+static uint8_t panel[SHARP_PANEL_HEIGHT][SHARP_PANEL_LINE_SIZE];
+static panel_state_t state = PANEL_IDLE;
+static int current_line;
+static int data_pos;
+static uint32_t lines_written;
+static uint32_t bytes_received;
+
+void sharp_panel_reset(void)
+{
+    memset(panel, 0xff, sizeof(panel));
+    state = PANEL_IDLE;
+    lines_written = 0;
+    bytes_received = 0;
+}
+
+void sharp_panel_cs(int level)
+{
+    state = level ? PANEL_MODE : PANEL_IDLE;
+}
+
+static void panel_byte(uint8_t b)
+{
+    switch (state)
+    {
+    case PANEL_IDLE:
+    case PANEL_IGNORE:
+        break;
+    case PANEL_MODE:
+        if (b & MODE_CLEAR)
+            memset(panel, 0xff, sizeof(panel));
+        state = (b & MODE_UPDATE) ? PANEL_ADDRESS : PANEL_IGNORE;
+        break;
+    case PANEL_ADDRESS:
+        if (b < 1 || b > SHARP_PANEL_HEIGHT)
+        {
+            // Trailing dummy byte (or garbage): nothing more to update
+            state = PANEL_IGNORE;
+            break;
+        }
+        current_line = b - 1;
+        data_pos = 0;
+        state = PANEL_DATA;
+        break;
+    case PANEL_DATA:
+        panel[current_line][data_pos++] = b;
+        if (data_pos == SHARP_PANEL_LINE_SIZE)
+        {
+            lines_written++;
+            state = PANEL_DUMMY;
+        }
+        break;
+    case PANEL_DUMMY:
+        state = PANEL_ADDRESS;
+        break;
+    }
+}
+
+void sharp_panel_write(const uint8_t *data, size_t len)
+{
+    bytes_received += len;
+    for (size_t i = 0; i < len; i++)
+        panel_byte(data[i]);
+}
+
+const uint8_t *sharp_panel_line(int line)
+{
+    if (line < 1 || line > SHARP_PANEL_HEIGHT)
+        return NULL;
+    return panel[line - 1];
+}
+
+uint32_t sharp_panel_lines_written(void)
+{
+    return lines_written;
+}
+
+uint32_t sharp_panel_bytes_received(void)
+{
+    return bytes_received;
+}
+
+/* Image export --------------------------------------------------------------*/
+
+// One row of the image as PBM packs it: MSB first, '1' is black
+static void image_row(int y, uint8_t *out)
+{
+    for (int x = 0; x < SHARP_PANEL_LINE_SIZE; x++)
+    {
+        uint8_t b = ~panel[y][x];
+        b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+        b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+        b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
+        out[x] = b;
+    }
+}
+
+int sharp_panel_write_pbm(const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (f == NULL)
+        return -1;
+
+    fprintf(f, "P4\n%d %d\n", SHARP_PANEL_WIDTH, SHARP_PANEL_HEIGHT);
+    for (int y = 0; y < SHARP_PANEL_HEIGHT; y++)
+    {
+        uint8_t row[SHARP_PANEL_LINE_SIZE];
+        image_row(y, row);
+        fwrite(row, 1, sizeof(row), f);
+    }
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *p, size_t len)
+{
+    crc = ~crc;
+    while (len--)
+    {
+        crc ^= *p++;
+        for (int k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (0xEDB88320U & -(crc & 1));
+    }
+    return ~crc;
+}
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static void png_chunk(FILE *f, const char *type, const uint8_t *data, uint32_t len)
+{
+    uint8_t hdr[8];
+    uint8_t crc_be[4];
+
+    put_be32(hdr, len);
+    memcpy(hdr + 4, type, 4);
+    fwrite(hdr, 1, 8, f);
+    if (len)
+        fwrite(data, 1, len, f);
+    uint32_t crc = crc32_update(0, hdr + 4, 4);
+    crc = crc32_update(crc, data, len);
+    put_be32(crc_be, crc);
+    fwrite(crc_be, 1, 4, f);
+}
+
+/*
+ * The PNG is written with "stored" (uncompressed) deflate blocks so the host
+ * build has no zlib dependency.  Each scanline is one filter byte plus the
+ * packed row, and one deflate block per scanline stays well under 64 KiB.
+ */
+int sharp_panel_write_png(const char *path)
+{
+    enum
+    {
+        ROW = 1 + SHARP_PANEL_LINE_SIZE,
+        BLOCK = 5 + ROW,
+        IDAT_SIZE = 2 + SHARP_PANEL_HEIGHT * BLOCK + 4
+    };
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    static uint8_t idat[IDAT_SIZE];
+    uint8_t ihdr[13];
+    uint32_t a = 1, b = 0;
+    size_t pos = 0;
+
+    FILE *f = fopen(path, "wb");
+    if (f == NULL)
+        return -1;
+
+    put_be32(ihdr, SHARP_PANEL_WIDTH);
+    put_be32(ihdr + 4, SHARP_PANEL_HEIGHT);
+    ihdr[8] = 1;  // bit depth
+    ihdr[9] = 0;  // grayscale
+    ihdr[10] = 0; // deflate
+    ihdr[11] = 0; // adaptive filtering
+    ihdr[12] = 0; // no interlace
+
+    idat[pos++] = 0x78; // zlib header: deflate, 32K window
+    idat[pos++] = 0x01;
+    for (int y = 0; y < SHARP_PANEL_HEIGHT; y++)
+    {
+        uint8_t *blk = &idat[pos];
+        blk[0] = (y == SHARP_PANEL_HEIGHT - 1) ? 1 : 0; // BFINAL, BTYPE=00
+        blk[1] = ROW & 0xff;
+        blk[2] = ROW >> 8;
+        blk[3] = ~ROW & 0xff;
+        blk[4] = (~ROW >> 8) & 0xff;
+        uint8_t *row = &blk[5];
+        row[0] = 0; // filter: none
+        image_row(y, row + 1);
+        for (int i = 1; i < ROW; i++)
+            row[i] = ~row[i]; // PNG grayscale: '1' is white
+        for (int i = 0; i < ROW; i++)
+        {
+            a = (a + row[i]) % 65521;
+            b = (b + a) % 65521;
+        }
+        pos += BLOCK;
+    }
+    put_be32(&idat[pos], (b << 16) | a);
+    pos += 4;
+
+    fwrite(signature, 1, sizeof(signature), f);
+    png_chunk(f, "IHDR", ihdr, sizeof(ihdr));
+    png_chunk(f, "IDAT", idat, pos);
+    png_chunk(f, "IEND", NULL, 0);
+    return fclose(f) == 0 ? 0 : -1;
+}
@@ -0,0 +1,48 @@
+/*
+ * assets.h
+ *
+ * Registry of built-in bitmap assets stored in flash
+ */
+
+#ifndef INC_ASSETS_H_
+#define INC_ASSETS_H_
+
+#include <stdint.h>
+
+/**
+ * Places read-only asset data in the ".assets" flash section.  Only use it
+ * on const objects: the link step fails if any asset symbol lands in RAM.
+ */
+#define ASSET_DATA __attribute__((section(".assets")))
+
+/** \addtogroup ASSETS
+ * @{
+ */
+#define ASSET_OPENRPNCALC 0 ///< 400x240 splash image
+#define ASSET_SMILEY 1      ///< 32x32 smiley face
+#define ASSET_ROOK 2        ///< 32x32 rook chess piece
+#define ASSET_COUNT 3
+/** @} */
+
+/// Built-in 1bpp bitmap, rows padded to whole bytes
+typedef struct
+{
+    const uint8_t *data; ///< Pixel data in flash
+    uint16_t width;      ///< Width in pixels
+    uint16_t height;     ///< Height in pixels
+} asset_t;
+
+/**
+ * @brief Look up a built-in asset
+ * @param id One of the ASSET_* ids
+ * @return Asset descriptor, NULL if id is unknown
+ */
+const asset_t *asset_lookup(uint32_t id);
+
+/// Width in pixels of asset id, 0 if unknown
+uint16_t asset_width(uint32_t id);
+
+/// Height in pixels of asset id, 0 if unknown
+uint16_t asset_height(uint32_t id);
+
+#endif /* INC_ASSETS_H_ */
@@ -9,21 +9,60 @@ extern C {
 #include "stm32u3xx_hal.h"
 #include "string.h"
 
+/* Font format flags */
+#define FONT_FLAG_FIXED 0x01 /*!< Every glyph uses the full advance (monospaced) */
+#define FONT_FLAG_BOLD  0x02 /*!< Bold face, see lcd_toggleFontT() */
+
+/*
+ * Glyph data is stored one glyph after the other for code points FirstChar to
+ * LastChar.  Each glyph is FontHeight rows of (FontWidth + 7) / 8 bytes, bit 0
+ * of a byte being the leftmost pixel and a '1' bit an inked pixel.
+ */
 typedef struct {
 	uint8_t FontWidth;    /*!< Font width in pixels */
 	uint8_t FontHeight;   /*!< Font height in pixels */
 	const void *data;    /*!< Pointer to data font data array */
+	uint8_t Ascent;       /*!< Pixels above the baseline used by the tallest glyph */
+	uint8_t Baseline;     /*!< Rows from the top of the glyph cell to the baseline */
+	uint8_t Advance;      /*!< Horizontal distance from one glyph to the next */
+	uint8_t FirstChar;    /*!< First code point with glyph data */
+	uint8_t LastChar;     /*!< Last code point with glyph data */
+	uint8_t Flags;        /*!< FONT_FLAG_* */
 } FontDef_t;
 
-extern FontDef_t font_6x8;
+/* Maximum number of fonts in the registry, built-in ones included */
+#define FONT_MAX 16
+
+extern const FontDef_t font_6x8;
+
+extern const FontDef_t font_7x12b;
+
+extern const FontDef_t font_12x20;
+
+extern const FontDef_t font_16x26;
 
-extern FontDef_t font_7x12b;
+extern const FontDef_t font_24x40;
 
-extern FontDef_t font_12x20;
+/**
+ * @brief  Look up a registered font
+ * @param  font_id: FONT_* id or id returned by font_register()
+ * @retval Font descriptor, NULL if no font has that id
+ */
+const FontDef_t *font_lookup(uint8_t font_id);
 
-extern FontDef_t font_16x26;
+/**
+ * @brief  Add a font to the registry
+ * @note   Only the pointer is kept: the descriptor and its glyph data must stay
+ *         valid for as long as the font is used, so keep both const (in flash).
+ * @param  font: Font descriptor
+ * @retval New font id, -1 if the font is invalid or the registry is full
+ */
+int font_register(const FontDef_t *font);
 
-extern FontDef_t font_24x40;
+/**
+ * @brief  Number of font ids in use; ids run from 0 to font_count() - 1
+ */
+int font_count(void);
 
 /* C++ detection */
 #ifdef __cplusplus
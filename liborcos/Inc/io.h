@@ -10,4 +10,16 @@ extern C {
 
 extern ADC_HandleTypeDef hadc1;
 
+void UpdateSysTick(uint32_t new_HCLK_freq);
+void UpdateAdcClock(uint32_t new_HCLK_freq);
+
+/// Measure the battery now and update the cached readings
+void vbat_sample(void);
+
+/// From the 1 Hz RTC wakeup: measure the battery every few calls
+void vbat_tick(void);
+
+/// Sleep until a conversion in flight is done, before HCLK stops in STOP2
+void vbat_wait(void);
+
 #endif
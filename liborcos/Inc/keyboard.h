@@ -2,9 +2,68 @@
 #define KEYBOARD_H
 
 #include "main.h"
+#include "stm32u3xx_hal.h"
 #include "orcos.h"
+#include "timer.h"
 
 #define NUM_ROW_PINS 9
 #define NUM_COLUMN_PINS 6
+#define NUM_KEYS (NUM_ROW_PINS * NUM_COLUMN_PINS)
+
+/* Keyboard tick on the LPTIM1 time base (timer.h), while keys are active */
+#define KEY_LPTIM_CLOCK_HZ LPTIM_CLOCK_HZ
+#ifndef KEY_TICK_HZ
+#define KEY_TICK_HZ 1024
+#endif
+#define KEY_TICK_PERIOD (KEY_LPTIM_CLOCK_HZ / KEY_TICK_HZ - 1)
+
+/* Debounce thresholds in keyboard ticks, see key_set_debounce() */
+#ifndef KEY_DEBOUNCE_PRESS
+#define KEY_DEBOUNCE_PRESS 5
+#endif
+#ifndef KEY_DEBOUNCE_RELEASE
+#define KEY_DEBOUNCE_RELEASE 5
+#endif
+
+/* Autorepeat timing in ms for KEY_REPEAT_NORMAL and KEY_REPEAT_FAST keys */
+#ifndef KEY_REPEAT_DELAY_MS
+#define KEY_REPEAT_DELAY_MS 500
+#endif
+#ifndef KEY_REPEAT_PERIOD_MS
+#define KEY_REPEAT_PERIOD_MS 100
+#endif
+#ifndef KEY_REPEAT_FAST_DELAY_MS
+#define KEY_REPEAT_FAST_DELAY_MS 300
+#endif
+#ifndef KEY_REPEAT_FAST_PERIOD_MS
+#define KEY_REPEAT_FAST_PERIOD_MS 50
+#endif
+
+/* Time for rows to float back up after releasing a column with closed keys */
+#ifndef KEY_SCAN_SETTLE_US
+#define KEY_SCAN_SETTLE_US 1
+#endif
+
+/* Key queue depth, must be a power of two. Override with -DKEY_QUEUE_SIZE=n */
+#ifndef KEY_QUEUE_SIZE
+#define KEY_QUEUE_SIZE 16
+#endif
+
+/* Key recorder depth in events, must be a power of two */
+#ifndef KEY_RECORD_SIZE
+#define KEY_RECORD_SIZE 256
+#endif
+
+/// Keyboard tick handler, runs from the LPTIM1 interrupt via lptim_tick_start()
+void key_tick(void);
+
+/// Configure the rows to wake from STOP on any key (off = 0) or ON only
+void key_arm_wakeup(int off);
+
+/// Back to active scanning after a wakeup
+void key_disarm_wakeup(void);
+
+/// Latency probe: lcd_refresh() has sent the frame to the panel
+void key_latency_refreshed(void);
 
 #endif // KEYBOARD_H
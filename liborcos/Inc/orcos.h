@@ -15,10 +15,29 @@
 
 /**
  * @brief Get battery voltage in millivolts
+ * Filtered reading cached by the battery monitor, which samples it every
+ * 10 s while the display is on.
  * @return Battery voltage in mV
  */
 int get_vbat(void);
 
+/** \addtogroup LOWBAT
+ * Battery state from the filtered voltage.  Each state is left only once
+ * the voltage is LOWBAT_HYSTERESIS_MV above its threshold.
+ * @{
+ */
+#define LOWBAT_STATE_OK 0
+#define LOWBAT_STATE_LOW 1      ///< Below LOWBAT_LOW_MV
+#define LOWBAT_STATE_CRITICAL 2 ///< Below LOWBAT_CRITICAL_MV
+
+#define LOWBAT_LOW_MV 2500
+#define LOWBAT_CRITICAL_MV 2200
+#define LOWBAT_HYSTERESIS_MV 100
+
+/// Current LOWBAT_STATE_*
+int get_lowbat_state(void);
+/** @} */
+
 // LCD dimensions and buffer sizes
 #define LCD_WIDTH 400                         ///< Display width in pixels
 #define LCD_HEIGHT 240                        ///< Display height in pixels
@@ -36,6 +55,52 @@ int get_vbat(void);
 #define FONT_24x40 3
 #define FONT_16x26 4
 
+/**
+ * @brief Text drawing state
+ * Subset of the DMCP disp_stat_t: the font is selected by id rather than by
+ * descriptor pointer.
+ */
+typedef struct
+{
+    int16_t x;       ///< Current text x position
+    int16_t y;       ///< Current text y position
+    int16_t ln_offs; ///< Extra pixels added to the font height for each line
+    uint8_t font_nr; ///< Current font id, see lcd_switchFont()
+} disp_stat_t;
+
+/**
+ * @brief Next larger font
+ * @param nr Font id
+ * @return Id of the next font by size, nr if it is already the largest
+ */
+int lcd_nextFontNr(int nr);
+
+/**
+ * @brief Next smaller font
+ * @param nr Font id
+ * @return Id of the previous font by size, nr if it is already the smallest
+ */
+int lcd_prevFontNr(int nr);
+
+/**
+ * @brief Switch between regular and bold faces
+ * @param nr Font id
+ * @return Id of the closest font in height with the other weight, nr if none
+ */
+int lcd_toggleFontT(int nr);
+
+/// Select font nr for ds, ignored if no such font is registered
+void lcd_switchFont(disp_stat_t *ds, int nr);
+
+/// Height of a text line in the current font, including ds->ln_offs
+int lcd_lineHeight(disp_stat_t *ds);
+
+/// Distance from the top of a text line to the baseline in the current font
+int lcd_baseHeight(disp_stat_t *ds);
+
+/// Advance width of the current font
+int lcd_fontWidth(disp_stat_t *ds);
+
 /**
  * @brief Power on the LCD display
  * Enables power supply and initializes display controller
@@ -54,6 +119,41 @@ void LCD_power_off(int clear);
  */
 bool LCD_is_on(void);
 
+/**
+ * @brief Show the next power-off image and keep the panel holding it
+ * The display stays powered with EXTCOMIN toggled from the RTC, for
+ * sys_power_off().  LCD_power_on() or LCD_power_off() ends it.
+ * @param allow_errors Unused: the images are built in
+ * @return 0
+ */
+int draw_power_off_image(int allow_errors);
+
+/// Start the power-off images over from the first one
+void reset_off_image_cycle(void);
+
+/** \addtogroup AUTO_OFF
+ * The display switches off AUTO_OFF_TIMEOUT (5 minutes) after it was
+ * powered on or a key was last pressed, on an RTC alarm.  Both the alarm
+ * and key presses are acted on from the main loop, in sys_sleep().
+ * @{
+ */
+
+/// Restart the auto-off timeout, and clear is_auto_off()
+void reset_auto_off(void);
+
+/// Non-zero once the timeout has switched the display off, until reset_auto_off()
+int is_auto_off(void);
+
+/// Number of times the timeout has switched the display off since start-up
+int sys_auto_off_cnt(void);
+
+/// From the keyboard tick: a debounced press, the timeout restarts in auto_off_service()
+void auto_off_key_pressed(void);
+
+/// From the main loop, in sys_sleep(): restart the timeout or switch the display off
+void auto_off_service(void);
+/** @} */
+
 /// Show a test screen on the display
 void LCD_test_screen(uint16_t count);
 
@@ -134,12 +234,175 @@ int lcd_for_calc(int what_screen);
  */
 void sys_sleep(int off);
 
+/**
+ * @brief Power off until the ON key, in the deepest mode that keeps the RAM
+ * Stop 3: only the RTC runs, SRAM1 and the registers are kept, so the call
+ * simply returns with the state as it was, the ON key press queued.  Turn
+ * the display off first, as for sys_sleep(1).  sys_timer deadlines move
+ * out by the time spent off.
+ */
+void sys_power_off(void);
+
 /**
  * @brief Perform system reset
  * Immediately resets the microcontroller
  */
 void sys_reset(void);
 
+/** \addtogroup PERF_LEVEL
+ * Clock and voltage range of the core.  Switching retimes SysTick,
+ * delay_us(), the display SPI and the ADC.  sys_sleep() keeps the level.
+ * @{
+ */
+#define SYS_PERF_LOW 0    ///< 12 MHz MSIS, voltage range 2: awake but idle
+#define SYS_PERF_NORMAL 1 ///< 16 MHz HSI16, voltage range 1: start-up default
+#define SYS_PERF_BOOST 2  ///< 96 MHz MSIS, voltage range 1: heavy computation
+#define SYS_PERF_LEVELS 3
+
+/**
+ * @brief Switch the core clock to a SYS_PERF_* level
+ * @return 0 on success, -1 on a bad level (nothing changes) or a clock
+ *         failure (the core is then back at SYS_PERF_NORMAL)
+ */
+int sys_set_perf_level(int level);
+
+/// Current SYS_PERF_* level
+int sys_get_perf_level(void);
+/** @} */
+
+/** \addtogroup POWER_STATS
+ * Where the time goes and what wakes the core up.  Residency is measured on
+ * the RTC counters, in steps of the sub-second counter: a single handler run
+ * is too short to resolve, but the totals over many wakeups come out right.
+ * An interrupt that ends a STOP2 or Stop 3 period counts as a wakeup of its
+ * source.  The off-state current itself needs an external meter; these give
+ * the time it applies for.
+ * @{
+ */
+#define SYS_POWER_RUN 0   ///< Main loop running, outside sys_sleep()
+#define SYS_POWER_IRQ 1   ///< In sys_sleep() or sys_power_off(), awake in interrupt handlers
+#define SYS_POWER_STOP2 2 ///< In sys_sleep(), core stopped
+#define SYS_POWER_OFF 3   ///< In sys_power_off(), Stop 3
+#define SYS_POWER_MODES 4
+
+#define SYS_WAKE_EXTI(line) (line) ///< EXTI line 0..15: keyboard rows
+#define SYS_WAKE_LPTIM 16          ///< LPTIM1: keyboard tick and sys_timer
+#define SYS_WAKE_RTC_WAKEUP 17     ///< RTC wakeup timer
+#define SYS_WAKE_RTC_ALARM 18      ///< RTC alarm A or B
+#define SYS_WAKE_WKUP 19           ///< Wakeup pin: the ON key in sys_power_off()
+#define SYS_WAKE_OTHER 20          ///< Any other RTC or PWR event
+#define SYS_WAKE_SOURCES 21
+
+typedef struct
+{
+    uint64_t ms[SYS_POWER_MODES];        ///< Time in each SYS_POWER_* mode
+    uint32_t wakeups[SYS_WAKE_SOURCES];  ///< STOP2 and Stop 3 periods ended, by SYS_WAKE_*
+    uint32_t sleeps;                     ///< sys_sleep() calls
+    uint32_t offs;                       ///< sys_power_off() calls
+    uint32_t resume_ms;                  ///< ON key to the next lcd_refresh(), last power-off
+    uint64_t awake_ms[SYS_PERF_LEVELS];  ///< RUN and IRQ time at each SYS_PERF_* level
+    uint64_t display_ms;                 ///< Time with the display booster on
+    uint32_t spi_bytes;                  ///< Bytes sent to the display
+    uint32_t adc_conversions;            ///< Battery samples converted
+} sys_power_stats_t;
+
+/// Copy the counts, with the current mode accounted up to now
+void sys_power_stats(sys_power_stats_t *stats);
+
+/// Clear the counts and start measuring from now
+void sys_power_stats_reset(void);
+
+/// Print the counts over RTT channel 0
+void sys_power_stats_dump(void);
+
+/**
+ * @brief Interrupt handler entry and exit, from stm32u3xx_it.c
+ * @param source SYS_WAKE_* source of the interrupt
+ */
+void sys_power_irq_enter(int source);
+void sys_power_irq_exit(void);
+
+/// Resume probe: lcd_refresh() has sent a frame to the panel
+void sys_power_refreshed(void);
+/** @} */
+
+/** \addtogroup ENERGY
+ * Charge drawn, estimated from the POWER_STATS counters since the last
+ * sys_power_stats_reset(): each state's time at its current from the table,
+ * plus a charge per byte sent to the panel and per ADC conversion.  The
+ * default table holds datasheet figures; once it is calibrated against a
+ * meter in series with the battery, a firmware change can be judged on
+ * charge drawn as well as on speed.
+ * @{
+ */
+#define SYS_ENERGY_RUN 0     ///< Core awake, at the SYS_PERF_* level of the time
+#define SYS_ENERGY_STOP2 1   ///< In sys_sleep()
+#define SYS_ENERGY_OFF 2     ///< In sys_power_off(), Stop 3
+#define SYS_ENERGY_DISPLAY 3 ///< Booster and panel, on or holding an image
+#define SYS_ENERGY_SPI 4     ///< Frames and lines sent to the panel
+#define SYS_ENERGY_ADC 5     ///< Battery samples
+#define SYS_ENERGY_PARTS 6
+
+typedef struct
+{
+    uint32_t run_na[SYS_PERF_LEVELS]; ///< Core awake at each SYS_PERF_* level
+    uint32_t stop2_na;                ///< STOP2 with the RTC and LPTIM1 on the LSE
+    uint32_t off_na;                  ///< Stop 3 with the RTC
+    uint32_t display_na;              ///< 5 V booster and the panel holding its image
+    uint32_t spi_pc_per_byte;         ///< Charge per byte sent to the panel
+    uint32_t adc_pc_per_conversion;   ///< Charge per oversampled conversion
+    uint32_t battery_mah;             ///< Capacity the battery life is projected from
+} sys_energy_table_t;
+
+typedef struct
+{
+    uint64_t nc[SYS_ENERGY_PARTS]; ///< Charge drawn by each SYS_ENERGY_* part, in nC
+    uint64_t ms;                   ///< Time it was drawn over
+    uint32_t avg_na;               ///< Average current, in nAh per hour
+    uint32_t life_hours;           ///< Battery life at that current, 0 before any time is measured
+} sys_energy_t;
+
+/// Copy the current table
+void sys_energy_table(sys_energy_table_t *table);
+
+/// Replace the table, with figures measured on the calculator
+void sys_energy_set_table(const sys_energy_table_t *table);
+
+/// Estimate the charge drawn since sys_power_stats_reset()
+void sys_energy(sys_energy_t *energy);
+
+/// Print the estimate over RTT channel 0
+void sys_energy_dump(void);
+/** @} */
+
+/** \addtogroup SYS_TIMER
+ * Software timers on the LPTIM1 low-power time base, which keeps counting
+ * in STOP2.  An expiry wakes the main loop from sys_sleep(); there is no
+ * periodic tick while only timers are running.
+ * @{
+ */
+#define SYS_TIMER_COUNT 4
+
+/// Start (or restart) a one-shot timer expiring in ms milliseconds
+void sys_timer_start(int timer_ix, uint32_t ms);
+
+/// Start (or restart) a timer expiring every ms milliseconds
+void sys_timer_start_periodic(int timer_ix, uint32_t ms);
+
+/// Non-zero while the timer is counting towards an expiry
+int sys_timer_active(int timer_ix);
+
+/**
+ * @brief Check whether a timer has expired
+ * A one-shot timer reports its expiry until restarted or disabled; a
+ * periodic timer reports each expiry once.
+ */
+int sys_timer_timeout(int timer_ix);
+
+/// Stop a timer and clear its expiry
+void sys_timer_disable(int timer_ix);
+/** @} */
+
 /**
  * @brief Initialize ORCOS library
  * Sets up hardware peripherals, clocks, and display
@@ -154,29 +417,297 @@ void orcos_init();
 
 /**
  * @brief Scan keyboard matrix
- * @return Keycode of pressed key, 0 if none, 0xFFFF if multiple keys
+ * @return Keycode of pressed key, 0 if none, 0xFFFF if more than two keys.
+ *         Two keys are packed as (higher << 8) | lower.
  */
 uint16_t scan_keyboard(void);
 
+/// Bit of a keycode in the pressed-key bitmaps
+#define KEY_BIT(keycode) (1ULL << ((keycode) - 1))
+
+/**
+ * @brief Scan the whole keyboard matrix
+ * Updates the pressed-key bitmap and its press/release edges.
+ * @return Bitmap of keys currently down, see KEY_BIT()
+ */
+uint64_t key_scan(void);
+
+/// Bitmap of keys down at the last key_scan()
+uint64_t key_state(void);
+
+/// Bitmap of keys that went down at the last key_scan()
+uint64_t key_pressed(void);
+
+/// Bitmap of keys that went up at the last key_scan()
+uint64_t key_released(void);
+
+/**
+ * @brief Bitmap of debounced keys down
+ * Maintained by the keyboard tick, which runs while any key is active.
+ */
+uint64_t key_debounced(void);
+
+/// True while the keyboard tick is scanning and debouncing the matrix
+bool key_scan_active(void);
+
+/**
+ * @brief Set the debounce thresholds
+ * A key changes state after this many more disagreeing than agreeing samples,
+ * taken every keyboard tick (about 1 ms).
+ * @param press_ticks Ticks for a press to register
+ * @param release_ticks Ticks for a release to register
+ */
+void key_set_debounce(uint8_t press_ticks, uint8_t release_ticks);
+
+/// Key event flags
+#define KEY_FLAG_REPEAT 0x01  ///< Generated by autorepeat while the key is held
+#define KEY_FLAG_RELEASE 0x02 ///< Keys in the code went up
+
+/// Entry of the input queue
+typedef struct
+{
+    uint16_t code; ///< Keycode, two keys packed as (higher << 8) | lower
+    uint8_t flags; ///< KEY_FLAG_* bits
+    uint32_t time; ///< key_clock() when the event was queued
+} key_event_t;
+
 /**
  * @brief Pop keycode from input queue
- * @return Next keycode in queue, 0 if empty
+ * @return Next keycode in queue, 0 if empty or for a key release
  */
 uint16_t key_pop(void);
 
+/**
+ * @brief Pop the next event from the input queue
+ * @param event Receives the event
+ * @return Non-zero if an event was popped, 0 if the queue is empty
+ */
+int key_pop_event(key_event_t *event);
+
 /**
  * @brief Push keycode to input queue
+ * Safe to call from the main loop and from interrupt handlers alike: the
+ * keyboard tick pushes from the LPTIM1 interrupt, and each push runs with
+ * interrupts masked.
+ * The key is dropped and counted in key_overflows() if the queue is full.
  * @param keycode Keycode to enqueue
  */
 void key_push(uint16_t keycode);
 
+/**
+ * @brief Push a key event with flags to input queue
+ * Same rules as key_push().
+ * @param keycode Keycode to enqueue
+ * @param flags KEY_FLAG_* bits
+ */
+void key_push_event(uint16_t keycode, uint8_t flags);
+
+/**
+ * @brief Check whether the input queue is empty
+ * @return Non-zero if there are no keys to pop
+ */
+int key_empty(void);
+
+/**
+ * @brief Peek at the most recently pushed keycode
+ * @return Newest keycode in queue (left in place), 0 for a release, -1 if empty
+ */
+int key_tail(void);
+
+/**
+ * @brief Pop the most recently pushed keycode and drop older ones
+ * @return Newest keycode in queue, 0 for a release, -1 if empty
+ */
+int key_pop_last(void);
+
+/// Discard all queued keycodes
+void key_pop_all(void);
+
+/// Number of keycodes dropped because the input queue was full
+uint32_t key_overflows(void);
+
 /**
  * @brief Wait until a key is pressed
- * Puts system to sleep until key press detected
+ * Puts system to sleep until a key event is queued
  * Use key_pop() to retrieve the keycode
  */
 void wait_for_key_press();
 
+/**
+ * @brief Wait until all keys are up
+ * The keyboard tick is stopped while keys are held: the rows of the held keys
+ * wake the system on a rising edge, the others on a new press.  No repeats
+ * are generated while waiting.  Release events are queued as usual.
+ */
+void wait_for_key_release(void);
+
+/**
+ * @brief Suspend background key reading
+ * By default a key press while the main loop is busy starts the keyboard
+ * tick, which queues its events from a low-priority interrupt.  While
+ * suspended, keys are only read in sleep and by explicit scans.  Calls nest.
+ */
+void suspended_bg_key_read(void);
+
+/// Resume background key reading, see suspended_bg_key_read()
+void resume_bg_key_read(void);
+
+/**
+ * @brief Check whether the abort key has been pressed
+ * Meant to be polled from long computations: reads a flag set by the
+ * keyboard tick, no GPIO access.  The request stays set until the key press
+ * is popped from the input queue.
+ */
+bool key_abort_requested(void);
+
+/// Select the key that sets key_abort_requested() (KEY_ON by default)
+void key_set_abort_key(uint16_t keycode);
+
+/// Keycode of the last key press event, whether popped or not
+int sys_last_key(void);
+
+/**
+ * @brief Keys down at the last keyboard scan
+ * @param k2 Receives the second key, 0 if none (may be NULL)
+ * @return First key, 0 if no key is down
+ */
+int sys_last_scan(int *k2);
+
+/** \addtogroup AUTOREPEAT
+ * Held keys are re-queued with KEY_FLAG_REPEAT by the keyboard tick, so the
+ * core sleeps between repeats and the application does not have to poll.
+ * Each key belongs to a repeat class that sets the initial delay and period.
+ * @{
+ */
+#define KEY_REPEAT_NORMAL 0 ///< Default class, editing and menu keys
+#define KEY_REPEAT_FAST 1   ///< Shorter delay and period, e.g. cursor keys
+#define KEY_REPEAT_NONE 2   ///< Never repeats (F and ON by default)
+#define KEY_REPEAT_CLASSES 3
+
+/**
+ * @brief Assign a key to a repeat class
+ * @param keycode Single keycode
+ * @param cls KEY_REPEAT_* class
+ */
+void key_set_repeat_class(uint16_t keycode, uint8_t cls);
+
+/**
+ * @brief Set the timing of a repeat class
+ * @param cls KEY_REPEAT_NORMAL or KEY_REPEAT_FAST
+ * @param delay_ms Time from the press to the first repeat
+ * @param period_ms Time between further repeats
+ */
+void key_set_repeat(uint8_t cls, uint16_t delay_ms, uint16_t period_ms);
+
+/// Non-zero if slow autorepeat (twice the repeat period) is selected
+int is_slow_autorepeat(void);
+
+/// Switch between normal and slow autorepeat
+void toggle_slow_autorepeat(void);
+
+/**
+ * @brief Wait for the next key event
+ * Same as runner_get_key_delay(repeat, 0, 0, 0, 0).
+ */
+int runner_get_key(int *repeat);
+
+/**
+ * @brief Wait for the next key event, with timeout and repeat overrides
+ * Sleeps in STOP2 until a key event is queued or the timeout expires.
+ * Non-zero rep0/rep1 replace the class timing for keys pressed from now on,
+ * until the next call.
+ * @param repeat Set to 1 for an autorepeat event, 0 otherwise (may be NULL)
+ * @param timeout Timeout in ms, 0 to wait forever
+ * @param rep0 Delay before the first repeat in ms, 0 for the class default
+ * @param rep1 Period of further repeats in ms, 0 for the class default
+ * @param rep1tout Stop repeating this many ms after the press, 0 for never
+ * @return Keycode, 0 for a key release, -1 on timeout
+ */
+int runner_get_key_delay(int *repeat, uint32_t timeout, uint32_t rep0, uint32_t rep1, uint32_t rep1tout);
+/** @} */
+
+/** \addtogroup KEY_LATENCY
+ * Each key press is timed from its EXTI to the first lcd_refresh() after it
+ * is popped, and every stage is counted in a histogram with log2 buckets:
+ * bucket b holds durations of [2^b, 2^(b+1)) key_clock() cycles.
+ * @{
+ */
+#define KEY_LAT_EXTI_SCAN 0   ///< Row EXTI to debounced press queued
+#define KEY_LAT_SCAN_WAKE 1   ///< Press queued to main loop awake
+#define KEY_LAT_WAKE_POP 2    ///< Main loop awake (or press queued) to key_pop
+#define KEY_LAT_POP_REFRESH 3 ///< key_pop to lcd_refresh() done
+#define KEY_LAT_EXTI_FIRST 4  ///< Row EXTI to the first matrix scan, the wake path
+#define KEY_LAT_STAGES 5
+#define KEY_LAT_BUCKETS 16
+
+/**
+ * @brief Monotonic key timestamp
+ * Counts 32.768 kHz LSE cycles while the keyboard tick or a system timer
+ * runs, including in STOP2, and holds still while neither does.
+ */
+uint32_t key_clock(void);
+
+/// Histogram of a KEY_LAT_* stage, KEY_LAT_BUCKETS counts
+const uint32_t *key_latency_histogram(int stage);
+
+/// Clear the latency histograms
+void key_latency_reset(void);
+
+/// Print the latency histograms over RTT channel 0
+void key_latency_dump(void);
+/** @} */
+
+/** \addtogroup KEY_RECORDER
+ * Record the key events the application receives and replay them later,
+ * for repeatable UI workloads.
+ * @{
+ */
+typedef struct
+{
+    uint32_t ms;   ///< rtc_ms() when the event was queued
+    uint16_t code; ///< Keycode, as in key_event_t
+    uint8_t flags; ///< KEY_FLAG_* bits
+} key_record_t;
+
+/// Clear the recorder and log every key event queued from now on
+void key_record_start(void);
+
+/// Stop logging key events, the recording is kept
+void key_record_stop(void);
+
+/// Number of recorded events held, the oldest are dropped once full
+int key_record_count(void);
+
+/**
+ * @brief Copy the recording, oldest event first
+ * @param out Destination array
+ * @param max Size of out in events
+ * @return Number of events copied
+ */
+int key_record_copy(key_record_t *out, int max);
+
+/// Print the recording over RTT channel 0, one "ms code flags" line per event
+void key_record_export(void);
+
+/**
+ * @brief Replay recorded events into the input queue
+ * Events are pushed from the keyboard tick, including during STOP2, with the
+ * recorded spacing divided by speed_pct / 100.  The keys are still scanned.
+ * @param events Recording, must stay valid until the replay is done
+ * @param count Number of events
+ * @param speed_pct 100 for the original pace, 200 for twice as fast, etc.
+ *                  0 to push one event per keyboard tick
+ * @return 0 on success, -1 for an empty recording
+ */
+int key_replay_start(const key_record_t *events, int count, uint16_t speed_pct);
+
+/// Abandon the replay in progress
+void key_replay_stop(void);
+
+/// True until the last replayed event has been pushed
+bool key_replay_active(void);
+/** @} */
+
 /** \addtogroup KEYCODES
  * @{
  */
@@ -212,4 +743,10 @@ typedef struct
 
 void rtc_read(tm_t *tm, dt_t *dt);
 
+/// Milliseconds since midnight from the RTC, in steps of its sub-second counter
+uint32_t rtc_ms(void);
+
+/// Milliseconds since 2000-01-01 from the RTC calendar, as rtc_ms() otherwise
+uint64_t rtc_epoch_ms(void);
+
 #endif /* __ORCOS_H */
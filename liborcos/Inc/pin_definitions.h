@@ -23,6 +23,11 @@ typedef struct {
 #define GPIO_TOGGLE(pin_arg)      HAL_GPIO_TogglePin((pin_arg).port, (pin_arg).pin)
 #define GPIO_READ(pin_arg)        HAL_GPIO_ReadPin((pin_arg).port, (pin_arg).pin)
 
+// Port-wide operations on a mask of pins, one register access each
+#define GPIO_PORT_SET(port, mask)   WRITE_REG((port)->BSRR, (mask))
+#define GPIO_PORT_RESET(port, mask) WRITE_REG((port)->BRR, (mask))
+#define GPIO_PORT_READ(port)        READ_REG((port)->IDR)
+
 // Initialization macros
 #define GPIO_INIT_SINGLE(pin_arg, mode, pull, speed) \
     do { \
@@ -0,0 +1,34 @@
+#ifndef POWER_H
+#define POWER_H
+
+#include <stdint.h>
+
+/* Power domains: peripherals clocked only while a user holds them */
+#define POWER_DOMAIN_DISPLAY 0 // SPI2, the link to the panel
+#define POWER_DOMAIN_ADC 1     // ADC1, for the battery monitor
+#define POWER_DOMAINS 2
+
+/// Clock the domain, set up for the current HCLK, until power_domain_put()
+void power_domain_get(int domain);
+
+/// Release the domain: its clock is gated when the last user lets go
+void power_domain_put(int domain);
+
+/// Users holding the domain
+int power_domain_users(int domain);
+
+/// Gate every domain nobody holds, once the peripherals are initialized
+void power_domains_init(void);
+
+/* Activity the energy model prices, see sys_energy() */
+
+/// The display booster was switched on or off
+void power_count_display(int on);
+
+/// Bytes were sent to the display
+void power_count_spi(uint32_t bytes);
+
+/// An ADC conversion was started
+void power_count_adc(void);
+
+#endif // POWER_H
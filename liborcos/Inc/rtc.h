@@ -1,4 +1,11 @@
 #pragma once
 
+#include "orcos_private.h"
+
+#define RTC_TICKS_PER_S (RTC_SYNCH_PREDIV + 1) // Sub-second steps
+
 extern RTC_HandleTypeDef hrtc;
-void WakeUpTimerEventCallback(RTC_HandleTypeDef *hrtc) __attribute__((used, noinline));
\ No newline at end of file
+void WakeUpTimerEventCallback(RTC_HandleTypeDef *hrtc) __attribute__((used, noinline));
+
+/// RTC sub-second steps since 2000-01-01, from the live counters
+uint64_t rtc_ticks(void);
@@ -23,17 +23,15 @@ extern uint8_t buffer[BUFFER_SIZE];
 
 void sharp_clear(void);
 
-void sharp_init(TIM_HandleTypeDef* htim1, SPI_HandleTypeDef* hspi1);
-
 void sharp_clear_buffer(uint16_t lines, unsigned char value);
 
 void sharp_invert_buffer(uint16_t lines);
 
 void sharp_send_buffer(uint16_t y, uint16_t size);
 
-void sharp_string(char* str, FontDef_t *font, uint16_t dx, uint16_t dy);
+void sharp_string(char* str, const FontDef_t *font, uint16_t dx, uint16_t dy);
 
-void sharp_char(uint8_t ch, FontDef_t *font, uint16_t dx, uint16_t dy);
+void sharp_char(uint8_t ch, const FontDef_t *font, uint16_t dx, uint16_t dy);
 
 void sharp_string_fast_16x26(char* str, uint8_t dx, uint8_t dy);
 
@@ -45,11 +43,9 @@ void sharp_char_fast_24x40(uint8_t ch, uint8_t dx, uint8_t dy);
 
 void sharp_filled_rectangle(size_t x, size_t y, size_t width, size_t height, uint8_t color);
 
-void sharp_test_font(FontDef_t *font, char start_symbol);
+void sharp_test_font(const FontDef_t *font, char start_symbol);
 
 void __lcd_init();
 
-void lcd_keep_alive();
-
 void LCD_test_screen(uint16_t count);
 #endif /* INC_SHARP_H_ */
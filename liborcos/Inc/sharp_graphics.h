@@ -11,7 +11,7 @@
 #include "sharp.h"
 #include "orcos.h"      // For LCD_HEIGHT, LCD_WIDTH
 
-extern uint8_t g_framebuffer[LCD_HEIGHT][LCD_WIDTH / 8];
+extern uint8_t g_framebuffer[LCD_HEIGHT][LCD_WIDTH / 8] __attribute__((aligned(4)));
 
 /* Drawing functions */
 void lcd_putsAt(const char *str, uint8_t font_id, uint16_t dx, uint16_t dy, uint8_t color);
@@ -22,7 +22,6 @@ void lcd_invert_framebuffer(void);
 void lcd_draw_test_pattern(uint8_t square_size);
 void lcd_fill(uint8_t color);
 void lcd_clear_buffer(void);
-FontDef_t *font_lookup(uint8_t font_id);
 
 /* Helper functions */
 uint8_t reverse_bits(uint8_t b);
@@ -12,18 +12,15 @@
 
 /* Hardware initialization */
 void SPI2_Init(void);
-void TIM1_Init(void);
 
 /* Error handling */
 void LCD_Error_Handler(void) __attribute__((noreturn));
 
 /* LCD operations */
 void __lcd_init(void);
+void __lcd_retime(uint32_t hclk_hz);
 void LCD_write_line(uint8_t *buf);
 void lcd_refresh(void);
-void delay_us(uint16_t us);
-void lcd_keep_alive(void);
 extern SPI_HandleTypeDef hspi2;
-extern TIM_HandleTypeDef htim1;
 
 #endif /* INC_SHARP_LOWLEVEL_H_ */
@@ -0,0 +1,39 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "stm32u3xx_hal.h"
+
+#include <stdint.h>
+
+/* Low-power time base: LPTIM1 counts the 32.768 kHz LSE, also in STOP2 */
+#define LPTIM_CLOCK_HZ 32768
+
+/* Counts left between reading the counter and the end of the period it is
+   being cut to, so the new auto-reload value lands before the counter does */
+#ifndef LPTIM_MARGIN
+#define LPTIM_MARGIN 4
+#endif
+
+/* Delays from this length sleep on the time base rather than busy-wait */
+#ifndef DELAY_SLEEP_MIN_US
+#define DELAY_SLEEP_MIN_US 1000
+#endif
+
+extern LPTIM_HandleTypeDef hlptim1;
+
+/// LSE cycles counted while the time base runs, see key_clock()
+uint32_t lptim_clock(void);
+
+/// Run key_tick() every KEY_TICK_PERIOD + 1 cycles until lptim_tick_stop()
+void lptim_tick_start(void);
+
+/// Back to tickless: periods end at the next timer expiry only
+void lptim_tick_stop(void);
+
+/// Start the DWT cycle counter delay_us() runs on
+void delay_init(void);
+
+/// Wait at least us microseconds, whatever the core clock
+void delay_us(uint32_t us);
+
+#endif // TIMER_H
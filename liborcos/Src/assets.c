@@ -1,4 +1,17 @@
-unsigned char pixel_data_bin[] = {
+/*
+ * assets.c
+ *
+ * Built-in bitmap assets.  The pixel data lives in the read-only ".assets"
+ * flash section (see ASSET_DATA) and is only reachable through the registry
+ * below, so it is never copied to RAM by the startup code.
+ */
+
+#include "assets.h"
+
+#include <stddef.h>
+
+// 400x240 OpenRPNCalc splash image
+static const uint8_t openrpncalc_img[] ASSET_DATA = {
   0x00, 0x00, 0x22, 0x00, 0x00, 0x08, 0x00, 0x00, 0x84, 0x00, 0x00, 0x00,
   0x00, 0x00, 0x00, 0x08, 0x10, 0x00, 0x20, 0x01, 0x00, 0x00, 0x00, 0x00,
   0x24, 0x04, 0x00, 0x00, 0x00, 0x10, 0x40, 0x81, 0x00, 0x00, 0x00, 0x00,
@@ -1000,10 +1013,9 @@ unsigned char pixel_data_bin[] = {
   0x90, 0x24, 0x80, 0x09, 0x10, 0x41, 0x04, 0x40, 0x24, 0x82, 0x10, 0x00,
   0x24, 0x92, 0x00, 0x88, 0x24, 0x82, 0x00, 0x82, 0x01, 0x00, 0x04, 0x80
 };
-unsigned int pixel_data_bin_len = 12000;
 
 // 32x32 smiley face pattern (32 rows * 4 bytes per row = 128 bytes)
-const uint8_t test_img[] = {
+static const uint8_t smiley_img[] ASSET_DATA = {
     0x00, 0x00, 0x00, 0x00,  // ................................
     0x00, 0x07, 0xE0, 0x00,  // .....######.....................
     0x00, 0x1F, 0xF8, 0x00,  // ...##########...................
@@ -1038,7 +1050,8 @@ const uint8_t test_img[] = {
     0x00, 0x00, 0x00, 0x00   // ................................
 };
 
-unsigned char rook_img[] = {
+// 32x32 rook chess piece
+static const uint8_t rook_img[] ASSET_DATA = {
   0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
   0x00, 0x00, 0x00, 0x00, 0x01, 0xc3, 0xc3, 0x80, 0x01, 0xc3, 0xc3, 0x80,
   0x01, 0xff, 0xff, 0x80, 0x01, 0xff, 0xff, 0x80, 0x00, 0x00, 0x00, 0x00,
@@ -1050,4 +1063,28 @@ unsigned char rook_img[] = {
   0x00, 0xff, 0xff, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03, 0xff, 0xff, 0xc0,
   0x03, 0xff, 0xff, 0xc0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
   0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
-};
\ No newline at end of file
+};
+
+/* Registry, indexed by asset id */
+static const asset_t asset_table[ASSET_COUNT] = {
+    [ASSET_OPENRPNCALC] = {openrpncalc_img, 400, 240},
+    [ASSET_SMILEY] = {smiley_img, 32, 32},
+    [ASSET_ROOK] = {rook_img, 32, 32},
+};
+
+const asset_t *asset_lookup(uint32_t id)
+{
+    if (id >= ASSET_COUNT)
+        return NULL;
+    return &asset_table[id];
+}
+
+uint16_t asset_width(uint32_t id)
+{
+    return id < ASSET_COUNT ? asset_table[id].width : 0;
+}
+
+uint16_t asset_height(uint32_t id)
+{
+    return id < ASSET_COUNT ? asset_table[id].height : 0;
+}
@@ -0,0 +1,93 @@
+#include "stm32u3xx_hal.h"
+#include "orcos.h"
+#include "SEGGER_RTT.h"
+
+#include <string.h>
+
+/*
+ * Energy model.  Currents are in nA and per-event charges in pC, so that
+ * Stop 3 and a single SPI byte still get a whole number; time comes from the
+ * residency counters in ms, which makes nA x ms / 1000 a charge in nC.
+ *
+ * The defaults are first estimates from the STM32U3 datasheet and the
+ * LS027B7DH01 specification, to be replaced by measured figures.
+ */
+static sys_energy_table_t energy_table = {
+	.run_na = {
+		[SYS_PERF_LOW] = 200000,    // 12 MHz MSIS, range 2
+		[SYS_PERF_NORMAL] = 450000, // HSI16, range 1
+		[SYS_PERF_BOOST] = 1900000, // 96 MHz MSIS with the EPOD booster
+	},
+	.stop2_na = 2000,                // RTC and LPTIM1 on the LSE
+	.off_na = 600,                   // RTC only
+	.display_na = 20000,             // Panel static image, through the 5 V booster
+	.spi_pc_per_byte = 500,          // Panel data write, SPI2 clocked
+	.adc_pc_per_conversion = 100000, // VREFINT buffer start-up and 16 samples, in Sleep
+	.battery_mah = 220,
+};
+
+void sys_energy_table(sys_energy_table_t *table)
+{
+	*table = energy_table;
+}
+
+void sys_energy_set_table(const sys_energy_table_t *table)
+{
+	energy_table = *table;
+}
+
+void sys_energy(sys_energy_t *energy)
+{
+	const sys_energy_table_t *t = &energy_table;
+	sys_power_stats_t stats;
+	uint64_t total = 0;
+
+	sys_power_stats(&stats);
+	memset(energy, 0, sizeof(*energy));
+	for (int level = 0; level < SYS_PERF_LEVELS; level++)
+	{
+		energy->nc[SYS_ENERGY_RUN] += stats.awake_ms[level] * t->run_na[level] / 1000;
+	}
+	energy->nc[SYS_ENERGY_STOP2] = stats.ms[SYS_POWER_STOP2] * t->stop2_na / 1000;
+	energy->nc[SYS_ENERGY_OFF] = stats.ms[SYS_POWER_OFF] * t->off_na / 1000;
+	energy->nc[SYS_ENERGY_DISPLAY] = stats.display_ms * t->display_na / 1000;
+	energy->nc[SYS_ENERGY_SPI] = (uint64_t)stats.spi_bytes * t->spi_pc_per_byte / 1000;
+	energy->nc[SYS_ENERGY_ADC] = (uint64_t)stats.adc_conversions * t->adc_pc_per_conversion / 1000;
+
+	for (int mode = 0; mode < SYS_POWER_MODES; mode++)
+	{
+		energy->ms += stats.ms[mode];
+	}
+	for (int part = 0; part < SYS_ENERGY_PARTS; part++)
+	{
+		total += energy->nc[part];
+	}
+	if (energy->ms == 0)
+	{
+		return;
+	}
+
+	// nC per ms is uA: scaled to nA, it is also nAh drawn per hour
+	energy->avg_na = (uint32_t)(total * 1000 / energy->ms);
+	if (energy->avg_na)
+	{
+		uint64_t hours = (uint64_t)t->battery_mah * 1000000 / energy->avg_na;
+		energy->life_hours = hours > UINT32_MAX ? UINT32_MAX : (uint32_t)hours;
+	}
+}
+
+void sys_energy_dump(void)
+{
+	static const char *const part_name[SYS_ENERGY_PARTS] = {"run", "stop2", "off", "display", "spi", "adc"};
+	sys_energy_t energy;
+
+	sys_energy(&energy);
+	// No 64-bit or floating point formats in SEGGER_RTT_printf()
+	SEGGER_RTT_printf(0, "ENERGY %u.%03u uAh/h over %u s, battery life %u h\n", (unsigned)(energy.avg_na / 1000),
+			  (unsigned)(energy.avg_na % 1000), (unsigned)(energy.ms / 1000), (unsigned)energy.life_hours);
+	for (int part = 0; part < SYS_ENERGY_PARTS; part++)
+	{
+		uint32_t nah = (uint32_t)(energy.nc[part] / 3600);
+		SEGGER_RTT_printf(0, "  %-7s %6u.%03u uAh\n", part_name[part], (unsigned)(nah / 1000), (unsigned)(nah % 1000));
+	}
+}
@@ -0,0 +1,142 @@
+#include "fonts.h"
+#include "orcos.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Font registry -------------------------------------------------------------*/
+
+/*
+ * Fonts are looked up by id in font_table.  font_order keeps the ids sorted by
+ * size (height, then width) and font_rank is its inverse, so stepping to the
+ * next or previous size is a table lookup as well.  Both are only rebuilt
+ * when a font is registered.
+ */
+static const FontDef_t *font_table[FONT_MAX] = {
+	[FONT_6x8] = &font_6x8,
+	[FONT_7x12b] = &font_7x12b,
+	[FONT_12x20] = &font_12x20,
+	[FONT_24x40] = &font_24x40,
+	[FONT_16x26] = &font_16x26,
+};
+static uint8_t font_order[FONT_MAX] = {FONT_6x8, FONT_7x12b, FONT_12x20, FONT_16x26, FONT_24x40};
+static uint8_t font_rank[FONT_MAX] = {
+	[FONT_6x8] = 0,
+	[FONT_7x12b] = 1,
+	[FONT_12x20] = 2,
+	[FONT_16x26] = 3,
+	[FONT_24x40] = 4,
+};
+static uint8_t font_total = 5;
+
+static bool font_smaller(const FontDef_t *a, const FontDef_t *b)
+{
+	if (a->FontHeight != b->FontHeight)
+		return a->FontHeight < b->FontHeight;
+	return a->FontWidth < b->FontWidth;
+}
+
+const FontDef_t *font_lookup(uint8_t font_id)
+{
+	if (font_id >= font_total)
+		return NULL; // Invalid font ID
+	return font_table[font_id];
+}
+
+int font_register(const FontDef_t *font)
+{
+	if (font == NULL || font->data == NULL || font->FontWidth == 0 || font->FontHeight == 0 ||
+		font->Advance == 0 || font->FirstChar > font->LastChar || font->Baseline > font->FontHeight)
+		return -1;
+	if (font_total >= FONT_MAX)
+		return -1;
+
+	uint8_t id = font_total;
+	font_table[id] = font;
+
+	// Insert after every font that is not larger, so equal sizes keep id order
+	uint8_t pos = font_total;
+	while (pos > 0 && font_smaller(font, font_table[font_order[pos - 1]]))
+	{
+		font_order[pos] = font_order[pos - 1];
+		font_rank[font_order[pos]] = pos;
+		pos--;
+	}
+	font_order[pos] = id;
+	font_rank[id] = pos;
+	font_total++;
+	return id;
+}
+
+int font_count(void)
+{
+	return font_total;
+}
+
+/* DMCP font selection -------------------------------------------------------*/
+
+int lcd_nextFontNr(int nr)
+{
+	if (nr < 0 || nr >= font_total)
+		return nr;
+	uint8_t rank = font_rank[nr];
+	return rank + 1 < font_total ? font_order[rank + 1] : nr;
+}
+
+int lcd_prevFontNr(int nr)
+{
+	if (nr < 0 || nr >= font_total)
+		return nr;
+	uint8_t rank = font_rank[nr];
+	return rank > 0 ? font_order[rank - 1] : nr;
+}
+
+int lcd_toggleFontT(int nr)
+{
+	if (nr < 0 || nr >= font_total)
+		return nr;
+
+	// Closest font in height with the other weight, smaller one on a tie
+	uint8_t bold = font_table[nr]->Flags & FONT_FLAG_BOLD;
+	int best = nr;
+	int best_diff = 256;
+	for (uint8_t rank = 0; rank < font_total; rank++)
+	{
+		const FontDef_t *f = font_table[font_order[rank]];
+		if ((f->Flags & FONT_FLAG_BOLD) == bold)
+			continue;
+		int diff = f->FontHeight - font_table[nr]->FontHeight;
+		if (diff < 0)
+			diff = -diff;
+		if (diff < best_diff)
+		{
+			best = font_order[rank];
+			best_diff = diff;
+		}
+	}
+	return best;
+}
+
+void lcd_switchFont(disp_stat_t *ds, int nr)
+{
+	if (nr >= 0 && nr < font_total)
+		ds->font_nr = nr;
+}
+
+int lcd_lineHeight(disp_stat_t *ds)
+{
+	const FontDef_t *font = font_lookup(ds->font_nr);
+	return font ? font->FontHeight + ds->ln_offs : 0;
+}
+
+int lcd_baseHeight(disp_stat_t *ds)
+{
+	const FontDef_t *font = font_lookup(ds->font_nr);
+	return font ? font->Baseline : 0;
+}
+
+int lcd_fontWidth(disp_stat_t *ds)
+{
+	const FontDef_t *font = font_lookup(ds->font_nr);
+	return font ? font->Advance : 0;
+}
@@ -1,4 +1,6 @@
 #include "fonts.h"
+#include "assets.h"
+#include "orcos.h"
 
 /* 
   Slightly modified version of fonts from 
@@ -7,7 +9,7 @@
     https://www.mikrocontroller.net/topic/54860
 */
 
-const char font_6x8_data[256][8]={
+static const char font_6x8_data[256][8] ASSET_DATA = {
 {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},	// 0x00
 {0x1C,0x22,0x36,0x22,0x2A,0x22,0x1C,0x00},	// 0x01
 {0x1C,0x3E,0x2A,0x3E,0x22,0x3E,0x1C,0x00},	// 0x02
@@ -265,7 +267,7 @@ const char font_6x8_data[256][8]={
 {0x00,0x00,0x1E,0x1E,0x1E,0x1E,0x00,0x00},	// 0xFE
 {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00} 	// 0xFF
 };
-const char font_7x12b_data[256][12]={
+static const char font_7x12b_data[256][12] ASSET_DATA = {
 {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},	// 0x00
 {0x00,0x1C,0x22,0x55,0x41,0x63,0x5D,0x22,0x1C,0x00,0x00,0x00},	// 0x01
 {0x00,0x1C,0x3E,0x6B,0x7F,0x5D,0x63,0x3E,0x1C,0x00,0x00,0x00},	// 0x02
@@ -524,7 +526,7 @@ const char font_7x12b_data[256][12]={
 {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00} 	// 0xFF
 };
 
-const char font_12x20_data[256][40]={
+static const char font_12x20_data[256][40] ASSET_DATA = {
 {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},	// 0x00
 {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xF0,0x00,0x08,0x01,0x04,0x02,0xF2,0x04,0xF2,0x04,0x02,0x04,0x0A,0x05,0x0A,0x05,0xF4,0x02,0x08,0x01,0xF0,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},	// 0x01
 {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xF0,0x00,0xF8,0x01,0xFC,0x03,0x66,0x06,0x66,0x06,0xFE,0x07,0xF6,0x06,0xF6,0x06,0x0C,0x03,0xF8,0x01,0xF0,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},	// 0x02
@@ -783,7 +785,7 @@ const char font_12x20_data[256][40]={
 {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00} 	// 0xFF
 };
 
-const char font_16x26_data[256][52]={
+static const char font_16x26_data[256][52] ASSET_DATA = {
 {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},	// 0x00
 {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xE0,0x07,0x30,0x0C,0x08,0x10,0x64,0x26,0x66,0x66,0x02,0x40,0x02,0x40,0x12,0x48,0x12,0x48,0x36,0x6C,0x24,0x24,0xC8,0x13,0x30,0x0C,0xE0,0x07,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},	// 0x01
 {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xE0,0x07,0xF0,0x0F,0xF8,0x1F,0xFC,0x3F,0x9E,0x79,0x9E,0x79,0xFE,0x7F,0xFE,0x7F,0xEE,0x77,0xEE,0x77,0xDC,0x3B,0x38,0x1C,0xF0,0x0F,0xE0,0x07,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},	// 0x02
@@ -1042,7 +1044,7 @@ const char font_16x26_data[256][52]={
 {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00} 	// 0xFF
 };
 
-const char font_24x40_data[256][120]={
+static const char font_24x40_data[256][120] ASSET_DATA = {
 {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},	// 0x00
 {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x7E,0x00,0xC0,0xFF,0x03,0xE0,0x81,0x07,0x70,0x00,0x0E,0x38,0x00,0x1C,0x1C,0x00,0x38,0x8C,0xC3,0x31,0x8E,0xC3,0x71,0x86,0xC3,0x61,0x06,0x00,0x60,0x06,0x00,0x60,0x66,0x00,0x66,0x46,0x00,0x62,0xCE,0x00,0x73,0x8C,0x81,0x31,0x1C,0xFF,0x38,0x38,0x7E,0x1C,0x70,0x00,0x0E,0xE0,0x81,0x07,0xC0,0xFF,0x03,0x00,0x7E,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},	// 0x01
 {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x7E,0x00,0xC0,0xFF,0x03,0xE0,0xFF,0x07,0xF0,0xFF,0x0F,0xF8,0xFF,0x1F,0xFC,0xFF,0x3F,0x7C,0x3C,0x3E,0x7E,0x3C,0x7E,0x7E,0x3C,0x7E,0xFE,0xFF,0x7F,0xFE,0xFF,0x7F,0x9E,0xFF,0x79,0xBE,0xFF,0x7D,0x3E,0xFF,0x7C,0x7C,0x7E,0x3E,0xFC,0x00,0x3F,0xF8,0x81,0x1F,0xF0,0xFF,0x0F,0xE0,0xFF,0x07,0xC0,0xFF,0x03,0x00,0x7E,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},	// 0x02
@@ -1302,32 +1304,62 @@ const char font_24x40_data[256][120]={
 };
 
 
-FontDef_t font_6x8 = {
-	6,
-	8,
-	font_6x8_data
+const FontDef_t font_6x8 = {
+	.FontWidth = 6,
+	.FontHeight = 8,
+	.data = font_6x8_data,
+	.Ascent = 7,
+	.Baseline = 7,
+	.Advance = 6,
+	.FirstChar = 0x00,
+	.LastChar = 0xFF,
+	.Flags = FONT_FLAG_FIXED
 };
 
-FontDef_t font_7x12b = {
-	7,
-	12,
-	font_7x12b_data
+const FontDef_t font_7x12b = {
+	.FontWidth = 7,
+	.FontHeight = 12,
+	.data = font_7x12b_data,
+	.Ascent = 9,
+	.Baseline = 9,
+	.Advance = 7,
+	.FirstChar = 0x00,
+	.LastChar = 0xFF,
+	.Flags = FONT_FLAG_FIXED | FONT_FLAG_BOLD
 };
 
-FontDef_t font_12x20 = {
-	12,
-	20,
-	font_12x20_data
+const FontDef_t font_12x20 = {
+	.FontWidth = 12,
+	.FontHeight = 20,
+	.data = font_12x20_data,
+	.Ascent = 15,
+	.Baseline = 16,
+	.Advance = 12,
+	.FirstChar = 0x00,
+	.LastChar = 0xFF,
+	.Flags = FONT_FLAG_FIXED
 };
 
-FontDef_t font_16x26 = {
-	16,
-	26,
-	font_16x26_data
+const FontDef_t font_16x26 = {
+	.FontWidth = 16,
+	.FontHeight = 26,
+	.data = font_16x26_data,
+	.Ascent = 20,
+	.Baseline = 21,
+	.Advance = 16,
+	.FirstChar = 0x00,
+	.LastChar = 0xFF,
+	.Flags = FONT_FLAG_FIXED
 };
 
-FontDef_t font_24x40 = {
-	24,
-	40,
-	font_24x40_data
+const FontDef_t font_24x40 = {
+	.FontWidth = 24,
+	.FontHeight = 40,
+	.data = font_24x40_data,
+	.Ascent = 31,
+	.Baseline = 32,
+	.Advance = 24,
+	.FirstChar = 0x00,
+	.LastChar = 0xFF,
+	.Flags = FONT_FLAG_FIXED
 };
@@ -2,35 +2,163 @@
 #include "io.h"
 #include <stm32u3xx_ll_adc.h>
 #include "orcos.h"
+#include "power.h"
+
+#include <stdbool.h>
 
 void UpdateSysTick(uint32_t new_HCLK_freq) {
     HAL_SYSTICK_Config(new_HCLK_freq / 1000);  // Ensure 1 ms SysTick tick
 }
 
-int get_vbat() {
+/*
+ * Battery monitor.  VDDA, which is the battery voltage, is measured against
+ * VREFINT every VBAT_SAMPLE_PERIOD ticks of the 1 Hz RTC wakeup the display
+ * already takes for EXTCOMIN, so it adds no wakeups.  The ADC averages 16
+ * conversions in hardware; the readings then go through a first order low
+ * pass filter, and get_vbat() and get_lowbat_state() return cached values.
+ *
+ * The RTC wakeup handler only starts a conversion and the ADC interrupt
+ * finishes it, so no handler waits the ~600 us it takes.  The ADC kernel
+ * clock comes from HCLK, which STOP2 stops: until the result is in, the core
+ * returns from the handlers to Sleep instead, and sys_sleep() waits for it.
+ */
+#define VBAT_SAMPLE_PERIOD 10 // RTC wakeups between samples
+#define VBAT_FILTER_SHIFT 2   // Each sample moves the average 1/4 of the way
+
+static volatile int vbat_mv;
+static int32_t vbat_filtered; // mV << VBAT_FILTER_SHIFT, 0 before the first sample
+static volatile int lowbat_state = LOWBAT_STATE_OK;
+static volatile bool vbat_busy; // Conversion in flight, ADC domain held
+static uint32_t vbat_sleepdeep;  // SCB->SCR SLEEPDEEP when it started
+
+// Start a conversion unless one is in flight, from any context
+static void vbat_start(void) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (!vbat_busy) {
+        // Clocked for this conversion only, and stopped again by the domain
+        power_domain_get(POWER_DOMAIN_ADC);
+        if (HAL_ADC_Start_IT(&hadc1) == HAL_OK) {
+            power_count_adc();
+            vbat_busy = true;
+            vbat_sleepdeep = SCB->SCR & SCB_SCR_SLEEPDEEP_Msk;
+            SCB->SCR &= ~SCB_SCR_SLEEPDEEP_Msk;
+        } else {
+            power_domain_put(POWER_DOMAIN_ADC);
+        }
+    }
+    __set_PRIMASK(primask);
+}
+
+static void vbat_stop(void) {
+    power_domain_put(POWER_DOMAIN_ADC);
+    SCB->SCR |= vbat_sleepdeep;
+    vbat_busy = false;
+}
 
+// Keep the ADC kernel clock (HCLK / 16 at start-up) at or below 1 MHz, the
+// rate the VREFINT sampling time in vbat_sample() is chosen for
+void UpdateAdcClock(uint32_t new_HCLK_freq) {
+    static const uint32_t dividers[] = {
+        RCC_ADCDACCLK_DIV1, RCC_ADCDACCLK_DIV2, RCC_ADCDACCLK_DIV4, RCC_ADCDACCLK_DIV8,
+        RCC_ADCDACCLK_DIV16, RCC_ADCDACCLK_DIV32, RCC_ADCDACCLK_DIV64, RCC_ADCDACCLK_DIV128,
+        RCC_ADCDACCLK_DIV256, RCC_ADCDACCLK_DIV512,
+    };
+    unsigned n = 0;
+    while (n < sizeof(dividers) / sizeof(dividers[0]) - 1 && (new_HCLK_freq >> n) > 1000000) {
+        n++;
+    }
+    // The kernel clock may only change with the ADC disabled: a conversion
+    // cut short starts over on the new clock
+    HAL_ADC_Stop_IT(&hadc1);
+    __HAL_RCC_ADCDAC_DIV_CONFIG(dividers[n]);
+    if (vbat_busy && HAL_ADC_Start_IT(&hadc1) == HAL_OK) {
+        power_count_adc();
+    }
+}
+
+static void vbat_update(int ADC_measure_VREF) {
 	// Datasheet Section 3.20.2
 	// Internal voltage reference (VREFINT)
 	// The VREFINT provides a stable (bandgap) voltage output for the ADC and the comparators. The VREFINT is
 	// internally connected to ADC1 and ADC2 input channels.
 	// The precise voltage of VREFINT is individually measured for each part by STMicroelectronics during production
-	// test and stored in the system memory area. It is accessible in read-only mode.` 
-	if (HAL_ADC_Start(&hadc1) == HAL_OK) {
-		if (HAL_ADC_PollForConversion(&hadc1,100) == HAL_OK) {
-			// Read the V_REFINT ADC channel.  Should be close to the one stored during
- 			// calibration in VREF_CAL_ADDRESS
-			// Assumes: hadc1 has been correcly configured to read from ADC_CHANNEL_VREFINT
-			// with a minimum conversion time of 12.65 us, as specified in Table 30 of datasheet
-			// If we configure the ADC to run at 1MHz the ADC needs to be configure to sample
-			// for at least 12.65 cycles.  The closest configuration is ADC_SAMPLETIME_23CYCLES_5
-			uint16_t ADC_measure_VREF = HAL_ADC_GetValue(&hadc1);
-			// Read the VREF value that was stored after initial calibration,
-			// during manufacturing.
-			uint16_t ADC_cal_value = (*VREFINT_CAL_ADDR);
-			uint16_t VREF_VOLTAGE_AT_CALIBRATION = 3000;
-			uint16_t VREF_VOLTAGE = (VREF_VOLTAGE_AT_CALIBRATION*ADC_cal_value)/ADC_measure_VREF;
-			return VREF_VOLTAGE;
-		}
+	// test and stored in the system memory area. It is accessible in read-only mode.`
+	// Assumes: hadc1 has been correcly configured to read from ADC_CHANNEL_VREFINT
+	// with a minimum conversion time of 12.65 us, as specified in Table 30 of datasheet
+	// If we configure the ADC to run at 1MHz the ADC needs to be configure to sample
+	// for at least 12.65 cycles.  The closest configuration is ADC_SAMPLETIME_23CYCLES_5
+	if (ADC_measure_VREF == 0) {
+		return;
+	}
+	// Read the VREF value that was stored after initial calibration,
+	// during manufacturing.
+	uint16_t ADC_cal_value = (*VREFINT_CAL_ADDR);
+	uint16_t VREF_VOLTAGE_AT_CALIBRATION = 3000;
+	int32_t mv = (VREF_VOLTAGE_AT_CALIBRATION * ADC_cal_value) / ADC_measure_VREF;
+
+	if (vbat_filtered == 0) {
+		vbat_filtered = mv << VBAT_FILTER_SHIFT; // Start from the first reading
+	} else {
+		vbat_filtered += mv - (vbat_filtered >> VBAT_FILTER_SHIFT);
 	}
-	return 1;
-}
\ No newline at end of file
+	vbat_mv = vbat_filtered >> VBAT_FILTER_SHIFT;
+
+	// Hysteresis: a state is only left LOWBAT_HYSTERESIS_MV above its threshold
+	if (vbat_mv < LOWBAT_CRITICAL_MV) {
+		lowbat_state = LOWBAT_STATE_CRITICAL;
+	} else if (lowbat_state == LOWBAT_STATE_CRITICAL && vbat_mv >= LOWBAT_CRITICAL_MV + LOWBAT_HYSTERESIS_MV) {
+		lowbat_state = LOWBAT_STATE_LOW;
+	}
+	if (lowbat_state == LOWBAT_STATE_OK && vbat_mv < LOWBAT_LOW_MV) {
+		lowbat_state = LOWBAT_STATE_LOW;
+	} else if (lowbat_state != LOWBAT_STATE_OK && vbat_mv >= LOWBAT_LOW_MV + LOWBAT_HYSTERESIS_MV) {
+		lowbat_state = LOWBAT_STATE_OK;
+	}
+}
+
+void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef *hadc) {
+    int value = HAL_ADC_GetValue(hadc);
+
+    vbat_stop();
+    vbat_update(value);
+}
+
+void vbat_wait(void) {
+    // WFI wakes on a pending interrupt with PRIMASK set: the result cannot
+    // come in between the test and the sleep
+    __disable_irq();
+    while (vbat_busy) {
+        HAL_PWR_EnterSLEEPMode(PWR_MAINREGULATOR_ON, PWR_SLEEPENTRY_WFI);
+        __enable_irq();
+        __disable_irq();
+    }
+    __enable_irq();
+}
+
+void vbat_sample(void) {
+    vbat_start();
+    vbat_wait();
+}
+
+void vbat_tick(void) {
+    static int ticks;
+
+    if (vbat_busy) {
+        // A second on and no result: the conversion was lost
+        HAL_ADC_Stop_IT(&hadc1);
+        vbat_stop();
+    }
+    if (++ticks >= VBAT_SAMPLE_PERIOD) {
+        ticks = 0;
+        vbat_start();
+    }
+}
+
+int get_vbat() {
+    return vbat_mv;
+}
+
+int get_lowbat_state() {
+    return lowbat_state;
+}
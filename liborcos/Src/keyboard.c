@@ -3,109 +3,1134 @@
 #include "orcos.h"
 #include "pin_definitions.h"
 #include "sharp.h" // For LCD functions
-#include "sharp_lowlevel.h" // For delay_us()
+#include "sharp_lowlevel.h"
+#include "timer.h" // For delay_us()
 #include "SEGGER_RTT.h"
 
-#define KEY_QUEUE_SIZE 16
-static uint16_t key_queue[KEY_QUEUE_SIZE];
-static uint8_t key_queue_head = 0;
-static uint8_t key_queue_tail = 0;
+#include <string.h>
+
+/*
+ * Key queue: ring with several producers and a single consumer.  The
+ * keyboard tick and key replay push from the LPTIM1 interrupt and the
+ * application may push from the main loop, so a push masks interrupts for
+ * its few instructions and is the only writer of key_queue_head.  The
+ * consumer (main loop) stays lock-free and only writes key_queue_tail.  Both
+ * are free-running counters masked into the ring, so all KEY_QUEUE_SIZE slots
+ * are usable and head - tail is the fill level.  The pop side barriers order
+ * each slot read against the index reads and writes that hand the slot over.
+ * On one core a masked push can't be seen half done, and the consumer's
+ * barrier already frees a slot before its tail moves; the one barrier kept
+ * in the push publishes the slot before the head for a producer running
+ * beside the consumer rather than preempting it, as the host test's thread.
+ */
+static void key_latency_popped(uint32_t queued);
+static void key_record_add(uint16_t keycode, uint8_t flags);
+
+#define KEY_QUEUE_MASK (KEY_QUEUE_SIZE - 1)
+_Static_assert(KEY_QUEUE_SIZE >= 2 && (KEY_QUEUE_SIZE & KEY_QUEUE_MASK) == 0,
+               "KEY_QUEUE_SIZE must be a power of two");
+
+static key_event_t key_queue[KEY_QUEUE_SIZE];
+static volatile uint32_t key_queue_head = 0;
+static volatile uint32_t key_queue_tail = 0;
+static volatile uint32_t key_queue_overflows = 0;
+
+// Set by the keyboard tick on a press of abort_key, cleared when it is popped
+static volatile bool abort_requested = false;
+static uint16_t abort_key = KEY_ON;
+
+void key_push_event(uint16_t keycode, uint8_t flags)
+{
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  uint32_t head = key_queue_head;
+  if (head - key_queue_tail >= KEY_QUEUE_SIZE)
+  {
+    key_queue_overflows++; // Queue full, drop the new key
+    __set_PRIMASK(primask);
+    return;
+  }
+  key_queue[head & KEY_QUEUE_MASK] = (key_event_t){keycode, flags, key_clock()};
+  __DMB(); // Slot is written before it is published
+  key_queue_head = head + 1;
+  key_record_add(keycode, flags);
+  __set_PRIMASK(primask);
+}
 
 void key_push(uint16_t keycode)
 {
-  uint8_t next_head = (key_queue_head + 1) % KEY_QUEUE_SIZE;
-  if (next_head != key_queue_tail)
+  key_push_event(keycode, 0);
+}
+
+int key_pop_event(key_event_t *event)
+{
+  uint32_t tail = key_queue_tail;
+  if (key_queue_head == tail)
   {
-    key_queue[key_queue_head] = keycode;
-    key_queue_head = next_head;
+    return 0; // Queue empty
   }
+  __DMB(); // Read the slot only after seeing it published
+  *event = key_queue[tail & KEY_QUEUE_MASK];
+  __DMB(); // Slot is read before it is handed back
+  key_queue_tail = tail + 1;
+  if (!(event->flags & (KEY_FLAG_RELEASE | KEY_FLAG_REPEAT)))
+  {
+    key_latency_popped(event->time);
+    if ((event->code & 0xff) == abort_key || (event->code >> 8) == abort_key)
+    {
+      abort_requested = false; // Handed to the main loop
+    }
+  }
+  DEBUG_PRINT("K-POP: %d:%d%s\n", event->code >> 8, event->code & 0xff,
+              (event->flags & KEY_FLAG_RELEASE) ? " (release)" :
+              (event->flags & KEY_FLAG_REPEAT) ? " (repeat)" : "");
+  return 1;
+}
+
+// Keycode of an event for the keycode-only API, KEY_NONE for a release
+static uint16_t key_event_code(const key_event_t *event)
+{
+  return (event->flags & KEY_FLAG_RELEASE) ? KEY_NONE : event->code;
 }
 
 uint16_t key_pop(void)
 {
-  if (key_queue_head == key_queue_tail)
+  key_event_t event;
+  return key_pop_event(&event) ? key_event_code(&event) : 0;
+}
+
+int key_empty(void)
+{
+  return key_queue_head == key_queue_tail;
+}
+
+int key_tail(void)
+{
+  uint32_t head = key_queue_head;
+  if (head == key_queue_tail)
   {
-    return 0; // Queue empty
+    return -1;
   }
-  uint16_t key = key_queue[key_queue_tail];
-  key_queue_tail = (key_queue_tail + 1) % KEY_QUEUE_SIZE;
-  DEBUG_PRINT("K-POP: %d:%d\n", key >> 8, key & 0xff);
+  __DMB();
+  // The newest slot is not reused until the consumer has moved past it
+  return key_event_code(&key_queue[(head - 1) & KEY_QUEUE_MASK]);
+}
+
+int key_pop_last(void)
+{
+  uint32_t head = key_queue_head;
+  if (head == key_queue_tail)
+  {
+    return -1;
+  }
+  __DMB();
+  uint16_t key = key_event_code(&key_queue[(head - 1) & KEY_QUEUE_MASK]);
+  __DMB();
+  key_queue_tail = head;
   return key;
 }
 
-void wait_for_key_press()
+void key_pop_all(void)
 {
-  sys_sleep(0);
-  uint16_t keycode = scan_keyboard();
-  key_push(keycode);
-  return;
+  key_queue_tail = key_queue_head;
 }
 
-uint16_t scan_keyboard(void)
+uint32_t key_overflows(void)
 {
-  uint16_t key1 = 0;
-  uint16_t key2 = 0;
-  uint8_t key_count = 0;
-
-  // Set all output column pins to high
-  for (uint16_t column = 0; column < NUM_COLUMN_PINS; column++) {
-    GPIO_WRITE(column_pin_array[column], GPIO_PIN_SET);
-  }
-
-  // Scan columns
-  for (int16_t column = 0; column < NUM_COLUMN_PINS; column++) {
-    GPIO_WRITE(column_pin_array[column], GPIO_PIN_RESET); // Set column pin to low
-    delay_us(20); // Small delay for transitions
-
-    // Read row pins
-    for (int16_t row = 0; row < NUM_ROW_PINS; row++) {
-      if ((GPIO_READ(row_pin_array[row])) == GPIO_PIN_RESET) {
-        uint16_t keycode = (column + row * NUM_COLUMN_PINS + 1);
-        if (key_count == 0) {
-          key1 = keycode;
-          key_count = 1;
-        } else if (key_count == 1) {
-          key2 = keycode;
-          key_count = 2;
-        } else {
-          // More than two keys pressed
-          key_count = 3;
-          break;
-        }
-      }
+  return key_queue_overflows;
+}
+
+/*
+ * Matrix scan.  All columns share one port and all rows another, so a column
+ * is driven with a single BSRR/BRR write and every row is sampled with one
+ * IDR read.  The port masks are derived once from pin_definitions.c.
+ */
+static GPIO_TypeDef *column_port;
+static GPIO_TypeDef *row_port;
+static uint32_t column_mask;
+static uint32_t row_mask;
+static uint8_t row_of_pin[16];
+
+static uint64_t keys_down;
+static uint64_t keys_pressed;
+static uint64_t keys_released;
+
+/*
+ * Row register images.  The rows switch between three configurations on
+ * every sleep and wakeup: scanning (pull-ups, no interrupts), asleep with
+ * every row armed and asleep with only the ON key row armed.  Their GPIO and
+ * EXTI/NVIC bits are precomputed here, so a switch is a few masked register
+ * writes instead of a HAL_GPIO_Init() per pin.
+ */
+enum
+{
+  ROWS_SCAN,
+  ROWS_WAKE_ANY,
+  ROWS_WAKE_ON,
+  ROWS_IMAGES
+};
+
+typedef struct
+{
+  uint32_t moder; // Row fields of MODER
+  uint32_t pupdr; // Row fields of PUPDR
+  uint32_t exti;  // EXTI lines unmasked and edge-triggered
+  uint32_t nvic;  // NVIC->ISER[0] bits of those lines
+} key_rows_image_t;
+
+// All row EXTI interrupts are in the first NVIC enable register
+_Static_assert(EXTI15_IRQn < 32, "row EXTI interrupts must be in NVIC ISER[0]");
+
+static key_rows_image_t rows_image[ROWS_IMAGES];
+static int rows_state = ROWS_SCAN;
+static uint32_t row_moder_mask;
+static uint32_t row_pupdr_mask;
+static uint32_t row_nvic_mask;
+// Pins of columns 0..n-1, to probe a range of columns at once
+static uint32_t columns_below[NUM_COLUMN_PINS + 1];
+// Rows that fired a falling EXTI since the last scan
+static volatile uint32_t exti_rows;
+
+static void key_rows_apply(int state);
+
+static void key_matrix_init(void)
+{
+  column_port = column_pin_array[0].port;
+  row_port = row_pin_array[0].port;
+  for (size_t column = 0; column < NUM_COLUMN_PINS; column++)
+  {
+    column_mask |= column_pin_array[column].pin;
+    columns_below[column + 1] = column_mask;
+  }
+
+  uint32_t pullups = 0;
+  for (size_t row = 0; row < NUM_ROW_PINS; row++)
+  {
+    uint32_t line = __builtin_ctz(row_pin_array[row].pin);
+    row_mask |= row_pin_array[row].pin;
+    row_of_pin[line] = row;
+    row_moder_mask |= GPIO_MODER_MODE0 << (2 * line);
+    row_pupdr_mask |= GPIO_PUPDR_PUPD0 << (2 * line);
+    row_nvic_mask |= 1U << (EXTI0_IRQn + line);
+    pullups |= GPIO_PULLUP << (2 * line);
+  }
+
+  // Rows are inputs throughout (MODER 0).  Internal pull-ups make scanning
+  // more responsive; asleep, the high-valued external pull-ups are enough
+  // to trigger interrupts and draw less current.
+  uint32_t on_line = __builtin_ctz(row_pin_array[NUM_ROW_PINS - 1].pin);
+  rows_image[ROWS_SCAN] = (key_rows_image_t){0, pullups, 0, 0};
+  rows_image[ROWS_WAKE_ANY] = (key_rows_image_t){0, 0, row_mask, row_nvic_mask};
+  rows_image[ROWS_WAKE_ON] = (key_rows_image_t){0, 0, 1U << on_line, 1U << (EXTI0_IRQn + on_line)};
+
+  // Let the HAL route the row EXTI lines to the row port, once
+  GPIO_INIT_ARRAY(row_pin_array, GPIO_MODE_IT_FALLING, GPIO_PULLUP, GPIO_SPEED_FREQ_LOW);
+  key_rows_apply(ROWS_SCAN);
+}
+
+// Pull a group of columns low and return the rows that follow
+static uint32_t key_probe_columns(uint32_t columns)
+{
+  GPIO_PORT_RESET(column_port, columns);
+  (void)GPIO_PORT_READ(row_port); // Cover the input synchroniser delay
+  uint32_t low = ~GPIO_PORT_READ(row_port) & row_mask;
+  GPIO_PORT_SET(column_port, columns);
+  if (low)
+  {
+    delay_us(KEY_SCAN_SETTLE_US); // Let rows held low float back up
+  }
+  return low;
+}
+
+/*
+ * Keys down in columns [first, last) of the given rows.  Rows in seen are
+ * known to have at least one key down in that range; the others may have
+ * none.  Halve the range and probe the lower half: a row seen low there
+ * has a key in it, and a row that stays high can only have its key in the
+ * upper half, so the upper half only needs probing for rows that also had
+ * a key below.  A row only reaches a single column still unseen if no probe
+ * has found its key yet: that column is probed before it is reported, and
+ * a row nothing ever holds low is dropped.  A single key takes three to
+ * five probes, under four on average, instead of a walk over all six
+ * columns.
+ */
+static uint64_t key_probe(size_t first, size_t last, uint32_t rows, uint32_t seen)
+{
+  uint64_t down = 0;
+
+  if (last - first == 1)
+  {
+    if (rows & ~seen)
+    {
+      seen |= key_probe_columns(columns_below[last] & ~columns_below[first]) & rows;
     }
+    rows &= seen;
+    while (rows)
+    {
+      uint32_t bit = __builtin_ctz(rows);
+      rows &= rows - 1;
+      down |= KEY_BIT(first + row_of_pin[bit] * NUM_COLUMN_PINS + 1);
+    }
+    return down;
+  }
 
-    GPIO_WRITE(column_pin_array[column], GPIO_PIN_SET); // Reset column
-    if (key_count > 2) break; // Early exit if too many keys
+  size_t middle = (first + last) / 2;
+  uint32_t lower = key_probe_columns(columns_below[middle] & ~columns_below[first]) & rows;
+  uint32_t upper = rows & ~lower;
+  uint32_t upper_seen = seen & ~lower;
+  if (lower)
+  {
+    uint32_t both = key_probe_columns(columns_below[last] & ~columns_below[middle]) & lower;
+    upper |= both;
+    upper_seen |= both;
+    down |= key_probe(first, middle, lower, lower);
   }
+  if (upper)
+  {
+    down |= key_probe(middle, last, upper, upper_seen);
+  }
+  return down;
+}
 
-  // Reset all output column pins to low
-  for (uint16_t column = 0; column < NUM_COLUMN_PINS; column++) {
-    GPIO_WRITE(column_pin_array[column], GPIO_PIN_RESET);
+uint64_t key_scan(void)
+{
+  if (column_mask == 0)
+  {
+    key_matrix_init();
   }
 
-  if (key_count > 0) {
-    lcd_keep_alive();
+  uint64_t down = 0;
+
+  // Columns idle low, so any closed key is holding its row low right now.
+  // Rows that fired EXTI since the last scan are probed too, in case the
+  // contact is bouncing open at this very moment, but only a probe that
+  // finds them low makes a key of them.  No key down, no probing.
+  uint32_t held = ~GPIO_PORT_READ(row_port) & row_mask;
+  uint32_t rows = held | exti_rows;
+  exti_rows = 0;
+  if (rows)
+  {
+    // Rows armed for EXTI (background reading): keep our own column pulses
+    // from looking like key presses
+    bool armed = rows_state != ROWS_SCAN;
+    if (armed)
+    {
+      MODIFY_REG(EXTI->IMR1, row_mask, 0);
+    }
+
+    // Release all columns and let the rows held low float back up, then
+    // resolve the columns of those rows only
+    GPIO_PORT_SET(column_port, column_mask);
+    delay_us(KEY_SCAN_SETTLE_US);
+    down = key_probe(0, NUM_COLUMN_PINS, rows, held);
+
+    // Back to idle: all columns low so any key can wake us through EXTI
+    GPIO_PORT_RESET(column_port, column_mask);
+    if (armed)
+    {
+      WRITE_REG(EXTI->RPR1, row_mask);
+      WRITE_REG(EXTI->FPR1, row_mask);
+      MODIFY_REG(EXTI->IMR1, row_mask, rows_image[rows_state].exti);
+    }
+  }
+
+  keys_pressed = down & ~keys_down;
+  keys_released = keys_down & ~down;
+  keys_down = down;
+  return down;
+}
+
+uint64_t key_state(void)
+{
+  return keys_down;
+}
+
+uint64_t key_pressed(void)
+{
+  return keys_pressed;
+}
+
+uint64_t key_released(void)
+{
+  return keys_released;
+}
+
+// Pack up to two keys as (higher << 8) | lower, 0xFFFF for more
+static uint16_t key_pack(uint64_t down)
+{
+  if (down == 0)
+  {
+    return 0; // No keys pressed
   }
 
-  if (key_count == 1) {
+  uint16_t key1 = __builtin_ctzll(down) + 1;
+  down &= down - 1;
+  if (down == 0)
+  {
     return key1;
-  } else if (key_count == 2) {
-    // Ensure higher key is in MSB position
-    if (key1 > key2) {
-      return key2 | (key1 << 8);
-    } else {
-      return key1 | (key2 << 8);
-    }
-  } else if (key_count > 2) {
+  }
+
+  uint16_t key2 = __builtin_ctzll(down) + 1;
+  down &= down - 1;
+  if (down)
+  {
     return 0xFFFF; // Too many keys
   }
-  return 0; // No keys pressed
+  // Higher key in MSB position
+  return key1 | (key2 << 8);
+}
+
+/*
+ * Debounce.  A key EXTI starts the LPTIM1 tick (timer.c) at KEY_TICK_HZ,
+ * which scans the matrix on every tick, also while the core sits in STOP2.
+ * Each key has an integrator counting samples that disagree with its
+ * debounced state up and samples that agree with it down; the state flips
+ * when the count reaches the press or release threshold, so isolated bounces
+ * cancel out instead of restarting a delay.  Each press and each release is
+ * queued as an event.  Once every key is up and settled the tick stops and
+ * the rows are re-armed for EXTI wakeup if the main loop is asleep.
+ * wait_for_key_release() also stops it while keys are held, with the held
+ * rows armed for a rising edge.
+ */
+static uint8_t debounce_count[NUM_KEYS];
+static uint64_t debounce_busy;  // Keys with a non-zero integrator
+static uint64_t debounced_down;
+static uint8_t press_threshold = KEY_DEBOUNCE_PRESS;
+static uint8_t release_threshold = KEY_DEBOUNCE_RELEASE;
+static volatile bool tick_running = false;
+static volatile int8_t wake_mode = -1; // sys_sleep(off) argument while asleep, -1 when awake
+static volatile bool release_wait = false; // In wait_for_key_release()
+static uint32_t hold_rows;                 // Row pins armed for release while the tick is stopped
+static volatile uint16_t last_key;         // Last press event, for sys_last_key()
+static volatile uint8_t bg_suspended = 0;  // suspended_bg_key_read() nesting
+
+/*
+ * Autorepeat, also driven by the keyboard tick: after a press event the
+ * chord is queued again with KEY_FLAG_REPEAT once the delay of the pressed
+ * key's class has passed, then every period while it stays held.  The core
+ * sleeps in between; any release or new press restarts the cycle.
+ */
+typedef struct
+{
+  uint16_t delay_ms;
+  uint16_t period_ms;
+} key_repeat_t;
+
+static key_repeat_t repeat_timing[KEY_REPEAT_CLASSES] = {
+    [KEY_REPEAT_NORMAL] = {KEY_REPEAT_DELAY_MS, KEY_REPEAT_PERIOD_MS},
+    [KEY_REPEAT_FAST] = {KEY_REPEAT_FAST_DELAY_MS, KEY_REPEAT_FAST_PERIOD_MS},
+    [KEY_REPEAT_NONE] = {0, 0},
+};
+static uint8_t repeat_class[NUM_KEYS] = {
+    [KEY_F - 1] = KEY_REPEAT_NONE,
+    [KEY_ON - 1] = KEY_REPEAT_NONE,
+};
+static volatile bool slow_autorepeat = false;
+static key_repeat_t repeat_override;   // From runner_get_key_delay(), zero for class timing
+static uint32_t repeat_override_limit; // Ticks of repeating allowed, 0 for no limit
+
+static uint16_t repeat_code;
+static uint32_t repeat_countdown; // Ticks to the next repeat, 0 when not repeating
+static uint32_t repeat_period;
+static uint32_t repeat_limit;     // Ticks of repeating left, 0 for no limit
+
+static volatile uint32_t wait_ticks;  // runner_get_key_delay() timeout, keeps the tick running
+static volatile bool wait_expired;
+
+static uint32_t ms_to_ticks(uint32_t ms)
+{
+  return ((uint64_t)ms * KEY_TICK_HZ + 999) / 1000;
+}
+
+static void key_repeat_arm(uint32_t key_index)
+{
+  const key_repeat_t *timing = &repeat_timing[repeat_class[key_index]];
+  uint32_t delay = repeat_override.delay_ms ? repeat_override.delay_ms : timing->delay_ms;
+  uint32_t period = repeat_override.period_ms ? repeat_override.period_ms : timing->period_ms;
+
+  repeat_code = key_pack(debounced_down);
+  if (timing->delay_ms == 0 || repeat_code == 0xFFFF)
+  {
+    repeat_countdown = 0; // Class does not repeat, or too many keys down
+    return;
+  }
+  if (slow_autorepeat)
+  {
+    period *= 2;
+  }
+  repeat_countdown = ms_to_ticks(delay);
+  repeat_period = ms_to_ticks(period);
+  repeat_limit = repeat_override_limit;
+}
+
+static void key_repeat_run(void)
+{
+  if (repeat_countdown == 0)
+  {
+    return;
+  }
+  if (repeat_limit && --repeat_limit == 0)
+  {
+    repeat_countdown = 0;
+    return;
+  }
+  if (--repeat_countdown == 0)
+  {
+    key_push_event(repeat_code, KEY_FLAG_REPEAT);
+    HAL_PWR_DisableSleepOnExit();
+    repeat_countdown = repeat_period;
+  }
+}
+
+static void key_rows_apply(int state)
+{
+  if (column_mask == 0)
+  {
+    key_matrix_init();
+  }
+
+  const key_rows_image_t *image = &rows_image[state];
+  // Rows held low by a key wait for it to go up, the rest for a press
+  uint32_t rising = state == ROWS_WAKE_ANY ? hold_rows : 0;
+
+  WRITE_REG(NVIC->ICER[0], row_nvic_mask);
+  MODIFY_REG(EXTI->IMR1, row_mask, image->exti);
+  MODIFY_REG(row_port->MODER, row_moder_mask, image->moder);
+  MODIFY_REG(row_port->PUPDR, row_pupdr_mask, image->pupdr);
+  MODIFY_REG(EXTI->RTSR1, row_mask, image->exti & rising);
+  MODIFY_REG(EXTI->FTSR1, row_mask, image->exti & ~rising);
+  // Drop edges latched while scanning, they would fire as soon as enabled
+  WRITE_REG(EXTI->RPR1, row_mask);
+  WRITE_REG(EXTI->FPR1, row_mask);
+  WRITE_REG(NVIC->ICPR[0], image->nvic);
+  WRITE_REG(NVIC->ISER[0], image->nvic);
+  rows_state = state;
+}
+
+static void key_rows_scan_mode(void)
+{
+  key_rows_apply(ROWS_SCAN);
+}
+
+static void key_rows_wake_mode(int off)
+{
+  // When off, only the ON key row (the last one) can wake us up
+  key_rows_apply(off ? ROWS_WAKE_ON : ROWS_WAKE_ANY);
+}
+
+// Rows while the keyboard tick is stopped: armed for wakeup when asleep, and
+// awake too for background reading, unless that is suspended
+static void key_rows_idle_mode(void)
+{
+  if (wake_mode >= 0)
+  {
+    key_rows_wake_mode(wake_mode);
+  }
+  else if (bg_suspended == 0)
+  {
+    key_rows_apply(ROWS_WAKE_ANY);
+  }
+  else
+  {
+    key_rows_scan_mode();
+  }
+}
+
+static void key_tick_start(void)
+{
+  if (tick_running)
+  {
+    return;
+  }
+  tick_running = true;
+  hold_rows = 0;
+  lptim_tick_start();
+}
+
+// Row pins of the given keys
+static uint32_t key_rows_of(uint64_t keys)
+{
+  uint32_t rows = 0;
+  for (size_t row = 0; row < NUM_ROW_PINS; row++)
+  {
+    uint64_t row_keys = ((1ULL << NUM_COLUMN_PINS) - 1) << (row * NUM_COLUMN_PINS);
+    if (keys & row_keys)
+    {
+      rows |= row_pin_array[row].pin;
+    }
+  }
+  return rows;
+}
+
+static void key_tick_stop(void)
+{
+  lptim_tick_stop();
+  hold_rows = key_rows_of(debounced_down);
+  tick_running = false;
+  key_rows_idle_mode();
+}
+
+/*
+ * Latency probes.  key_clock() counts LSE cycles (30.5 us) on LPTIM1, so it
+ * keeps going in STOP2 but only while the time base runs, which includes
+ * the keyboard tick spanning a key press from its EXTI until the key is up
+ * and settled.  Each press
+ * event is stamped at EXTI, at scan completion (debounced press), at wakeup
+ * of the main loop, at key_pop and when the next lcd_refresh() completes,
+ * and every stage adds its duration to a log2 histogram.  The first scan
+ * after the EXTI is stamped too: that is the wake path, before debouncing.
+ */
+static uint32_t latency_hist[KEY_LAT_STAGES][KEY_LAT_BUCKETS];
+static uint32_t lat_exti;    // EXTI time of the press being debounced
+static uint32_t lat_scan;    // Press event queued while the main loop slept
+static uint32_t lat_wake;    // Main loop woke up for a press event
+static uint32_t lat_pop;     // Press event popped, waiting for a refresh
+static volatile uint8_t lat_pending; // Bits (1 << stage) of the probes armed above
+
+static const char *const latency_stage_name[KEY_LAT_STAGES] = {
+    [KEY_LAT_EXTI_SCAN] = "EXTI to scan",
+    [KEY_LAT_SCAN_WAKE] = "scan to wake",
+    [KEY_LAT_WAKE_POP] = "wake to pop",
+    [KEY_LAT_POP_REFRESH] = "pop to refresh",
+    [KEY_LAT_EXTI_FIRST] = "EXTI to first scan",
+};
+
+uint32_t key_clock(void)
+{
+  return lptim_clock();
+}
+
+static void key_latency_add(int stage, uint32_t from)
+{
+  uint32_t cycles = key_clock() - from;
+  int bucket = cycles ? 32 - __builtin_clz(cycles) - 1 : 0;
+  if (bucket >= KEY_LAT_BUCKETS)
+  {
+    bucket = KEY_LAT_BUCKETS - 1;
+  }
+  latency_hist[stage][bucket]++;
+}
+
+static void key_latency_scanned(void)
+{
+  if (lat_pending & (1 << KEY_LAT_EXTI_FIRST))
+  {
+    key_latency_add(KEY_LAT_EXTI_FIRST, lat_exti);
+    lat_pending &= ~(1 << KEY_LAT_EXTI_FIRST);
+  }
+}
+
+static void key_latency_pressed(void)
+{
+  if (lat_pending & (1 << KEY_LAT_EXTI_SCAN))
+  {
+    key_latency_add(KEY_LAT_EXTI_SCAN, lat_exti);
+  }
+  lat_pending &= ~((1 << KEY_LAT_EXTI_SCAN) | (1 << KEY_LAT_WAKE_POP));
+  if (wake_mode >= 0)
+  {
+    lat_scan = key_clock();
+    lat_pending |= 1 << KEY_LAT_SCAN_WAKE;
+  }
+}
+
+static void key_latency_woke(void)
+{
+  __disable_irq();
+  if (lat_pending & (1 << KEY_LAT_SCAN_WAKE))
+  {
+    key_latency_add(KEY_LAT_SCAN_WAKE, lat_scan);
+    lat_wake = key_clock();
+    lat_pending = (lat_pending & ~(1 << KEY_LAT_SCAN_WAKE)) | (1 << KEY_LAT_WAKE_POP);
+  }
+  __enable_irq();
+}
+
+static void key_latency_popped(uint32_t queued)
+{
+  __disable_irq();
+  // Without a wakeup the main loop was running when the press was queued
+  key_latency_add(KEY_LAT_WAKE_POP, (lat_pending & (1 << KEY_LAT_WAKE_POP)) ? lat_wake : queued);
+  lat_pop = key_clock();
+  lat_pending = (lat_pending & ~(1 << KEY_LAT_WAKE_POP)) | (1 << KEY_LAT_POP_REFRESH);
+  __enable_irq();
+}
+
+void key_latency_refreshed(void)
+{
+  __disable_irq();
+  if (lat_pending & (1 << KEY_LAT_POP_REFRESH))
+  {
+    key_latency_add(KEY_LAT_POP_REFRESH, lat_pop);
+    lat_pending &= ~(1 << KEY_LAT_POP_REFRESH);
+  }
+  __enable_irq();
+}
+
+const uint32_t *key_latency_histogram(int stage)
+{
+  return (stage >= 0 && stage < KEY_LAT_STAGES) ? latency_hist[stage] : NULL;
+}
+
+void key_latency_reset(void)
+{
+  memset(latency_hist, 0, sizeof(latency_hist));
+}
+
+void key_latency_dump(void)
+{
+  for (int stage = 0; stage < KEY_LAT_STAGES; stage++)
+  {
+    SEGGER_RTT_printf(0, "%s:\n", latency_stage_name[stage]);
+    for (int bucket = 0; bucket < KEY_LAT_BUCKETS; bucket++)
+    {
+      if (latency_hist[stage][bucket] == 0)
+      {
+        continue;
+      }
+      // Bucket b holds [2^b, 2^(b+1)) LSE cycles, printed in us
+      uint32_t lo = bucket ? (1U << bucket) * 15625U / 512U : 0;
+      uint32_t hi = (2U << bucket) * 15625U / 512U;
+      SEGGER_RTT_printf(0, "  %6u - %6u us: %u\n", (unsigned)lo, (unsigned)hi,
+                        (unsigned)latency_hist[stage][bucket]);
+    }
+  }
+}
+
+/*
+ * Recorder and replay.  While recording, every queued event is also logged
+ * with its RTC time into a RAM ring that keeps the newest KEY_RECORD_SIZE.
+ * Replay feeds a recording back through key_push_event() from the keyboard
+ * tick, which keeps running until the last event: the application sees the
+ * same events with the same spacing (or scaled) without touching the keys.
+ */
+#define KEY_RECORD_MASK (KEY_RECORD_SIZE - 1)
+_Static_assert((KEY_RECORD_SIZE & KEY_RECORD_MASK) == 0, "KEY_RECORD_SIZE must be a power of two");
+
+#define MS_PER_DAY 86400000U
+
+static key_record_t record_ring[KEY_RECORD_SIZE];
+static uint32_t record_total; // Events recorded, the ring holds the newest
+static volatile bool recording = false;
+
+static const key_record_t *replay_events;
+static uint32_t replay_count;
+static uint32_t replay_pos;
+static uint32_t replay_countdown; // Ticks to the next event
+static uint16_t replay_speed;
+static volatile bool replay_active = false;
+
+static void key_record_add(uint16_t keycode, uint8_t flags)
+{
+  if (!recording)
+  {
+    return;
+  }
+  record_ring[record_total & KEY_RECORD_MASK] = (key_record_t){rtc_ms(), keycode, flags};
+  record_total++;
+}
+
+void key_record_start(void)
+{
+  record_total = 0;
+  recording = true;
+}
+
+void key_record_stop(void)
+{
+  recording = false;
+}
+
+int key_record_count(void)
+{
+  return record_total < KEY_RECORD_SIZE ? record_total : KEY_RECORD_SIZE;
+}
+
+int key_record_copy(key_record_t *out, int max)
+{
+  int count = key_record_count();
+  uint32_t first = record_total - count;
+  if (count > max)
+  {
+    count = max;
+  }
+  for (int i = 0; i < count; i++)
+  {
+    out[i] = record_ring[(first + i) & KEY_RECORD_MASK];
+  }
+  return count;
+}
+
+void key_record_export(void)
+{
+  int count = key_record_count();
+  uint32_t first = record_total - count;
+  uint32_t t0 = record_ring[first & KEY_RECORD_MASK].ms;
+
+  // One "ms code flags" line per event, times relative to the first one
+  SEGGER_RTT_printf(0, "KEYREC %d\n", count);
+  for (int i = 0; i < count; i++)
+  {
+    const key_record_t *rec = &record_ring[(first + i) & KEY_RECORD_MASK];
+    SEGGER_RTT_printf(0, "%u %u %u\n", (unsigned)((rec->ms + MS_PER_DAY - t0) % MS_PER_DAY),
+                      (unsigned)rec->code, (unsigned)rec->flags);
+  }
+  SEGGER_RTT_printf(0, "KEYREC END\n");
+}
+
+// Ticks from one replayed event to the next
+static uint32_t key_replay_gap(const key_record_t *from)
+{
+  if (replay_speed == 0)
+  {
+    return 1; // As fast as the tick goes
+  }
+  uint32_t ms = (from[1].ms + MS_PER_DAY - from[0].ms) % MS_PER_DAY;
+  uint32_t ticks = ms_to_ticks((uint64_t)ms * 100 / replay_speed);
+  return ticks ? ticks : 1;
+}
+
+static void key_replay_run(void)
+{
+  if (!replay_active || --replay_countdown)
+  {
+    return;
+  }
+  const key_record_t *rec = &replay_events[replay_pos++];
+  key_push_event(rec->code, rec->flags);
+  HAL_PWR_DisableSleepOnExit();
+  if (replay_pos == replay_count)
+  {
+    replay_active = false;
+    return;
+  }
+  replay_countdown = key_replay_gap(rec);
+}
+
+int key_replay_start(const key_record_t *events, int count, uint16_t speed_pct)
+{
+  if (events == NULL || count <= 0)
+  {
+    return -1;
+  }
+  __disable_irq();
+  replay_events = events;
+  replay_count = count;
+  replay_pos = 0;
+  replay_speed = speed_pct;
+  replay_countdown = 1; // First event on the next tick
+  replay_active = true;
+  if (!tick_running)
+  {
+    key_rows_scan_mode();
+    key_tick_start();
+  }
+  __enable_irq();
+  return 0;
+}
+
+void key_replay_stop(void)
+{
+  replay_active = false;
+}
+
+bool key_replay_active(void)
+{
+  return replay_active;
+}
+
+void key_tick(void)
+{
+  uint64_t raw = key_scan();
+  key_latency_scanned();
+  uint64_t differ = raw ^ debounced_down;
+  uint64_t work = differ | debounce_busy;
+  uint64_t pressed = 0;
+  uint64_t released = 0;
+
+  while (work)
+  {
+    uint32_t k = __builtin_ctzll(work);
+    uint64_t bit = 1ULL << k;
+    work &= work - 1;
+
+    if (differ & bit)
+    {
+      uint8_t threshold = (debounced_down & bit) ? release_threshold : press_threshold;
+      if (++debounce_count[k] < threshold)
+      {
+        debounce_busy |= bit;
+        continue;
+      }
+      debounce_count[k] = 0;
+      debounce_busy &= ~bit;
+      if (debounced_down & bit)
+      {
+        released |= bit;
+      }
+      else
+      {
+        pressed |= bit;
+      }
+      debounced_down ^= bit;
+    }
+    else if (--debounce_count[k] == 0)
+    {
+      debounce_busy &= ~bit;
+    }
+  }
+
+  // While off, the ON key row is armed but other keys on it must not wake us
+  if (wake_mode == 1)
+  {
+    pressed &= KEY_BIT(KEY_ON);
+    released &= KEY_BIT(KEY_ON);
+  }
+  if (released)
+  {
+    key_push_event(key_pack(released), KEY_FLAG_RELEASE);
+    HAL_PWR_DisableSleepOnExit();
+    repeat_countdown = 0;
+  }
+  if (pressed)
+  {
+    if (pressed & KEY_BIT(abort_key))
+    {
+      abort_requested = true;
+    }
+    key_latency_pressed();
+    auto_off_key_pressed();
+    last_key = key_pack(debounced_down);
+    key_push(last_key);
+    HAL_PWR_DisableSleepOnExit(); // Let the main loop have it
+    if (!release_wait)
+    {
+      key_repeat_arm(__builtin_ctzll(pressed));
+    }
+  }
+  else
+  {
+    key_repeat_run(); // A release above has already stopped it
+  }
+
+  key_replay_run();
+
+  if (wait_ticks && --wait_ticks == 0)
+  {
+    wait_expired = true;
+    HAL_PWR_DisableSleepOnExit();
+  }
+  // Keys held in wait_for_key_release() are left to the rising-edge EXTI
+  if ((debounced_down == 0 || (release_wait && repeat_countdown == 0)) &&
+      debounce_busy == 0 && wait_ticks == 0 && !replay_active)
+  {
+    key_tick_stop();
+  }
+}
+
+bool key_scan_active(void)
+{
+  return tick_running;
+}
+
+uint64_t key_debounced(void)
+{
+  return debounced_down;
+}
+
+void key_set_debounce(uint8_t press_ticks, uint8_t release_ticks)
+{
+  press_threshold = press_ticks ? press_ticks : 1;
+  release_threshold = release_ticks ? release_ticks : 1;
+}
+
+void key_set_repeat_class(uint16_t keycode, uint8_t cls)
+{
+  if (keycode >= 1 && keycode <= NUM_KEYS && cls < KEY_REPEAT_CLASSES)
+  {
+    repeat_class[keycode - 1] = cls;
+  }
+}
+
+void key_set_repeat(uint8_t cls, uint16_t delay_ms, uint16_t period_ms)
+{
+  if (cls == KEY_REPEAT_NONE || cls >= KEY_REPEAT_CLASSES || delay_ms == 0 || period_ms == 0)
+  {
+    return;
+  }
+  repeat_timing[cls].delay_ms = delay_ms;
+  repeat_timing[cls].period_ms = period_ms;
+}
+
+int is_slow_autorepeat(void)
+{
+  return slow_autorepeat;
+}
+
+void toggle_slow_autorepeat(void)
+{
+  slow_autorepeat = !slow_autorepeat;
+}
+
+void key_arm_wakeup(int off)
+{
+  wake_mode = off ? 1 : 0;
+  if (!tick_running)
+  {
+    key_rows_idle_mode();
+  }
+  // Otherwise key_tick_stop() arms the rows once all keys are up
+}
+
+void key_disarm_wakeup(void)
+{
+  wake_mode = -1;
+  key_latency_woke();
+  if (!tick_running)
+  {
+    key_rows_idle_mode();
+  }
+}
+
+uint16_t scan_keyboard(void)
+{
+  // The keyboard tick owns the matrix while it runs
+  return key_pack(tick_running ? debounced_down : key_scan());
+}
+
+void wait_for_key_press()
+{
+  while (key_empty())
+  {
+    sys_sleep(0);
+  }
+}
+
+void suspended_bg_key_read(void)
+{
+  __disable_irq();
+  bg_suspended++;
+  if (!tick_running && wake_mode < 0)
+  {
+    key_rows_scan_mode();
+  }
+  __enable_irq();
+}
+
+void resume_bg_key_read(void)
+{
+  __disable_irq();
+  if (bg_suspended > 0 && --bg_suspended == 0 && !tick_running && wake_mode < 0)
+  {
+    key_rows_apply(ROWS_WAKE_ANY);
+  }
+  __enable_irq();
+}
+
+bool key_abort_requested(void)
+{
+  return abort_requested;
+}
+
+void key_set_abort_key(uint16_t keycode)
+{
+  abort_key = keycode;
+  abort_requested = false;
+}
+
+void wait_for_key_release(void)
+{
+  __disable_irq();
+  release_wait = true;
+  repeat_countdown = 0;
+  __enable_irq();
+
+  while (debounced_down || debounce_busy)
+  {
+    sys_sleep(0);
+  }
+  release_wait = false;
+}
+
+int sys_last_key(void)
+{
+  return last_key;
+}
+
+int sys_last_scan(int *k2)
+{
+  // The debounced state is current while the tick runs or keys are held
+  uint64_t down = (tick_running || hold_rows) ? debounced_down : keys_down;
+  int k1 = down ? __builtin_ctzll(down) + 1 : 0;
+  down &= down - 1;
+  if (k2)
+  {
+    *k2 = down ? __builtin_ctzll(down) + 1 : 0;
+  }
+  return k1;
+}
+
+int runner_get_key(int *repeat)
+{
+  return runner_get_key_delay(repeat, 0, 0, 0, 0);
+}
+
+int runner_get_key_delay(int *repeat, uint32_t timeout, uint32_t rep0, uint32_t rep1, uint32_t rep1tout)
+{
+  repeat_override.delay_ms = rep0 > UINT16_MAX ? UINT16_MAX : rep0;
+  repeat_override.period_ms = rep1 > UINT16_MAX ? UINT16_MAX : rep1;
+  repeat_override_limit = rep1tout ? ms_to_ticks(rep1tout) : 0;
+  auto_off_service(); // Presses queued while the main loop was busy
+
+  if (timeout && key_empty())
+  {
+    // The keyboard tick counts the timeout down, also through STOP2
+    __disable_irq();
+    wait_expired = false;
+    wait_ticks = ms_to_ticks(timeout);
+    if (!tick_running)
+    {
+      key_rows_scan_mode();
+      key_tick_start();
+    }
+    __enable_irq();
+  }
+
+  while (key_empty() && !(timeout && wait_expired))
+  {
+    sys_sleep(0);
+  }
+
+  __disable_irq();
+  wait_ticks = 0;
+  __enable_irq();
+
+  key_event_t event;
+  if (!key_pop_event(&event))
+  {
+    if (repeat)
+    {
+      *repeat = 0;
+    }
+    return -1;
+  }
+  if (repeat)
+  {
+    *repeat = (event.flags & KEY_FLAG_REPEAT) != 0;
+  }
+  return key_event_code(&event);
 }
 
 void HAL_GPIO_EXTI_Rising_Callback(uint16_t GPIO_Pin)
 {
   DEBUG_PRINT("INT Rising\n");
+  if (GPIO_Pin & hold_rows)
+  {
+    // Held key going up: debounce the release from the keyboard tick
+    key_rows_scan_mode();
+    key_tick_start();
+    return;
+  }
   HAL_ResumeTick();
   HAL_PWR_DisableSleepOnExit();
 }
@@ -113,6 +1138,24 @@ void HAL_GPIO_EXTI_Rising_Callback(uint16_t GPIO_Pin)
 void HAL_GPIO_EXTI_Falling_Callback(uint16_t GPIO_Pin)
 {
   DEBUG_PRINT("INT Falling\n");
+  if (column_mask == 0)
+  {
+    key_matrix_init();
+  }
+  if (GPIO_Pin & row_mask)
+  {
+    exti_rows |= GPIO_Pin & row_mask;
+    // Key activity: scan and debounce from the keyboard tick, which ends the
+    // sleep once there is a key event for the main loop
+    key_rows_scan_mode();
+    if (!tick_running)
+    {
+      lat_exti = key_clock();
+      lat_pending |= (1 << KEY_LAT_EXTI_SCAN) | (1 << KEY_LAT_EXTI_FIRST);
+    }
+    key_tick_start();
+    return;
+  }
   HAL_ResumeTick();
   HAL_PWR_DisableSleepOnExit();
 }
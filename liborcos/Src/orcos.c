@@ -1,7 +1,10 @@
 #include "sharp.h"
 #include "orcos.h"
 #include "orcos_private.h"
+#include "io.h"
+#include "keyboard.h"
 #include "pin_definitions.h"
+#include "power.h"
 #include "SEGGER_RTT.h"
 
 ADC_HandleTypeDef hadc1;
@@ -58,6 +61,10 @@ void SystemClock_Config(void)
     {
         Error_Handler();
     }
+
+    // Wake from STOP2 on HSI16 too, rather than the MSIS reset default, so
+    // interrupts taken on wakeup see the clock tree set up here
+    HAL_RCCEx_StopWakeupSysclkConfig(RCC_STOP_WKUP_SYSCLK_HSI);
 }
 
 /**
@@ -86,7 +93,12 @@ static void MX_ADC1_Init(void)
     hadc1.Init.Overrun = ADC_OVR_DATA_PRESERVED;
     hadc1.Init.LeftBitShift = ADC_LEFTBITSHIFT_NONE;
     hadc1.Init.ConversionDataManagement = ADC_CONVERSIONDATA_DR;
-    hadc1.Init.OversamplingMode = DISABLE;
+    // Average 16 conversions in hardware for each battery sample
+    hadc1.Init.OversamplingMode = ENABLE;
+    hadc1.Init.Oversampling.Ratio = 16; // A plain count on the U3, 1 to 1024
+    hadc1.Init.Oversampling.RightBitShift = ADC_RIGHTBITSHIFT_4;
+    hadc1.Init.Oversampling.TriggeredMode = ADC_TRIGGEREDMODE_SINGLE_TRIGGER;
+    hadc1.Init.Oversampling.OversamplingStopReset = ADC_REGOVERSAMPLING_CONTINUED_MODE;
     if (HAL_ADC_Init(&hadc1) != HAL_OK)
     {
         Error_Handler();
@@ -303,6 +315,11 @@ static void MX_RTC_Init(void)
     {
         Error_Handler();
     }
+    // Read the counters live: no stale shadow registers after STOP2, see rtc.c
+    if (HAL_RTCEx_EnableBypassShadow(&hrtc) != HAL_OK)
+    {
+        Error_Handler();
+    }
     privilegeState.rtcPrivilegeFull = RTC_PRIVILEGE_FULL_NO;
     privilegeState.backupRegisterPrivZone = RTC_PRIVILEGE_BKUP_ZONE_NONE;
     privilegeState.backupRegisterStartZone2 = RTC_BKP_DR0;
@@ -313,6 +330,32 @@ static void MX_RTC_Init(void)
     }
 }
 
+/**
+ * @brief LPTIM1 Initialization Function
+ * Low-power time base: counts the LSE (clock source selected in
+ * HAL_LPTIM_MspInit) so it keeps running in STOP2.  Started, stopped and
+ * given its period by timer.c.
+ * @param None
+ * @retval None
+ */
+static void MX_LPTIM1_Init(void)
+{
+    hlptim1.Instance = LPTIM1;
+    hlptim1.Init.Clock.Source = LPTIM_CLOCKSOURCE_APBCLOCK_LPOSC;
+    hlptim1.Init.Clock.Prescaler = LPTIM_PRESCALER_DIV1;
+    hlptim1.Init.Trigger.Source = LPTIM_TRIGSOURCE_SOFTWARE;
+    hlptim1.Init.Period = 0xFFFF;
+    hlptim1.Init.UpdateMode = LPTIM_UPDATE_IMMEDIATE;
+    hlptim1.Init.CounterSource = LPTIM_COUNTERSOURCE_INTERNAL;
+    hlptim1.Init.Input1Source = LPTIM_INPUT1SOURCE_GPIO;
+    hlptim1.Init.Input2Source = LPTIM_INPUT2SOURCE_GPIO;
+    hlptim1.Init.RepetitionCounter = 0;
+    if (HAL_LPTIM_Init(&hlptim1) != HAL_OK)
+    {
+        Error_Handler();
+    }
+}
+
 /**
  * @brief  This function is executed in case of error occurrence.
  * @retval None
@@ -366,7 +409,12 @@ void orcos_init()
     MX_GPIO_Init();
     MX_ICACHE_Init();
     MX_RTC_Init();
+    sys_power_stats_reset(); // Residency is measured on the RTC
     MX_ADC1_Init();
+    MX_LPTIM1_Init();
 
+    delay_init();
+    vbat_sample(); // Battery readings are cached from here on
     __lcd_init();
+    power_domains_init(); // SPI2 and the ADC are clocked on demand from here on
 }
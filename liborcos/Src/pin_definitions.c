@@ -15,8 +15,9 @@ DEFINE_PIN(v_sens, GPIOC, GPIO_PIN_8);
 DEFINE_PIN(disp, GPIOA, GPIO_PIN_10);
 DEFINE_PIN(v5_en, GPIOA, GPIO_PIN_15);
 DEFINE_PIN(extcomin, GPIOA, GPIO_PIN_9);
-/* Note: If you change pin definitions below, make sure you update
- * HAL_NVIC_[Enable|Disable]IRQ calls throughout the code to match */
+/* Note: keyboard.c derives its port masks and EXTI/NVIC bits from the
+ * tables below; columns must share one port and rows another.  If you
+ * change them, make sure the EXTIn_IRQHandler()s still match the rows */
 const gpio_pin_t column_pin_array[] = {
     {GPIOA, GPIO_PIN_0},
     {GPIOA, GPIO_PIN_2},
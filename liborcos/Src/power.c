@@ -1,69 +1,515 @@
 #include "stm32u3xx_hal.h"
 #include "pin_definitions.h"
 #include "orcos.h"
-#if DEBUG
+#include "keyboard.h"
+#include "io.h"
+#include "power.h"
+#include "rtc.h"
+#include "sharp_lowlevel.h"
 #include "SEGGER_RTT.h"
-#endif
 
-static void delay_us(uint16_t us)
+#include <stdbool.h>
+#include <string.h>
+
+/*
+ * Performance levels.  NORMAL is the clock tree SystemClock_Config() sets up
+ * at start-up.  Moving between levels always goes through NORMAL, so the
+ * MSIS is never reconfigured while it clocks the core, the voltage range is
+ * raised before the clock and lowered after it, and the EPOD booster is on
+ * whenever HCLK is above 24 MHz.  HAL_RCC_ClockConfig() orders the flash wait
+ * states around the switch and retimes SysTick; the peripherals timed from
+ * HCLK (the SPI2 baud rate, the ADC kernel clock) are retimed through their
+ * power domains, and delay_us() follows SystemCoreClock.
+ */
+typedef struct
+{
+	uint32_t sysclk_source;
+	uint32_t msis_source;
+	uint32_t msis_div;
+	uint32_t hclk_hz;
+	uint32_t voltage_scale;
+	uint32_t flash_latency;
+	uint32_t stop_wakeup;	// Clock the core wakes up on from STOP2
+} perf_config_t;
+
+static const perf_config_t perf_configs[SYS_PERF_LEVELS] = {
+	[SYS_PERF_LOW] = {RCC_SYSCLKSOURCE_MSIS, RCC_MSI_RC1, RCC_MSI_DIV2, 12000000,
+			  PWR_REGULATOR_VOLTAGE_SCALE2, FLASH_LATENCY_0, RCC_STOP_WKUP_SYSCLK_MSIS},
+	[SYS_PERF_NORMAL] = {RCC_SYSCLKSOURCE_HSI, 0, 0, 16000000,
+			     PWR_REGULATOR_VOLTAGE_SCALE1, FLASH_LATENCY_0, RCC_STOP_WKUP_SYSCLK_HSI},
+	[SYS_PERF_BOOST] = {RCC_SYSCLKSOURCE_MSIS, RCC_MSI_RC0, RCC_MSI_DIV1, 96000000,
+			    PWR_REGULATOR_VOLTAGE_SCALE1, FLASH_LATENCY_2, RCC_STOP_WKUP_SYSCLK_HSI},
+};
+
+#define EPOD_BOOSTER_MIN_HZ 24000000
+
+static int perf_level = SYS_PERF_NORMAL;
+
+static HAL_StatusTypeDef perf_switch_sysclk(const perf_config_t *config)
+{
+	RCC_ClkInitTypeDef clk = {0};
+
+	clk.ClockType = RCC_CLOCKTYPE_HCLK | RCC_CLOCKTYPE_SYSCLK | RCC_CLOCKTYPE_PCLK1 | RCC_CLOCKTYPE_PCLK2 | RCC_CLOCKTYPE_PCLK3;
+	clk.SYSCLKSource = config->sysclk_source;
+	clk.AHBCLKDivider = RCC_SYSCLK_DIV1;
+	clk.APB1CLKDivider = RCC_HCLK_DIV1;
+	clk.APB2CLKDivider = RCC_HCLK_DIV1;
+	clk.APB3CLKDivider = RCC_HCLK_DIV1;
+	return HAL_RCC_ClockConfig(&clk, config->flash_latency);
+}
+
+// Only while SYSCLK is HSI16
+static HAL_StatusTypeDef perf_start_msis(const perf_config_t *config)
 {
-	/* Assuming 16MHz clock */
-	uint32_t delay = us * (SystemCoreClock / 1000000);
-	while (delay--)
+	RCC_OscInitTypeDef osc = {0};
+
+	osc.OscillatorType = RCC_OSCILLATORTYPE_MSIS;
+	osc.MSISState = RCC_MSI_ON;
+	osc.MSISSource = config->msis_source;
+	osc.MSISDiv = config->msis_div;
+	return HAL_RCC_OscConfig(&osc);
+}
+
+// From level to NORMAL
+static HAL_StatusTypeDef perf_leave(int level)
+{
+	const perf_config_t *normal = &perf_configs[SYS_PERF_NORMAL];
+
+	if (level == SYS_PERF_NORMAL)
+	{
+		return HAL_OK;
+	}
+	// HSI16 with no wait state is valid in either voltage range
+	if (perf_switch_sysclk(normal) != HAL_OK)
+	{
+		return HAL_ERROR;
+	}
+	if (perf_configs[level].hclk_hz > EPOD_BOOSTER_MIN_HZ)
 	{
-		__NOP(); // No operation instruction
+		HAL_PWREx_DisableEpodBooster();
+		HAL_RCCEx_EpodBoosterClkConfig(RCC_EPODBOOSTER_SOURCE_NONE, RCC_EPODBOOSTER_DIV1);
 	}
+	return HAL_PWREx_ControlVoltageScaling(normal->voltage_scale);
 }
 
-void sys_sleep(int off)
+// From NORMAL to level
+static HAL_StatusTypeDef perf_enter(int level)
 {
-	if (off)
-	{
-
-		// First set all rows to input and disable the internal pull-up
-		// The high-valued external pull-ups are sufficient to
-		// trigger interrupts and should draw less current.
-		GPIO_INIT_ARRAY(row_pin_array,
-						GPIO_MODE_INPUT,
-						GPIO_NOPULL,
-						GPIO_SPEED_FREQ_LOW);
-
-		// Second, set the row corresponding to ON/OFF key to ext. interrupt mode
-		// (This is the last row in the matrix)
-		GPIO_INIT_SINGLE(row_pin_array[row_pin_array_count - 1],
-						 GPIO_MODE_IT_FALLING,
-						 GPIO_NOPULL,
-						 GPIO_SPEED_FREQ_LOW);
-
-		// Third, disable interrupts for all other keyboard pins
-		HAL_NVIC_DisableIRQ(EXTI0_IRQn);
-		HAL_NVIC_DisableIRQ(EXTI1_IRQn);
-		HAL_NVIC_DisableIRQ(EXTI2_IRQn);
-		HAL_NVIC_DisableIRQ(EXTI3_IRQn);
-		HAL_NVIC_DisableIRQ(EXTI4_IRQn);
-		HAL_NVIC_DisableIRQ(EXTI5_IRQn);
-		HAL_NVIC_DisableIRQ(EXTI13_IRQn);
-		HAL_NVIC_DisableIRQ(EXTI14_IRQn);
-		HAL_NVIC_EnableIRQ(EXTI15_IRQn);
+	const perf_config_t *config = &perf_configs[level];
+
+	if (level == SYS_PERF_NORMAL)
+	{
+		return HAL_OK;
+	}
+	if (config->hclk_hz > EPOD_BOOSTER_MIN_HZ)
+	{
+		// Booster clock from HSI16 / 2, inside its 3 to 16 MHz input range
+		if (HAL_RCCEx_EpodBoosterClkConfig(RCC_EPODBOOSTER_SOURCE_HSI, RCC_EPODBOOSTER_DIV2) != HAL_OK ||
+		    HAL_PWREx_EnableEpodBooster() != HAL_OK)
+		{
+			return HAL_ERROR;
+		}
+	}
+	if (perf_start_msis(config) != HAL_OK || perf_switch_sysclk(config) != HAL_OK)
+	{
+		return HAL_ERROR;
+	}
+	if (config->voltage_scale != perf_configs[SYS_PERF_NORMAL].voltage_scale)
+	{
+		return HAL_PWREx_ControlVoltageScaling(config->voltage_scale);
+	}
+	return HAL_OK;
+}
+
+/*
+ * Power domains.  SPI2 and the ADC are only clocked while a user holds them:
+ * lcd_refresh() for the display link, a battery sample for the ADC.  STOP2
+ * keeps their registers, so neither is set up again after a wakeup, but both
+ * are timed from HCLK.  A level change retimes the domains in use at once
+ * and marks the others stale, for their next user to retime: a sys_sleep()
+ * at BOOST comes back with an MSIS restart and a clock switch and nothing
+ * else, and the SPI2 and ADC setup is only redone if the display or the
+ * battery monitor runs.
+ */
+typedef struct
+{
+	uint8_t users;
+	bool stale; // HCLK changed since the domain was last timed
+} power_domain_t;
+
+static power_domain_t domains[POWER_DOMAINS];
+
+static void power_domain_clock(int domain, bool on)
+{
+	switch (domain)
+	{
+	case POWER_DOMAIN_DISPLAY:
+		if (on)
+		{
+			__HAL_RCC_SPI2_CLK_ENABLE();
+		}
+		else
+		{
+			__HAL_RCC_SPI2_CLK_DISABLE();
+		}
+		break;
+	case POWER_DOMAIN_ADC:
+		if (on)
+		{
+			__HAL_RCC_ADC12_CLK_ENABLE();
+		}
+		else
+		{
+			HAL_ADC_Stop(&hadc1); // Disabled, not just left without a clock
+			__HAL_RCC_ADC12_CLK_DISABLE();
+		}
+		break;
+	}
+}
+
+static void power_domain_retime(int domain)
+{
+	uint32_t hclk = HAL_RCC_GetHCLKFreq();
+
+	if (domain == POWER_DOMAIN_DISPLAY)
+	{
+		__lcd_retime(hclk);
 	}
 	else
 	{
-		// Set all rows to ext. interrupt mode
-		GPIO_INIT_ARRAY(row_pin_array,
-						GPIO_MODE_IT_FALLING,
-						GPIO_NOPULL,
-						GPIO_SPEED_FREQ_LOW);
-		// Enable interrupts for all keyboard pins
-		HAL_NVIC_EnableIRQ(EXTI0_IRQn);
-		HAL_NVIC_EnableIRQ(EXTI1_IRQn);
-		HAL_NVIC_EnableIRQ(EXTI2_IRQn);
-		HAL_NVIC_EnableIRQ(EXTI3_IRQn);
-		HAL_NVIC_EnableIRQ(EXTI4_IRQn);
-		HAL_NVIC_EnableIRQ(EXTI5_IRQn);
-		HAL_NVIC_EnableIRQ(EXTI13_IRQn);
-		HAL_NVIC_EnableIRQ(EXTI14_IRQn);
-		HAL_NVIC_EnableIRQ(EXTI15_IRQn);
+		UpdateAdcClock(hclk);
+	}
+	domains[domain].stale = false;
+}
+
+// HCLK changed: retime the domains in use now, the others when next used
+static void power_domains_retime(void)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	for (int domain = 0; domain < POWER_DOMAINS; domain++)
+	{
+		if (domains[domain].users)
+		{
+			power_domain_retime(domain);
+		}
+		else
+		{
+			domains[domain].stale = true;
+		}
+	}
+	__set_PRIMASK(primask);
+}
+
+void power_domain_get(int domain)
+{
+	if (domain < 0 || domain >= POWER_DOMAINS)
+	{
+		return;
+	}
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	power_domain_t *d = &domains[domain];
+	if (d->users++ == 0)
+	{
+		power_domain_clock(domain, true);
+		if (d->stale)
+		{
+			power_domain_retime(domain);
+		}
+	}
+	__set_PRIMASK(primask);
+}
+
+void power_domain_put(int domain)
+{
+	if (domain < 0 || domain >= POWER_DOMAINS || domains[domain].users == 0)
+	{
+		return;
+	}
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if (--domains[domain].users == 0)
+	{
+		power_domain_clock(domain, false);
 	}
+	__set_PRIMASK(primask);
+}
+
+int power_domain_users(int domain)
+{
+	return (domain >= 0 && domain < POWER_DOMAINS) ? domains[domain].users : 0;
+}
+
+void power_domains_init(void)
+{
+	for (int domain = 0; domain < POWER_DOMAINS; domain++)
+	{
+		if (domains[domain].users == 0)
+		{
+			power_domain_clock(domain, false);
+		}
+	}
+}
+
+static void power_account(void);
+
+int sys_set_perf_level(int level)
+{
+	if (level < 0 || level >= SYS_PERF_LEVELS)
+	{
+		return -1;
+	}
+	if (level == perf_level)
+	{
+		return 0;
+	}
+
+	power_account(); // The time so far ran at the old level
+
+	DEBUG_PRINT("perf level %d -> %d\n", perf_level, level);
+	int result = -1;
+	if (perf_leave(perf_level) == HAL_OK)
+	{
+		perf_level = SYS_PERF_NORMAL;
+		if (perf_enter(level) == HAL_OK)
+		{
+			perf_level = level;
+			result = 0;
+		}
+		else
+		{
+			perf_leave(level); // Back to the start-up clock tree
+		}
+	}
+
+	// Whatever happened, follow the clock the core runs on now
+	power_domains_retime();
+	HAL_RCCEx_StopWakeupSysclkConfig(perf_configs[perf_level].stop_wakeup);
+	return result;
+}
+
+int sys_get_perf_level(void)
+{
+	return perf_level;
+}
+
+/*
+ * First step after STOP2 or Stop 3.  The core comes back on the clock
+ * RCC_STOP_WKUP_SYSCLK_* selects, which sys_set_perf_level() keeps in line
+ * with the level: check it rather than trust it, since SystemCoreClock,
+ * SysTick and the power domains all assume the level's clock.  An MSIS
+ * level that woke up on HSI16, as BOOST does, finds the MSIS stopped: it is
+ * started again here, and the booster, which sys_sleep() leaves enabled, is
+ * checked ready before the switch.  Nothing else is restored here; the power domains come back when
+ * their users need them.
+ */
+static void power_check_clock(void)
+{
+	const perf_config_t *config = &perf_configs[perf_level];
+
+	if (HAL_RCC_GetSysClockFreq() == config->hclk_hz)
+	{
+		return;
+	}
+	DEBUG_PRINT("woke up at %u Hz, back to %u Hz\n", (unsigned)HAL_RCC_GetSysClockFreq(), (unsigned)config->hclk_hz);
+	if (config->sysclk_source == RCC_SYSCLKSOURCE_MSIS)
+	{
+		if (config->hclk_hz > EPOD_BOOSTER_MIN_HZ)
+		{
+			HAL_PWREx_EnableEpodBooster(); // Returns at once if it stayed ready
+		}
+		perf_start_msis(config);
+	}
+	perf_switch_sysclk(config);
+	HAL_RCCEx_StopWakeupSysclkConfig(config->stop_wakeup);
+	power_domains_retime();
+}
+
+/*
+ * Residency and wakeup accounting.  The time since the last mode change is
+ * added to the mode being left: sys_sleep() moves between RUN and STOP2,
+ * sys_power_off() between RUN and OFF, and the outermost interrupt handler
+ * taken in either between that mode and IRQ.  With sleep-on-exit the core
+ * goes back to sleep when that handler returns; when it returns to the main
+ * loop instead, the caller moves on to RUN a few instructions later.
+ *
+ * For the energy model, the same intervals are also added up by the perf
+ * level awake time runs at and while the display booster is on, so a level
+ * change or a booster switch closes the interval too.
+ *
+ * The outermost handler of every wakeup closes two intervals, so they are
+ * timed with rtc_ticks(), a read of the live RTC counters, and kept in its
+ * sub-second steps: the conversion to ms is left to sys_power_stats().
+ */
+static sys_power_stats_t power_stats; // The counts; the times are below
+static uint64_t mode_ticks[SYS_POWER_MODES];
+static uint64_t awake_ticks[SYS_PERF_LEVELS];
+static uint64_t display_ticks;
+static uint64_t power_mark; // rtc_ticks() of the last mode change
+static int power_mode = SYS_POWER_RUN;
+static int irq_depth;
+static int irq_from; // Mode the outermost handler interrupted
+static bool display_on; // Booster on since power_mark
+
+static uint64_t ticks_ms(uint64_t ticks)
+{
+	return ticks * 1000 / RTC_TICKS_PER_S;
+}
+
+static void power_enter_mode(int mode)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	uint64_t now = rtc_ticks();
+	uint64_t elapsed = now - power_mark;
+	mode_ticks[power_mode] += elapsed;
+	if (power_mode == SYS_POWER_RUN || power_mode == SYS_POWER_IRQ)
+	{
+		awake_ticks[perf_level] += elapsed;
+	}
+	if (display_on)
+	{
+		display_ticks += elapsed;
+	}
+	power_mark = now;
+	power_mode = mode;
+	__set_PRIMASK(primask);
+}
+
+// Close the interval without changing mode
+static void power_account(void)
+{
+	power_enter_mode(power_mode);
+}
+
+void power_count_display(int on)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	power_account();
+	display_on = on;
+	__set_PRIMASK(primask);
+}
+
+void power_count_spi(uint32_t bytes)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	power_stats.spi_bytes += bytes;
+	__set_PRIMASK(primask);
+}
+
+void power_count_adc(void)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq(); // Also sampled from the RTC wakeup handler
+	power_stats.adc_conversions++;
+	__set_PRIMASK(primask);
+}
+
+void sys_power_irq_enter(int source)
+{
+	if (irq_depth++ == 0 && (power_mode == SYS_POWER_STOP2 || power_mode == SYS_POWER_OFF))
+	{
+		irq_from = power_mode;
+		power_enter_mode(SYS_POWER_IRQ);
+		power_stats.wakeups[(source >= 0 && source < SYS_WAKE_SOURCES) ? source : SYS_WAKE_OTHER]++;
+	}
+}
+
+void sys_power_irq_exit(void)
+{
+	if (--irq_depth == 0 && power_mode == SYS_POWER_IRQ)
+	{
+		power_enter_mode(irq_from);
+	}
+}
+
+void sys_power_stats(sys_power_stats_t *stats)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	power_account();
+	*stats = power_stats;
+	for (int mode = 0; mode < SYS_POWER_MODES; mode++)
+	{
+		stats->ms[mode] = ticks_ms(mode_ticks[mode]);
+	}
+	for (int level = 0; level < SYS_PERF_LEVELS; level++)
+	{
+		stats->awake_ms[level] = ticks_ms(awake_ticks[level]);
+	}
+	stats->display_ms = ticks_ms(display_ticks);
+	__set_PRIMASK(primask);
+}
+
+void sys_power_stats_reset(void)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	memset(&power_stats, 0, sizeof(power_stats));
+	memset(mode_ticks, 0, sizeof(mode_ticks));
+	memset(awake_ticks, 0, sizeof(awake_ticks));
+	display_ticks = 0;
+	power_mark = rtc_ticks();
+	__set_PRIMASK(primask);
+}
+
+void sys_power_stats_dump(void)
+{
+	static const char *const mode_name[SYS_POWER_MODES] = {"run", "irq", "stop2", "off"};
+	static const char *const source_name[] = {"lptim", "rtc wakeup", "rtc alarm", "on key", "other"};
+	sys_power_stats_t stats;
+	uint64_t total = 0;
+
+	sys_power_stats(&stats);
+	for (int mode = 0; mode < SYS_POWER_MODES; mode++)
+	{
+		total += stats.ms[mode];
+	}
+	SEGGER_RTT_printf(0, "POWER %u sleeps, %u power-offs, resume %u ms\n", (unsigned)stats.sleeps,
+			  (unsigned)stats.offs, (unsigned)stats.resume_ms);
+	for (int mode = 0; mode < SYS_POWER_MODES; mode++)
+	{
+		// No 64-bit or floating point formats in SEGGER_RTT_printf()
+		uint32_t permille = total ? (uint32_t)(stats.ms[mode] * 1000 / total) : 0;
+		SEGGER_RTT_printf(0, "  %-5s %8u.%03u s %3u.%u%%\n", mode_name[mode], (unsigned)(stats.ms[mode] / 1000),
+				  (unsigned)(stats.ms[mode] % 1000), (unsigned)(permille / 10), (unsigned)(permille % 10));
+	}
+	for (int source = 0; source < SYS_WAKE_SOURCES; source++)
+	{
+		if (stats.wakeups[source] == 0)
+		{
+			continue;
+		}
+		if (source < SYS_WAKE_LPTIM)
+		{
+			SEGGER_RTT_printf(0, "  exti%-2d %u\n", source, (unsigned)stats.wakeups[source]);
+		}
+		else
+		{
+			SEGGER_RTT_printf(0, "  %s %u\n", source_name[source - SYS_WAKE_LPTIM], (unsigned)stats.wakeups[source]);
+		}
+	}
+}
+
+void sys_sleep(int off)
+{
+	auto_off_service(); // Presses and the alarm seen while the main loop was busy
+
+	// Interrupts taken in STOP2 run on the wakeup clock, HSI16 unless the
+	// level is LOW.  BOOST stays set, booster included: power_check_clock()
+	// only has the MSIS to start again, which leaves a keypress one clock
+	// switch from its keycode rather than a level change each way
+	vbat_wait(); // A battery sample runs on HCLK, which STOP2 stops
+
+	// Arm the rows for EXTI wakeup: any key, or only the ON key when off.
+	// If the keyboard tick is still debouncing, it arms them when all keys
+	// are up and keeps the MCU in STOP2 in the meantime.
+	key_arm_wakeup(off);
 
 	// Go back to STOP mode after interrupt completes
 	HAL_PWR_EnableSleepOnExit();
@@ -71,28 +517,114 @@ void sys_sleep(int off)
 
 	HAL_DBGMCU_EnableDBGStopMode();
 	DEBUG_PRINT("--- sleep (off = %d)---\n", off);
+	power_stats.sleeps++;
+	power_enter_mode(SYS_POWER_STOP2);
 	HAL_PWR_EnterSTOPMode(PWR_LOWPOWERMODE_STOP2, PWR_STOPENTRY_WFI);
+	power_enter_mode(SYS_POWER_RUN);
+	power_check_clock();
 	DEBUG_PRINT("--- wake up --- \n");
+	HAL_ResumeTick();
+
+	// Contact bounce is handled by the keyboard tick: no settling delay here
+	key_disarm_wakeup();
+	auto_off_service();
+}
+
+/*
+ * Deep power-off in Stop 3.  Only the RTC keeps running: there is no LPTIM1
+ * time base, no EXTI and no SysTick until the ON key, so sys_timer deadlines
+ * move out by the time spent off.  The SRAM and register contents are kept,
+ * so resuming is the return from WFI: there is nothing to initialize again
+ * and the calculator state and framebuffer are where they were.  SRAM1 holds
+ * everything the FLASH layout links; SRAM2, which it leaves unused, is not
+ * retained.
+ *
+ * The ON key's row, PB15, doubles as wakeup pin WKUP7.  With the ON column
+ * driven low as for sys_sleep(1), pressing ON makes the edge that wakes the
+ * core through the PWR interrupt.
+ */
+#ifndef POWER_OFF_RAM_DOWN
+#define POWER_OFF_RAM_DOWN PWR_SRAM2_FULL_STOP_RETENTION
+#endif
+#define POWER_OFF_WAKEUP_LINE PWR_WAKEUP_LINE7
 
-	HAL_NVIC_DisableIRQ(EXTI0_IRQn);
-	HAL_NVIC_DisableIRQ(EXTI1_IRQn);
-	HAL_NVIC_DisableIRQ(EXTI2_IRQn);
-	HAL_NVIC_DisableIRQ(EXTI3_IRQn);
-	HAL_NVIC_DisableIRQ(EXTI4_IRQn);
-	HAL_NVIC_DisableIRQ(EXTI5_IRQn);
-	HAL_NVIC_DisableIRQ(EXTI13_IRQn);
-	HAL_NVIC_DisableIRQ(EXTI14_IRQn);
-	HAL_NVIC_DisableIRQ(EXTI15_IRQn);
-
-	// 100 us delay to let contact bounce settle before scanning the keyboard. 
-	delay_us(100);
-
-	// Re-enable the internal pull ups on all rows to make keyboard scanning
-	// more responsive.  Also, disable interrupts.
-	GPIO_INIT_ARRAY(row_pin_array,
-					GPIO_MODE_INPUT,
-					GPIO_PULLUP,
-					GPIO_SPEED_FREQ_LOW);
+static volatile bool power_off_woken;
+static uint64_t resume_mark; // rtc_ticks() when the ON key ended the last power-off
+static bool resume_pending;	// No lcd_refresh() since
+
+void HAL_PWR_WKUP7_Callback(void)
+{
+	power_off_woken = true;
+}
+
+void sys_power_off(void)
+{
+	// The keyboard tick can't run in Stop 3: let the ON key that asked for
+	// this go up first
+	wait_for_key_release();
+
+	// Unlike sys_sleep(), off is for long: the booster goes down with BOOST
+	int level = perf_level;
+	if (level == SYS_PERF_BOOST)
+	{
+		sys_set_perf_level(SYS_PERF_NORMAL);
+	}
+	vbat_wait();
+	key_arm_wakeup(1);
+	HAL_SuspendTick();
+
+	DEBUG_PRINT("--- power off ---\n");
+	HAL_PWREx_DisableRAMsContentStopRetention(POWER_OFF_RAM_DOWN);
+	power_off_woken = false;
+	HAL_PWR_EnableWakeUpLine(POWER_OFF_WAKEUP_LINE, PWR_WAKEUP_SELECT_0, PWR_WAKEUP_POLARITY_LOW);
+	HAL_NVIC_EnableIRQ(PWR_IRQn);
+
+	power_stats.offs++;
+	HAL_PWR_DisableSleepOnExit();
+	__disable_irq();
+	power_enter_mode(SYS_POWER_OFF);
+	while (!power_off_woken)
+	{
+		// WFI wakes on a pending interrupt with PRIMASK set: take it, and
+		// unless it was the ON key go back to Stop 3
+		HAL_PWR_EnterSTOPMode(PWR_LOWPOWERMODE_STOP3, PWR_STOPENTRY_WFI);
+		__enable_irq();
+		__disable_irq();
+	}
+	power_enter_mode(SYS_POWER_RUN);
+	power_check_clock();
+	__enable_irq();
+	resume_mark = power_mark;
+	resume_pending = true;
+
+	HAL_NVIC_DisableIRQ(PWR_IRQn);
+	HAL_PWR_DisableWakeUpLine(POWER_OFF_WAKEUP_LINE);
+	HAL_PWREx_EnableRAMsContentStopRetention(POWER_OFF_RAM_DOWN);
+	DEBUG_PRINT("--- power on ---\n");
+	HAL_ResumeTick();
+
+	// The row's EXTI line missed the press: hand it to the keyboard the way
+	// its falling edge interrupt would have
+	uint16_t on_row = row_pin_array[NUM_ROW_PINS - 1].pin;
+	__disable_irq();
+	__HAL_GPIO_EXTI_CLEAR_FALLING_IT(on_row);
+	HAL_GPIO_EXTI_Falling_Callback(on_row);
+	__enable_irq();
+	key_disarm_wakeup();
+
+	if (level != perf_level)
+	{
+		sys_set_perf_level(level);
+	}
+}
+
+void sys_power_refreshed(void)
+{
+	if (resume_pending)
+	{
+		resume_pending = false;
+		power_stats.resume_ms = (uint32_t)ticks_ms(rtc_ticks() - resume_mark);
+	}
 }
 
 /**
@@ -3,26 +3,104 @@
 #include "rtc.h"
 #include "orcos.h"
 
+/*
+ * The shadow registers are bypassed (see MX_RTC_Init()): TR, DR and SSR are
+ * read live, so a read right after STOP2 is current without waiting for RSF
+ * to be set again.  Reads of different registers can straddle a sub-second
+ * step, so they are repeated until SSR and TR read the same twice.
+ */
+static uint32_t rtc_read_raw(uint32_t *tr, uint32_t *dr)
+{
+    uint32_t ssr;
+
+    do {
+        ssr = RTC->SSR;
+        *tr = RTC->TR;
+        *dr = RTC->DR;
+    } while (ssr != RTC->SSR || *tr != RTC->TR);
+    return ssr;
+}
+
+static uint32_t bcd(uint32_t value)
+{
+    return (value >> 4) * 10 + (value & 0xF);
+}
+
+static uint32_t rtc_seconds(uint32_t tr)
+{
+    uint32_t hours = bcd((tr & (RTC_TR_HT | RTC_TR_HU)) >> RTC_TR_HU_Pos);
+    uint32_t minutes = bcd((tr & (RTC_TR_MNT | RTC_TR_MNU)) >> RTC_TR_MNU_Pos);
+    return (hours * 60 + minutes) * 60 + bcd((tr & (RTC_TR_ST | RTC_TR_SU)) >> RTC_TR_SU_Pos);
+}
+
+// Days since 2000-01-01
+static uint32_t rtc_days(uint32_t dr)
+{
+    static const uint16_t days_before_month[12] = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334};
+    uint32_t year = bcd((dr & (RTC_DR_YT | RTC_DR_YU)) >> RTC_DR_YU_Pos);
+    uint32_t month = bcd((dr & (RTC_DR_MT | RTC_DR_MU)) >> RTC_DR_MU_Pos);
+    uint32_t date = bcd((dr & (RTC_DR_DT | RTC_DR_DU)) >> RTC_DR_DU_Pos);
+
+    // Years 2000 to 2099: every fourth one is a leap year, 2000 included
+    uint32_t days = year * 365U + (year + 3U) / 4U + days_before_month[month - 1] + date - 1U;
+    if (month > 2 && year % 4 == 0) {
+        days++;
+    }
+    return days;
+}
+
 // implement rtc_read()
 void rtc_read( 	tm_t * tm, dt_t * dt)
 {
-    RTC_TimeTypeDef Time;
-    RTC_DateTypeDef Date;
-
-    /* Get the RTC calendar time */
-    HAL_RTC_GetTime(&hrtc, &Time, RTC_FORMAT_BIN);
-    // Do not skip reading the date: this is needed to trigger an update to the shadow registers!
-    HAL_RTC_GetDate(&hrtc, &Date, RTC_FORMAT_BIN);
+    uint32_t tr, dr;
+    uint32_t ssr = rtc_read_raw(&tr, &dr);
 
     if (tm != NULL) {
-        tm->sec = Time.Seconds;
-        tm->min = Time.Minutes;
-        tm->hour = Time.Hours;
+        tm->csec = (RTC_SYNCH_PREDIV - ssr) * 100 / RTC_TICKS_PER_S;
+        tm->sec = bcd((tr & (RTC_TR_ST | RTC_TR_SU)) >> RTC_TR_SU_Pos);
+        tm->min = bcd((tr & (RTC_TR_MNT | RTC_TR_MNU)) >> RTC_TR_MNU_Pos);
+        tm->hour = bcd((tr & (RTC_TR_HT | RTC_TR_HU)) >> RTC_TR_HU_Pos);
     }
 
     if (dt != NULL) {
-        dt->day = Date.WeekDay;
-        dt->month = Date.Month;
-        dt->year = Date.Year;
+        dt->day = (dr & RTC_DR_WDU) >> RTC_DR_WDU_Pos;
+        dt->month = bcd((dr & (RTC_DR_MT | RTC_DR_MU)) >> RTC_DR_MU_Pos);
+        dt->year = bcd((dr & (RTC_DR_YT | RTC_DR_YU)) >> RTC_DR_YU_Pos);
     }
-}
\ No newline at end of file
+}
+
+// Milliseconds since midnight, to the resolution of the RTC sub-seconds
+uint32_t rtc_ms(void)
+{
+    uint32_t tr, dr;
+    uint32_t ssr = rtc_read_raw(&tr, &dr);
+
+    return rtc_seconds(tr) * 1000 + (RTC_SYNCH_PREDIV - ssr) * 1000 / RTC_TICKS_PER_S;
+}
+
+// Sub-second steps since 2000-01-01: no calendar arithmetic unless the date
+// changed since the last call, so it is cheap enough for every interrupt
+uint64_t rtc_ticks(void)
+{
+    static uint32_t day_dr = UINT32_MAX; // DR the day number below is for
+    static uint32_t day;
+    uint32_t tr, dr, days;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t ssr = rtc_read_raw(&tr, &dr);
+    if (dr != day_dr) {
+        day = rtc_days(dr);
+        day_dr = dr;
+    }
+    days = day;
+    __set_PRIMASK(primask);
+
+    return ((uint64_t)days * 86400U + rtc_seconds(tr)) * RTC_TICKS_PER_S + RTC_SYNCH_PREDIV - ssr;
+}
+
+// Milliseconds since 2000-01-01 00:00, for intervals that may span midnight
+uint64_t rtc_epoch_ms(void)
+{
+    return rtc_ticks() * 1000 / RTC_TICKS_PER_S;
+}
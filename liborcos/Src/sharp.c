@@ -11,12 +11,15 @@
  */
 
 #include "fonts.h"
-#include "openrpncalc.h"
+#include "io.h"
+#include "assets.h"
 #include "orcos.h"
 #include "pin_definitions.h"
+#include "power.h"
 #include "sharp.h"
 #include "sharp_graphics.h"
 #include "sharp_lowlevel.h"
+#include "timer.h"
 #include "stm32u3xx_hal.h"
 #include "stm32u3xx_hal_rtc_ex.h"
 
@@ -29,19 +32,22 @@
 #endif
 
 extern RTC_HandleTypeDef hrtc;
-TIM_HandleTypeDef htim1;
 SPI_HandleTypeDef hspi2;
-LPTIM_HandleTypeDef hlptim1;
 
 
-// 1bpp packed buffer (400x240 / 8 = 12,000 bytes)
-uint8_t g_framebuffer[LCD_HEIGHT][LCD_WIDTH / 8];
+// 1bpp packed buffer (400x240 / 8 = 12,000 bytes), word aligned for lcd_putsAt
+uint8_t g_framebuffer[LCD_HEIGHT][LCD_WIDTH / 8] __attribute__((aligned(4)));
 
 // Power management variables
-static int timeout_counter = 0;
 static bool lcd_is_on = false;
+static bool lcd_held = false; // Showing the power-off image, see draw_power_off_image()
 static int current_test_screen = 0;
-#define OFF_TIMEOUT (5 * 60) // 5 min timeout before switching off
+#define AUTO_OFF_TIMEOUT (5 * 60) // 5 min without a key press before switching off
+
+static volatile bool auto_off;
+static volatile int auto_off_cnt;
+static volatile bool auto_off_due;   // Alarm fired, display not switched off yet
+static volatile bool auto_off_rearm; // Key pressed since the alarm was set
 
 
 /**
@@ -58,11 +64,13 @@ static int current_test_screen = 0;
 /**
  * @brief RTC Wakeup Timer callback function
  * 
- * Called every second by RTC wakeup timer interrupt to:
+ * Called every second by RTC wakeup timer interrupt while the display is on to:
  * 1. Toggle EXTCOMIN signal (required for Sharp Memory LCD operation)
- * 2. Update display timeout counter
+ * 2. Sample the battery every few seconds, see vbat_tick()
  * 3. Handle special cases like RTC test screen updates
  * 
+ * The display timeout runs on RTC alarm A instead, see reset_auto_off().
+ * 
  * Note: Must read both time and date registers to properly update shadow registers
  * 
  * @param hrtc Pointer to RTC handle
@@ -70,6 +78,11 @@ static int current_test_screen = 0;
 void WakeUpTimerEventCallback(RTC_HandleTypeDef *hrtc)
 {
     GPIO_TOGGLE(extcomin);  // Required to prevent LCD image retention
+    vbat_tick();
+    if (auto_off_due || auto_off_rearm)
+    {
+        HAL_PWR_DisableSleepOnExit(); // Missed by sys_sleep(), or the RTC was busy: have it again
+    }
     
     RTC_TimeTypeDef Time;
     RTC_DateTypeDef Date;
@@ -79,8 +92,7 @@ void WakeUpTimerEventCallback(RTC_HandleTypeDef *hrtc)
     HAL_RTC_GetDate(hrtc, &Date, RTC_FORMAT_BIN);
     
 #if DEBUG
-    SEGGER_RTT_printf(0, "wake up timer event %02d:%02d! (%d)\n", 
-                     Time.Minutes, Time.Seconds, timeout_counter);
+    SEGGER_RTT_printf(0, "wake up timer event %02d:%02d!\n", Time.Minutes, Time.Seconds);
 #endif
 
     /* Special case: Update RTC test screen if currently displayed */
@@ -88,24 +100,110 @@ void WakeUpTimerEventCallback(RTC_HandleTypeDef *hrtc)
     {
         LCD_test_screen(current_test_screen);
     }
+}
+
+/*
+ * Auto-off.  A single RTC alarm is set AUTO_OFF_TIMEOUT after the last key
+ * press, matching on the time of day only (the timeout is well under a
+ * day), rather than counting the 1 Hz wakeups: the core is woken once, at
+ * the deadline, and not at all while the display is off.
+ *
+ * Both ends run from the main loop, through auto_off_service() in
+ * sys_sleep(): the alarm handler and the keyboard tick only raise a flag.
+ * Setting the alarm takes the RTC HAL lock, which an interrupt could find
+ * held by LCD_power_on() or LCD_power_off(), and switching off talks to
+ * the panel.
+ */
+
+static void AutoOffAlarmCallback(RTC_HandleTypeDef *hrtc)
+{
+    (void)hrtc;
+    auto_off_due = true;
+    HAL_PWR_DisableSleepOnExit(); // Let sys_sleep() switch off
+}
+
+void auto_off_key_pressed(void)
+{
+    auto_off_rearm = true;
+}
 
-    /* Increment and check display timeout counter */
-    timeout_counter++;
-    if (timeout_counter > OFF_TIMEOUT)
+void auto_off_service(void)
+{
+    if (auto_off_rearm)
+    {
+        reset_auto_off(); // A key beat the timeout
+    }
+    else if (auto_off_due)
     {
-        LCD_power_off(1);  // Turn off display after timeout period (5 minutes)
+        auto_off_due = false;
+        if (lcd_is_on)
+        {
+            DEBUG_PRINT("auto off\n");
+            LCD_power_off(1);
+            auto_off = true;
+            auto_off_cnt++;
+        }
     }
 }
 
-void lcd_keep_alive()
+void reset_auto_off(void)
+{
+    RTC_AlarmTypeDef sAlarm = {0};
+    RTC_TimeTypeDef Time;
+    RTC_DateTypeDef Date;
+
+    // Presses from now on need another pass
+    auto_off_rearm = false;
+    auto_off_due = false;
+    auto_off = false;
+    if (!lcd_is_on)
+    {
+        return; // LCD_power_on() arms it
+    }
+
+    HAL_RTC_GetTime(&hrtc, &Time, RTC_FORMAT_BIN);
+    HAL_RTC_GetDate(&hrtc, &Date, RTC_FORMAT_BIN); // Unlock the shadow registers
+
+    uint32_t sec = ((Time.Hours * 60 + Time.Minutes) * 60 + Time.Seconds + AUTO_OFF_TIMEOUT) % 86400;
+    sAlarm.AlarmTime.Hours = sec / 3600;
+    sAlarm.AlarmTime.Minutes = sec / 60 % 60;
+    sAlarm.AlarmTime.Seconds = sec % 60;
+    sAlarm.AlarmMask = RTC_ALARMMASK_DATEWEEKDAY;
+    sAlarm.AlarmSubSecondMask = RTC_ALARMSUBSECONDMASK_ALL;
+    sAlarm.AlarmDateWeekDaySel = RTC_ALARMDATEWEEKDAYSEL_DATE;
+    sAlarm.AlarmDateWeekDay = 1;
+    sAlarm.Alarm = RTC_ALARM_A;
+
+    HAL_StatusTypeDef status = HAL_RTC_RegisterCallback(&hrtc, HAL_RTC_ALARM_A_EVENT_CB_ID, AutoOffAlarmCallback);
+    if (status == HAL_OK)
+    {
+        status = HAL_RTC_SetAlarm_IT(&hrtc, &sAlarm, RTC_FORMAT_BIN);
+    }
+    if (status == HAL_BUSY)
+    {
+        auto_off_rearm = true; // RTC in use: try again on the next pass
+    }
+    else if (status != HAL_OK)
+    {
+        LCD_Error_Handler();
+    }
+}
+
+int is_auto_off(void)
+{
+    return auto_off;
+}
+
+int sys_auto_off_cnt(void)
 {
-    timeout_counter = 0;
+    return auto_off_cnt;
 }
 
 void LCD_power_on()
 {
     DEBUG_PRINT("\n--- LDC_power_on() ---\n");
     GPIO_WRITE(v5_en, GPIO_PIN_SET); // 5V booster enable
+    power_count_display(1);
     HAL_Delay(1);
     GPIO_WRITE(disp, GPIO_PIN_SET); // DISP signal to "ON"
     /* Configure wakeup interrupt */
@@ -118,21 +216,24 @@ void LCD_power_on()
     }
     HAL_RTCEx_SetWakeUpTimer_IT(&hrtc, 2047, RTC_WAKEUPCLOCK_RTCCLK_DIV16, 0);
     lcd_is_on = true;
+    lcd_held = false;
+    reset_auto_off();
 }
 
 void LCD_power_off(int clear)
 {
     DEBUG_PRINT("\n--- LDC_power_off() ---\n");
-    // XXX: this prevents waking up form STOP2
-    // HAL_TIM_Base_Stop_IT(&htim1); // Stop the timer
     delay_us(30);
     if (clear)
         GPIO_WRITE(disp, GPIO_PIN_RESET); // DISP signal to "OFF"
     delay_us(30);
     GPIO_WRITE(extcomin, GPIO_PIN_RESET);  // EXTCOMIN signal of "OFF"
     GPIO_WRITE(v5_en, GPIO_PIN_RESET); // 5V booster disable
+    power_count_display(0);
     HAL_RTCEx_DeactivateWakeUpTimer(&hrtc);
+    HAL_RTC_DeactivateAlarm(&hrtc, RTC_ALARM_A);
     lcd_is_on = false;
+    lcd_held = false;
 }
 
 bool LCD_is_on()
@@ -140,6 +241,83 @@ bool LCD_is_on()
     return lcd_is_on;
 }
 
+/*
+ * Power-off image.  The memory LCD keeps what it was last sent for as long
+ * as the booster is on and EXTCOMIN keeps toggling, for a few microamps.
+ * draw_power_off_image() sends the next image of the cycle once and leaves
+ * the panel holding it: SPI2 gated, no auto-off alarm, no battery samples,
+ * and an RTC wakeup handler that only toggles EXTCOMIN.  The RTC keeps
+ * counting in Stop 3, so sys_power_off() wakes for that toggle once a second
+ * and goes straight back.  LCD_power_on() or LCD_power_off() ends it.
+ */
+static uint32_t off_image_cycle;
+
+static void HoldTimerEventCallback(RTC_HandleTypeDef *hrtc)
+{
+    (void)hrtc;
+    GPIO_TOGGLE(extcomin); // Nothing else: the core is back in Stop 3 at once
+}
+
+static void off_image_splash(void)
+{
+    const asset_t *splash = asset_lookup(ASSET_OPENRPNCALC);
+    lcd_clear_buffer();
+    lcd_draw_img(splash->data, splash->width, splash->height, 0, 0, LCD_SET_VALUE);
+}
+
+static void off_image_inverted(void)
+{
+    off_image_splash();
+    lcd_invert_framebuffer();
+}
+
+static void off_image_rooks(void)
+{
+    const asset_t *rook = asset_lookup(ASSET_ROOK);
+    lcd_clear_buffer();
+    for (int x = 0; x < LCD_WIDTH; x += 64)
+    {
+        for (int y = 0; y < LCD_HEIGHT; y += 64)
+        {
+            lcd_draw_img(rook->data, rook->width, rook->height, x, y, LCD_SET_VALUE);
+            lcd_draw_img(rook->data, rook->width, rook->height, x + 32, y + 32, LCD_SET_VALUE);
+        }
+    }
+}
+
+static void (*const off_images[])(void) = {off_image_splash, off_image_inverted, off_image_rooks};
+#define OFF_IMAGES (sizeof(off_images) / sizeof(off_images[0]))
+
+int draw_power_off_image(int allow_errors)
+{
+    (void)allow_errors; // The images are built in: none can fail to load
+
+    off_images[off_image_cycle++ % OFF_IMAGES]();
+    if (!lcd_is_on && !lcd_held)
+    {
+        GPIO_WRITE(v5_en, GPIO_PIN_SET); // 5V booster enable
+        power_count_display(1);
+        HAL_Delay(1);
+        GPIO_WRITE(disp, GPIO_PIN_SET);
+    }
+    lcd_refresh();
+
+    HAL_RTC_DeactivateAlarm(&hrtc, RTC_ALARM_A);
+    if (HAL_RTC_RegisterCallback(&hrtc, HAL_RTC_WAKEUPTIMER_EVENT_CB_ID, HoldTimerEventCallback) != HAL_OK)
+    {
+        LCD_Error_Handler();
+    }
+    HAL_RTCEx_SetWakeUpTimer_IT(&hrtc, 2047, RTC_WAKEUPCLOCK_RTCCLK_DIV16, 0);
+    lcd_is_on = false;
+    lcd_held = true;
+    return 0;
+}
+
+void reset_off_image_cycle(void)
+{
+    off_image_cycle = 0;
+}
+
 
 
 
@@ -192,6 +370,19 @@ int lcd_for_calc(int what_screen)
                  vbat / 1000, vbat % 1000);
         lcd_putsAt(voltage_str, FONT_16x26, 0, 0, LCD_SET_VALUE);
 
+        // Average current so far, which is also the uAh drawn per hour
+        sys_energy_t energy;
+        sys_energy(&energy);
+        char energy_str[48];
+        int len = snprintf(energy_str, sizeof(energy_str), "%lu.%03lu uAh/h",
+                           (unsigned long)(energy.avg_na / 1000), (unsigned long)(energy.avg_na % 1000));
+        if (energy.life_hours)
+        {
+            snprintf(energy_str + len, sizeof(energy_str) - len, ", %lu days",
+                     (unsigned long)(energy.life_hours / 24));
+        }
+        lcd_putsAt(energy_str, FONT_12x20, 0, 200, LCD_SET_VALUE);
+
         break;
     default:
         lcd_draw_test_pattern(8);
@@ -219,25 +410,28 @@ void LCD_test_screen(uint16_t count)
     }
     if (count == 3)
     {
+        const asset_t *rook = asset_lookup(ASSET_ROOK);
         lcd_draw_test_pattern(32);
         for (int i = 0; i < 7; i++)
         {
             for (int j = 0; j < 6; j++)
             {
-                lcd_draw_img(rook_img, 32, 32, i * 64, j * 64, LCD_EMPTY_VALUE);
-                lcd_draw_img(rook_img, 32, 32, i * 64, j * 64 + 32, LCD_SET_VALUE);
-                lcd_draw_img(rook_img, 32, 32, i * 64 + 32, j * 64 + 32, LCD_EMPTY_VALUE);
-                lcd_draw_img(rook_img, 32, 32, i * 64 + 32, j * 64, LCD_SET_VALUE);
+                lcd_draw_img(rook->data, rook->width, rook->height, i * 64, j * 64, LCD_EMPTY_VALUE);
+                lcd_draw_img(rook->data, rook->width, rook->height, i * 64, j * 64 + 32, LCD_SET_VALUE);
+                lcd_draw_img(rook->data, rook->width, rook->height, i * 64 + 32, j * 64 + 32, LCD_EMPTY_VALUE);
+                lcd_draw_img(rook->data, rook->width, rook->height, i * 64 + 32, j * 64, LCD_SET_VALUE);
             }
         }
     }
     if (count == 4)
     {
+        const asset_t *splash = asset_lookup(ASSET_OPENRPNCALC);
+        const asset_t *smiley = asset_lookup(ASSET_SMILEY);
         lcd_clear_buffer();
-        lcd_draw_img(pixel_data_bin, 400, 240, 0, 0, LCD_SET_VALUE);
-        lcd_draw_img(test_img, 32, 32, 0, 0, LCD_SET_VALUE);
-        lcd_draw_img(test_img, 32, 32, 50, 50, LCD_SET_VALUE);
-        lcd_draw_img(test_img, 32, 32, 90, 90, LCD_EMPTY_VALUE);
+        lcd_draw_img(splash->data, splash->width, splash->height, 0, 0, LCD_SET_VALUE);
+        lcd_draw_img(smiley->data, smiley->width, smiley->height, 0, 0, LCD_SET_VALUE);
+        lcd_draw_img(smiley->data, smiley->width, smiley->height, 50, 50, LCD_SET_VALUE);
+        lcd_draw_img(smiley->data, smiley->width, smiley->height, 90, 90, LCD_EMPTY_VALUE);
 
         lcd_draw_img((uint8_t[]){0xff, 0xff}, 2, 2, 100, 100, LCD_SET_VALUE);
         lcd_draw_img((uint8_t[]){0xff, 0xff}, 2, 2, 106, 100, LCD_SET_VALUE);
@@ -268,8 +462,8 @@ void LCD_test_screen(uint16_t count)
         lcd_putsAt("Reverse", FONT_24x40, 120, 80, LCD_SET_VALUE);
 
         // Second line - highlighted text with background
-        FontDef_t *font = font_lookup(FONT_24x40);
-        uint16_t text_width = strlen("Polish") * font->FontWidth;
+        const FontDef_t *font = font_lookup(FONT_24x40);
+        uint16_t text_width = strlen("Polish") * font->Advance;
         uint16_t text_height = font->FontHeight;
         uint16_t padding = 10;
 
@@ -301,6 +495,7 @@ void LCD_test_screen(uint16_t count)
     if (count == 8)
     {
         // Draw test image line by line using LCD_write_line
+        const uint8_t *splash = asset_lookup(ASSET_OPENRPNCALC)->data;
         uint8_t line_buffer[LCD_LINE_BUF_SIZE] = {0};
 
         // Loop through each line of the test image
@@ -312,7 +507,7 @@ void LCD_test_screen(uint16_t count)
             // Copy one line swapping byte order
             for (int x = 0; x < LCD_LINE_SIZE; x++)
             {
-                uint8_t original = pixel_data_bin[y * LCD_LINE_SIZE + x];
+                uint8_t original = splash[y * LCD_LINE_SIZE + x];
                 // Reverse bits in each byte
                 line_buffer[2 + x] = ((original & 0x01) << 7) |
                                      ((original & 0x02) << 5) |
@@ -11,63 +11,98 @@
 #include <string.h>
 #include <stdbool.h>
 
-extern uint8_t g_framebuffer[LCD_HEIGHT][LCD_WIDTH / 8];
 
 static void lcd_draw_img_aligned(const uint8_t *img, uint32_t w, uint32_t h, uint32_t x, uint32_t y, uint8_t color, bool msb);
 static void lcd_draw_img_unaligned(const uint8_t *img, uint32_t w, uint32_t h, uint32_t x, uint32_t y, uint8_t color, bool msb);
 
-FontDef_t *font_lookup(uint8_t font_id)
-{
-    switch (font_id)
-    {
-    case FONT_6x8:
-        return &font_6x8;
-    case FONT_7x12b:
-        return &font_7x12b;
-    case FONT_12x20:
-        return &font_12x20;
-    case FONT_16x26:
-        return &font_16x26;
-    case FONT_24x40:
-        return &font_24x40;
-    default:
-        return NULL; // Invalid font ID
-    }
-}
+/*
+ * Text is rendered as a glyph run: for each font row, the row of every glyph
+ * in the string is shifted into a line accumulator, and the accumulator is
+ * then merged into the framebuffer with one pass of aligned word accesses.
+ * Each framebuffer row is read and written once per string instead of once
+ * per character.
+ *
+ * The framebuffer is treated as one little-endian bit stream (bit k of byte j
+ * is pixel 8*j + k), so rows whose start is not word-aligned (every odd row,
+ * since a row is 400 bits) are handled by offsetting the accumulator.
+ */
+typedef uint32_t __attribute__((may_alias)) fb_word_t;
+
+#define FB_WORD_BITS 32
+#define PUTS_ACC_WORDS ((FB_WORD_BITS + LCD_WIDTH) / FB_WORD_BITS + 2)
 
 void lcd_putsAt(const char *str, uint8_t font_id, uint16_t dx, uint16_t dy, uint8_t color)
 {
-    FontDef_t *font = font_lookup(font_id);
+    const FontDef_t *font = font_lookup(font_id);
     if (font == NULL)
         return;
 
-    uint16_t width = font->FontWidth;
-    uint16_t height = font->FontHeight;
-    uint16_t bytes_per_char = (width + 7) / 8;
-    const char (*font_data)[bytes_per_char * height] = font->data;
-
     if (dy >= LCD_HEIGHT)
         return;
 
-    uint16_t xpos = ((dx + 7) / 8) << 3;
-    int char_idx = 0;
+    uint32_t width = font->FontWidth;
+    uint32_t height = font->FontHeight;
+    uint32_t advance = font->Advance;
+    uint32_t bytes_per_row = (width + 7) / 8;
+    uint32_t bytes_per_char = bytes_per_row * height;
+    const uint8_t *font_data = font->data;
 
-    // Temporary buffer for one character
-    uint8_t char_buffer[bytes_per_char * height];
+    uint32_t xpos = ((dx + 7) / 8) << 3;
+    if (xpos >= LCD_WIDTH)
+        return;
 
-    while (xpos < LCD_WIDTH && str[char_idx] != '\0')
+    // Only glyphs starting on screen are drawn; their tails are clipped
+    size_t count = 0;
+    for (uint32_t x = xpos; x < LCD_WIDTH && str[count] != '\0'; x += advance)
+        count++;
+    if (count == 0)
+        return;
+
+    fb_word_t *fb = (fb_word_t *)g_framebuffer;
+    uint32_t acc[PUTS_ACC_WORDS];
+
+    for (uint32_t row = 0; row < height && dy + row < LCD_HEIGHT; row++)
     {
-        uint8_t current_char = str[char_idx];
-        const char *char_data = font_data[current_char];
+        uint32_t first_bit = (dy + row) * LCD_WIDTH + xpos;
+        uint32_t shift = first_bit % FB_WORD_BITS;
+        uint32_t limit = shift + LCD_WIDTH - xpos; // first bit past the row
+        uint32_t words = (limit + FB_WORD_BITS - 1) / FB_WORD_BITS;
 
-        // Copy character data directly (already in MSB format)
-        memcpy(char_buffer, char_data, bytes_per_char * height);
+        memset(acc, 0, (words + 1) * sizeof(acc[0]));
 
-        // Draw character using MSB-optimized function
-        lcd_draw_img_unaligned(char_buffer, width, height, xpos, dy, color, true);
+        uint32_t pos = shift;
+        for (size_t i = 0; i < count; i++, pos += advance)
+        {
+            uint8_t ch = str[i];
+            if (ch < font->FirstChar || ch > font->LastChar)
+                continue; // No glyph: leave a blank cell
+            const uint8_t *glyph_row = font_data + (ch - font->FirstChar) * bytes_per_char + row * bytes_per_row;
+            // Up to 32 glyph pixels are merged per step
+            for (uint32_t b = 0; b < bytes_per_row && pos + 8 * b < limit; b += 4)
+            {
+                uint32_t p = pos + 8 * b;
+                uint32_t chunk = glyph_row[b];
+                for (uint32_t k = 1; k < 4 && b + k < bytes_per_row; k++)
+                    chunk |= (uint32_t)glyph_row[b + k] << (8 * k);
+                uint64_t bits = (uint64_t)chunk << (p % FB_WORD_BITS);
+                acc[p / FB_WORD_BITS] |= (uint32_t)bits;
+                acc[p / FB_WORD_BITS + 1] |= (uint32_t)(bits >> FB_WORD_BITS);
+            }
+        }
+        if (limit % FB_WORD_BITS)
+            acc[words - 1] &= (1u << (limit % FB_WORD_BITS)) - 1;
 
-        xpos += width;
-        char_idx++;
+        fb_word_t *dst = &fb[first_bit / FB_WORD_BITS];
+        if (color == LCD_SET_VALUE)
+        {
+            for (uint32_t w = 0; w < words; w++)
+                dst[w] &= ~acc[w]; // Clear bits for black
+        }
+        else
+        {
+            for (uint32_t w = 0; w < words; w++)
+                dst[w] |= acc[w]; // Set bits for white
+        }
     }
 }
 
@@ -7,10 +7,11 @@
 #include "sharp_lowlevel.h"
 #include "sharp.h"
 #include "pin_definitions.h"
+#include "keyboard.h"
+#include "power.h"
+#include "timer.h"
 #include "stm32u3xx_hal.h"
 
-extern RTC_HandleTypeDef hrtc;
-
 void LCD_Error_Handler(void)
 {
     __disable_irq();
@@ -19,36 +20,6 @@ void LCD_Error_Handler(void)
     }
 }
 
-void TIM1_Init(void)
-{
-    TIM_ClockConfigTypeDef sClockSourceConfig = {0};
-    TIM_MasterConfigTypeDef sMasterConfig = {0};
-
-    htim1.Instance = TIM1;
-    htim1.Init.Prescaler = 15;
-    htim1.Init.CounterMode = TIM_COUNTERMODE_UP;
-    htim1.Init.Period = 65535;
-    htim1.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
-    htim1.Init.RepetitionCounter = 0;
-    htim1.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
-    if (HAL_TIM_Base_Init(&htim1) != HAL_OK)
-    {
-        LCD_Error_Handler();
-    }
-    sClockSourceConfig.ClockSource = TIM_CLOCKSOURCE_INTERNAL;
-    if (HAL_TIM_ConfigClockSource(&htim1, &sClockSourceConfig) != HAL_OK)
-    {
-        LCD_Error_Handler();
-    }
-    sMasterConfig.MasterOutputTrigger = TIM_TRGO_RESET;
-    sMasterConfig.MasterOutputTrigger2 = TIM_TRGO2_RESET;
-    sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
-    if (HAL_TIMEx_MasterConfigSynchronization(&htim1, &sMasterConfig) != HAL_OK)
-    {
-        LCD_Error_Handler();
-    }
-}
-
 void SPI2_Init(void)
 {
     SPI_AutonomousModeConfTypeDef HAL_SPI_AutonomousMode_Cfg_Struct = {0};
@@ -88,24 +59,53 @@ void SPI2_Init(void)
     }
 }
 
+/* SCLK of the 16 MHz start-up clock with SPI_BAUDRATEPRESCALER_8, within
+   the 2 MHz the panel accepts */
+#define LCD_SPI_MAX_HZ 2000000
+
+/*
+ * Follow an HCLK change: SPI2 gets the smallest prescaler that keeps SCLK
+ * within the panel's limit.  APB1 runs at HCLK.
+ */
+void __lcd_retime(uint32_t hclk_hz)
+{
+    static const uint32_t spi_prescalers[] = {
+        SPI_BAUDRATEPRESCALER_2, SPI_BAUDRATEPRESCALER_4, SPI_BAUDRATEPRESCALER_8,
+        SPI_BAUDRATEPRESCALER_16, SPI_BAUDRATEPRESCALER_32, SPI_BAUDRATEPRESCALER_64,
+        SPI_BAUDRATEPRESCALER_128, SPI_BAUDRATEPRESCALER_256,
+    };
+    size_t n = 0;
+    while (n < sizeof(spi_prescalers) / sizeof(spi_prescalers[0]) - 1 &&
+           hclk_hz / (2U << n) > LCD_SPI_MAX_HZ)
+    {
+        n++;
+    }
+
+    hspi2.Init.BaudRatePrescaler = spi_prescalers[n];
+    if (HAL_SPI_Init(&hspi2) != HAL_OK)
+    {
+        LCD_Error_Handler();
+    }
+}
+
 void __lcd_init()
 {
-    SPI2_Init();
-    TIM1_Init();
-    HAL_RTCEx_SetWakeUpTimer_IT(&hrtc, 4095, RTC_WAKEUPCLOCK_RTCCLK_DIV8, 0);
-    HAL_TIM_Base_Start_IT(&htim1);
+    SPI2_Init(); // LCD_power_on() starts the 1 Hz EXTCOMIN wakeup
 }
 
 void LCD_write_line(uint8_t *buf)
 {
     buf[0] = 0x1; // Write Line command
     buf[52] = buf[53] = 0;
+    power_domain_get(POWER_DOMAIN_DISPLAY);
     GPIO_WRITE(display_cs, GPIO_PIN_SET);
     delay_us(12);
     HAL_SPI_Transmit(&hspi2, buf, LCD_LINE_BUF_SIZE, HAL_MAX_DELAY);
+    power_count_spi(LCD_LINE_BUF_SIZE);
     delay_us(4);
     GPIO_WRITE(display_cs, GPIO_PIN_RESET);
     delay_us(4);
+    power_domain_put(POWER_DOMAIN_DISPLAY);
 }
 
 void lcd_refresh()
@@ -119,9 +119,11 @@ void lcd_refresh()
     const int num_chunks = (total_lines + chunk_size - 1) / chunk_size;
 
     uint8_t nop = 0x00;
+    power_domain_get(POWER_DOMAIN_DISPLAY);
     GPIO_WRITE(display_cs, GPIO_PIN_SET);
     delay_us(10);
     HAL_SPI_Transmit(&hspi2, &nop, 1, HAL_MAX_DELAY);
+    power_count_spi(1);
     delay_us(10);
     GPIO_WRITE(display_cs, GPIO_PIN_RESET);
     delay_us(10);
@@ -145,14 +147,12 @@ void lcd_refresh()
         GPIO_WRITE(display_cs, GPIO_PIN_SET);
         delay_us(12);
         HAL_SPI_Transmit(&hspi2, frame_buffer, pos, HAL_MAX_DELAY);
+        power_count_spi(pos);
         delay_us(4);
         GPIO_WRITE(display_cs, GPIO_PIN_RESET);
         delay_us(4);
     }
-}
-
-void delay_us(uint16_t us)
-{
-    __HAL_TIM_SET_COUNTER(&htim1, 0);
-    while (__HAL_TIM_GET_COUNTER(&htim1) < us);
+    power_domain_put(POWER_DOMAIN_DISPLAY);
+    key_latency_refreshed();
+    sys_power_refreshed();
 }
@@ -0,0 +1,322 @@
+#include "stm32u3xx_hal.h"
+#include "orcos.h"
+#include "keyboard.h"
+#include "timer.h"
+
+#include <stdbool.h>
+
+/*
+ * Low-power time base.  LPTIM1 counts the LSE, which keeps going in STOP2,
+ * and runs only while something needs it: the keyboard tick while keys are
+ * active, a running sys_timer or a long delay_us().  There is no periodic tick otherwise:
+ * each period is cut to end at the next timer expiry, or at the end of the
+ * 16-bit counter, so a 500 ms cursor blink wakes the core twice a second.
+ * While the keyboard tick runs, periods are KEY_TICK_PERIOD + 1 cycles and
+ * timers expire on the first tick at or after their deadline.
+ *
+ * The auto-reload value is only rewritten when a period changes length.  A
+ * new value takes a few LSE cycles to reach the counter, so a period cut
+ * short in flight never ends less than LPTIM_MARGIN cycles from now.
+ *
+ * The keyboard starts and stops its tick from its own critical sections and
+ * from the tick itself, so the functions below restore PRIMASK rather than
+ * enabling interrupts.
+ */
+LPTIM_HandleTypeDef hlptim1;
+
+typedef struct
+{
+    uint32_t deadline; // lptim_clock() of the next expiry
+    uint32_t interval; // Cycles between expiries, 0 for a one-shot timer
+    bool expired;
+} sys_timer_t;
+
+// The sys_timer slots, then a private one for delay_us()
+#define DELAY_TIMER SYS_TIMER_COUNT
+#define TIMER_SLOTS (SYS_TIMER_COUNT + 1)
+
+static sys_timer_t timers[TIMER_SLOTS];
+static uint32_t timers_running; // Bit per running timer
+static bool tick_running;
+static volatile uint32_t clock_base; // lptim_clock() at the start of this period
+static volatile uint32_t period;     // Cycles in this period, 0 while stopped
+
+static uint32_t lptim_count(void)
+{
+    uint32_t count;
+
+    // The counter runs on the LSE: only trust two matching reads
+    do
+    {
+        count = HAL_LPTIM_ReadCounter(&hlptim1);
+    } while (count != HAL_LPTIM_ReadCounter(&hlptim1));
+    return count;
+}
+
+uint32_t lptim_clock(void)
+{
+    uint32_t base, length, count;
+
+    do
+    {
+        base = clock_base;
+        length = period;
+        count = length ? lptim_count() : 0;
+    } while (base != clock_base);
+
+    // Counter wrapped but the interrupt has not been taken yet
+    if (length && __HAL_LPTIM_GET_FLAG(&hlptim1, LPTIM_FLAG_ARRM) && count < length / 2)
+    {
+        count += length;
+    }
+    return base + count;
+}
+
+/*
+ * Pick the end of the current period from the keyboard tick and the timers,
+ * starting or stopping the counter as needed.  Interrupts must be off.
+ */
+static void lptim_program(void)
+{
+    if (!tick_running && timers_running == 0)
+    {
+        if (period)
+        {
+            clock_base += lptim_count();
+            period = 0;
+            HAL_LPTIM_Counter_Stop_IT(&hlptim1);
+        }
+        return;
+    }
+
+    uint32_t count = 0;
+    if (period == 0)
+    {
+        HAL_LPTIM_Counter_Start_IT(&hlptim1);
+    }
+    else if (__HAL_LPTIM_GET_FLAG(&hlptim1, LPTIM_FLAG_ARRM))
+    {
+        return; // Period already over: its interrupt programs the next one
+    }
+    else
+    {
+        count = lptim_count();
+    }
+
+    uint32_t earliest = count + LPTIM_MARGIN;
+    uint32_t end = 0x10000;
+    if (tick_running)
+    {
+        // Next tick boundary, so ticks keep their pace across a cut
+        end = (earliest + KEY_TICK_PERIOD) & ~(uint32_t)KEY_TICK_PERIOD;
+    }
+    else
+    {
+        for (int i = 0; i < TIMER_SLOTS; i++)
+        {
+            int32_t left = (int32_t)(timers[i].deadline - clock_base);
+            if ((timers_running & (1U << i)) && left < (int32_t)end)
+            {
+                end = left > (int32_t)earliest ? (uint32_t)left : earliest;
+            }
+        }
+    }
+
+    if (end != period)
+    {
+        period = end;
+        __HAL_LPTIM_AUTORELOAD_SET(&hlptim1, end - 1);
+    }
+}
+
+static void timer_expire(void)
+{
+    bool woke = false;
+
+    for (int i = 0; i < TIMER_SLOTS; i++)
+    {
+        sys_timer_t *t = &timers[i];
+        if (!(timers_running & (1U << i)) || (int32_t)(t->deadline - clock_base) > 0)
+        {
+            continue;
+        }
+        t->expired = true;
+        woke = true;
+        if (t->interval == 0)
+        {
+            timers_running &= ~(1U << i);
+        }
+        else
+        {
+            // Keep the pace, but skip expiries missed by a long keyboard tick
+            t->deadline += t->interval;
+            if ((int32_t)(t->deadline - clock_base) <= 0)
+            {
+                t->deadline = clock_base + t->interval;
+            }
+        }
+    }
+
+    // Let the main loop see the timeout
+    if (woke)
+    {
+        HAL_PWR_DisableSleepOnExit();
+    }
+}
+
+void HAL_LPTIM_AutoReloadMatchCallback(LPTIM_HandleTypeDef *hlptim)
+{
+    if (hlptim != &hlptim1)
+    {
+        return;
+    }
+    clock_base += period;
+    if (tick_running)
+    {
+        key_tick();
+    }
+    timer_expire();
+    lptim_program();
+}
+
+void lptim_tick_start(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    tick_running = true;
+    lptim_program();
+    __set_PRIMASK(primask);
+}
+
+void lptim_tick_stop(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    tick_running = false;
+    lptim_program();
+    __set_PRIMASK(primask);
+}
+
+static void timer_start(int timer_ix, uint32_t cycles, bool periodic)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    sys_timer_t *t = &timers[timer_ix];
+    t->deadline = lptim_clock() + cycles;
+    t->interval = periodic ? cycles : 0;
+    t->expired = false;
+    timers_running |= 1U << timer_ix;
+    lptim_program();
+    __set_PRIMASK(primask);
+}
+
+static void timer_stop(int timer_ix)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    timers_running &= ~(1U << timer_ix);
+    timers[timer_ix].expired = false;
+    lptim_program();
+    __set_PRIMASK(primask);
+}
+
+static void timer_start_ms(int timer_ix, uint32_t ms, bool periodic)
+{
+    if (timer_ix < 0 || timer_ix >= SYS_TIMER_COUNT)
+    {
+        return;
+    }
+
+    // Round up, so a timer never ends early
+    uint32_t cycles = ((uint64_t)ms * LPTIM_CLOCK_HZ + 999) / 1000;
+    timer_start(timer_ix, cycles ? cycles : 1, periodic);
+}
+
+void sys_timer_start(int timer_ix, uint32_t ms)
+{
+    timer_start_ms(timer_ix, ms, false);
+}
+
+void sys_timer_start_periodic(int timer_ix, uint32_t ms)
+{
+    timer_start_ms(timer_ix, ms, true);
+}
+
+int sys_timer_active(int timer_ix)
+{
+    if (timer_ix < 0 || timer_ix >= SYS_TIMER_COUNT)
+    {
+        return 0;
+    }
+    return (timers_running >> timer_ix) & 1;
+}
+
+int sys_timer_timeout(int timer_ix)
+{
+    if (timer_ix < 0 || timer_ix >= SYS_TIMER_COUNT)
+    {
+        return 0;
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    sys_timer_t *t = &timers[timer_ix];
+    int expired = t->expired;
+    if (t->interval)
+    {
+        t->expired = false; // Each period is reported once
+    }
+    __set_PRIMASK(primask);
+    return expired;
+}
+
+void sys_timer_disable(int timer_ix)
+{
+    if (timer_ix < 0 || timer_ix >= SYS_TIMER_COUNT)
+    {
+        return;
+    }
+    timer_stop(timer_ix);
+}
+
+/*
+ * Delays.  Short ones count core cycles on the DWT at SystemCoreClock, which
+ * HAL_RCC_ClockConfig() keeps up to date across sys_set_perf_level().  The
+ * cycle counter stops while the core sleeps, so long ones sleep until the
+ * private timer slot expires instead, and end within an LSE cycle after the
+ * requested time.  A handler, or code with interrupts off, would never see
+ * that expiry: it always busy-waits.
+ */
+void delay_init(void)
+{
+    DCB->DEMCR |= DCB_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+void delay_us(uint32_t us)
+{
+    uint32_t start = DWT->CYCCNT;
+
+    if (us >= DELAY_SLEEP_MIN_US && __get_IPSR() == 0 && __get_PRIMASK() == 0)
+    {
+        // Rounded up, plus the part of a cycle already gone on the counter
+        timer_start(DELAY_TIMER, ((uint64_t)us * LPTIM_CLOCK_HZ + 999999) / 1000000 + 1, false);
+        __disable_irq();
+        while (!timers[DELAY_TIMER].expired)
+        {
+            // WFI wakes on a pending interrupt with PRIMASK set: none is lost
+            HAL_PWR_EnterSLEEPMode(PWR_MAINREGULATOR_ON, PWR_SLEEPENTRY_WFI);
+            __enable_irq();
+            __disable_irq();
+        }
+        __enable_irq();
+        timer_stop(DELAY_TIMER);
+        return;
+    }
+
+    uint32_t cycles = us * (SystemCoreClock / 1000000);
+    while (DWT->CYCCNT - start < cycles)
+    {
+    }
+}
@@ -0,0 +1,494 @@
+/*
+ * test_graphics.c
+ *
+ * Golden-image regression and performance suite for the drawing primitives,
+ * run against the host build of liborcos.
+ *
+ * Every case renders into the framebuffer, pushes it through lcd_refresh()
+ * (or LCD_write_line() for test screen 8) into the virtual Sharp panel, and
+ * compares the panel with tests/golden/<case>.pbm.  On mismatch the actual
+ * image is written next to the build as <case>.actual.pbm.
+ *
+ * Each primitive is then timed and checked against a per-primitive budget
+ * in ns/call.  Budgets are generous; scale them with ORCOS_PERF_SCALE when
+ * running under valgrind or on a slow machine.
+ *
+ *   test_graphics [--update] [--timings FILE] GOLDEN_DIR [OUT_DIR]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "assets.h"
+#include "fonts.h"
+#include "host.h"
+#include "orcos.h"
+#include "sharp.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NUM_OF_TEST_SCREENS 9
+#define RANDOM_CALLS 200
+
+static const char *golden_dir;
+static const char *out_dir;
+static bool update;
+static int failures;
+
+/* Deterministic PRNG (xorshift32) so golden images are reproducible */
+static uint32_t rng_state;
+
+static void rng_seed(uint32_t seed)
+{
+    rng_state = seed ? seed : 1;
+}
+
+static uint32_t rng(uint32_t n)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state % n;
+}
+
+/* Golden image comparison ---------------------------------------------------*/
+
+static int read_pbm(const char *path, uint8_t *out, size_t size)
+{
+    int w, h;
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+        return -1;
+    if (fscanf(f, "P4 %d %d", &w, &h) != 2 || w != SHARP_PANEL_WIDTH || h != SHARP_PANEL_HEIGHT)
+    {
+        fclose(f);
+        return -1;
+    }
+    fgetc(f); // single whitespace after the header
+    size_t n = fread(out, 1, size, f);
+    fclose(f);
+    return n == size ? 0 : -1;
+}
+
+static void check_panel(const char *name)
+{
+    enum { SIZE = SHARP_PANEL_LINE_SIZE * SHARP_PANEL_HEIGHT };
+    static uint8_t expected[SIZE];
+    static uint8_t actual[SIZE];
+    char path[512];
+    char actual_path[512];
+
+    snprintf(path, sizeof(path), "%s/%s.pbm", golden_dir, name);
+    if (update)
+    {
+        if (sharp_panel_write_pbm(path) != 0)
+        {
+            printf("FAIL %-24s cannot write %s\n", name, path);
+            failures++;
+            return;
+        }
+        printf("UPD  %s\n", name);
+        return;
+    }
+
+    snprintf(actual_path, sizeof(actual_path), "%s/%s.actual.pbm", out_dir, name);
+    sharp_panel_write_pbm(actual_path);
+    if (read_pbm(actual_path, actual, SIZE) != 0)
+    {
+        printf("FAIL %-24s cannot write %s\n", name, actual_path);
+        failures++;
+        return;
+    }
+    if (read_pbm(path, expected, SIZE) != 0)
+    {
+        printf("FAIL %-24s missing golden %s\n", name, path);
+        failures++;
+        return;
+    }
+
+    int bad_pixels = 0;
+    int first_x = -1, first_y = -1;
+    for (int i = 0; i < SIZE; i++)
+    {
+        uint8_t diff = expected[i] ^ actual[i];
+        if (diff == 0)
+            continue;
+        if (first_x < 0)
+        {
+            first_y = i / SHARP_PANEL_LINE_SIZE;
+            first_x = (i % SHARP_PANEL_LINE_SIZE) * 8 + __builtin_clz((uint32_t)diff << 24);
+        }
+        bad_pixels += __builtin_popcount(diff);
+    }
+
+    if (bad_pixels)
+    {
+        printf("FAIL %-24s %d pixels differ, first at (%d,%d), see %s\n",
+               name, bad_pixels, first_x, first_y, actual_path);
+        failures++;
+    }
+    else
+    {
+        printf("ok   %s\n", name);
+        remove(actual_path);
+    }
+}
+
+/* Randomized primitive calls ------------------------------------------------*/
+
+static const uint8_t fonts[] = {FONT_6x8, FONT_7x12b, FONT_12x20, FONT_16x26, FONT_24x40};
+
+static void random_putsAt(void)
+{
+    char str[24];
+    int len = 1 + rng(sizeof(str) - 1);
+    for (int i = 0; i < len; i++)
+        str[i] = 32 + rng(224);
+    str[len] = '\0';
+    lcd_putsAt(str, fonts[rng(sizeof(fonts))], rng(LCD_WIDTH), rng(LCD_HEIGHT),
+               rng(2) ? LCD_SET_VALUE : LCD_EMPTY_VALUE);
+}
+
+static void random_draw_img(void)
+{
+    uint32_t x = rng(LCD_WIDTH), y = rng(LCD_HEIGHT);
+    uint8_t color = rng(2) ? LCD_SET_VALUE : LCD_EMPTY_VALUE;
+    const uint8_t *rook = asset_lookup(ASSET_ROOK)->data;
+    switch (rng(4))
+    {
+    case 0:
+        lcd_draw_img(rook, 32, 32, x, y, color);
+        break;
+    case 1:
+        lcd_draw_img(asset_lookup(ASSET_SMILEY)->data, 32, 32, x, y, color);
+        break;
+    case 2:
+        // Odd widths take the unaligned path with a partial last byte
+        lcd_draw_img(rook, 3 + rng(29), 1 + rng(32), x, y, color);
+        break;
+    default:
+        lcd_draw_img(asset_lookup(ASSET_OPENRPNCALC)->data, 400, 240, x & ~7u, y, color);
+        break;
+    }
+}
+
+static void random_fill_rect(void)
+{
+    lcd_fill_rect(rng(LCD_WIDTH), rng(LCD_HEIGHT), rng(LCD_WIDTH), rng(LCD_HEIGHT),
+                  rng(2) ? LCD_SET_VALUE : LCD_EMPTY_VALUE);
+}
+
+static void random_bitblt24(void)
+{
+    static const int ops[] = {BLT_OR, BLT_ANDN, BLT_XOR};
+    uint32_t val = rng(0x10000) << 16 | rng(0x10000);
+    bitblt24(rng(LCD_WIDTH), 1 + rng(24), rng(LCD_HEIGHT), val, ops[rng(3)], rng(2) ? BLT_SET : BLT_NONE);
+}
+
+static void random_mixed(void)
+{
+    switch (rng(10))
+    {
+    case 0:
+        lcd_invert_framebuffer();
+        break;
+    case 1:
+    case 2:
+        random_putsAt();
+        break;
+    case 3:
+    case 4:
+        random_draw_img();
+        break;
+    case 5:
+    case 6:
+        random_fill_rect();
+        break;
+    default:
+        random_bitblt24();
+        break;
+    }
+}
+
+static const struct
+{
+    const char *name;
+    void (*fn)(void);
+    uint32_t seed;
+} random_cases[] = {
+    {"random_putsAt", random_putsAt, 0x0001},
+    {"random_draw_img", random_draw_img, 0x0002},
+    {"random_fill_rect", random_fill_rect, 0x0003},
+    {"random_bitblt24", random_bitblt24, 0x0004},
+    {"random_mixed", random_mixed, 0x0005},
+};
+
+static void run_golden(void)
+{
+    char name[32];
+
+    for (int i = 0; i < NUM_OF_TEST_SCREENS; i++)
+    {
+        lcd_clear_buffer();
+        LCD_test_screen(i);
+        snprintf(name, sizeof(name), "screen_%d", i);
+        check_panel(name);
+    }
+
+    for (size_t c = 0; c < sizeof(random_cases) / sizeof(random_cases[0]); c++)
+    {
+        lcd_clear_buffer();
+        rng_seed(random_cases[c].seed);
+        for (int i = 0; i < RANDOM_CALLS; i++)
+            random_cases[c].fn();
+        lcd_refresh();
+        check_panel(random_cases[c].name);
+    }
+}
+
+/* Font registry -------------------------------------------------------------*/
+
+// Two 10x3 glyphs: 'A' is a bar across the top row, 'B' a bar down column 0
+static const uint8_t test_font_data[2][6] = {
+    {0xFF, 0x03, 0x00, 0x00, 0x00, 0x00},
+    {0x01, 0x00, 0x01, 0x00, 0x01, 0x00},
+};
+
+static const FontDef_t test_font = {
+    .FontWidth = 10,
+    .FontHeight = 3,
+    .data = test_font_data,
+    .Ascent = 3,
+    .Baseline = 3,
+    .Advance = 12,
+    .FirstChar = 'A',
+    .LastChar = 'B',
+    .Flags = FONT_FLAG_BOLD,
+};
+
+static bool panel_black(int x, int y)
+{
+    return !(sharp_panel_line(y + 1)[x / 8] & (1 << (x % 8)));
+}
+
+static void expect(const char *what, int actual, int expected)
+{
+    if (actual != expected)
+    {
+        printf("FAIL %-24s got %d, expected %d\n", what, actual, expected);
+        failures++;
+    }
+}
+
+static void run_fonts(void)
+{
+    int failed = failures;
+
+    // Built-in fonts step through sizes in order and stop at both ends
+    int nr = FONT_6x8;
+    for (size_t i = 1; i < sizeof(fonts); i++)
+    {
+        nr = lcd_nextFontNr(nr);
+        expect("lcd_nextFontNr", nr, fonts[i]);
+    }
+    expect("lcd_nextFontNr largest", lcd_nextFontNr(nr), nr);
+    for (size_t i = sizeof(fonts) - 1; i > 0; i--)
+    {
+        nr = lcd_prevFontNr(nr);
+        expect("lcd_prevFontNr", nr, fonts[i - 1]);
+    }
+    expect("lcd_prevFontNr smallest", lcd_prevFontNr(nr), nr);
+    expect("lcd_toggleFontT 6x8", lcd_toggleFontT(FONT_6x8), FONT_7x12b);
+    expect("lcd_toggleFontT 7x12b", lcd_toggleFontT(FONT_7x12b), FONT_6x8);
+
+    disp_stat_t ds = {.ln_offs = 2};
+    lcd_switchFont(&ds, FONT_16x26);
+    expect("lcd_lineHeight", lcd_lineHeight(&ds), 28);
+    expect("lcd_baseHeight", lcd_baseHeight(&ds), 21);
+    expect("lcd_fontWidth", lcd_fontWidth(&ds), 16);
+    lcd_switchFont(&ds, FONT_MAX);
+    expect("lcd_switchFont invalid", ds.font_nr, FONT_16x26);
+
+    // A registered font slots in by size and renders through lcd_putsAt
+    int id = font_register(&test_font);
+    expect("font_register", id, font_count() - 1);
+    expect("font_register invalid", font_register(NULL), -1);
+    expect("lcd_nextFontNr registered", lcd_nextFontNr(id), FONT_6x8);
+    expect("lcd_prevFontNr registered", lcd_prevFontNr(FONT_6x8), id);
+
+    // '?' has no glyph and leaves a blank 12 pixel cell before 'B'
+    lcd_clear_buffer();
+    lcd_putsAt("A?B", id, 8, 100, LCD_SET_VALUE);
+    lcd_refresh();
+    for (int y = 100; y < 103; y++)
+        for (int x = 8; x < 48; x++)
+        {
+            bool ink = (y == 100 && x < 18) || x == 32;
+            if (panel_black(x, y) != ink)
+            {
+                printf("FAIL %-24s pixel (%d,%d)\n", "registered font", x, y);
+                failures++;
+                return;
+            }
+        }
+
+    if (failures == failed)
+        printf("ok   font registry\n");
+}
+
+/* Timings -------------------------------------------------------------------*/
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void perf_putsAt_16x26(int i)
+{
+    lcd_putsAt("1234567890.12345678", FONT_16x26, i % 8, 40, LCD_SET_VALUE);
+}
+
+static void perf_putsAt_6x8(int i)
+{
+    lcd_putsAt("The quick brown fox jumps over", FONT_6x8, i % 8, 10, LCD_SET_VALUE);
+}
+
+static void perf_draw_img_full(int i)
+{
+    const asset_t *a = asset_lookup(ASSET_OPENRPNCALC);
+    (void)i;
+    lcd_draw_img(a->data, a->width, a->height, 0, 0, LCD_SET_VALUE);
+}
+
+static void perf_draw_img_sprite(int i)
+{
+    const asset_t *a = asset_lookup(ASSET_ROOK);
+    lcd_draw_img(a->data, a->width, a->height, (i * 7) % 368, (i * 13) % 208, LCD_SET_VALUE);
+}
+
+static void perf_fill_rect(int i)
+{
+    lcd_fill_rect(i % 13, i % 11, 300, 150, (i & 1) ? LCD_SET_VALUE : LCD_EMPTY_VALUE);
+}
+
+static void perf_bitblt24(int i)
+{
+    bitblt24(100 + (i % 8), 24, 100 + (i % 40), 0xFFFFFFFF, BLT_XOR, BLT_NONE);
+}
+
+static void perf_invert(int i)
+{
+    (void)i;
+    lcd_invert_framebuffer();
+}
+
+static void perf_refresh(int i)
+{
+    (void)i;
+    lcd_refresh();
+}
+
+/*
+ * Budgets are in ns/call on a typical x86-64 host at -O2, roughly 10x the
+ * time measured when the suite was added, so only real regressions trip.
+ */
+static const struct
+{
+    const char *name;
+    void (*fn)(int);
+    int iterations;
+    double budget_ns;
+} perf_cases[] = {
+    {"lcd_putsAt 16x26 x19", perf_putsAt_16x26, 2000, 50000},
+    {"lcd_putsAt 6x8 x30", perf_putsAt_6x8, 2000, 30000},
+    {"lcd_draw_img 400x240", perf_draw_img_full, 200, 650000},
+    {"lcd_draw_img 32x32", perf_draw_img_sprite, 5000, 10000},
+    {"lcd_fill_rect 300x150", perf_fill_rect, 200, 1200000},
+    {"bitblt24", perf_bitblt24, 20000, 1000},
+    {"lcd_invert_framebuffer", perf_invert, 1000, 150000},
+    {"lcd_refresh", perf_refresh, 200, 500000},
+};
+
+static void run_perf(const char *timings_path)
+{
+    double scale = 1.0;
+    const char *env = getenv("ORCOS_PERF_SCALE");
+    FILE *timings = NULL;
+
+    if (env != NULL && atof(env) > 0)
+        scale = atof(env);
+    if (timings_path != NULL)
+    {
+        timings = fopen(timings_path, "w");
+        if (timings != NULL)
+            fprintf(timings, "primitive,ns_per_call,budget_ns\n");
+    }
+
+    printf("\n%-28s %12s %12s\n", "primitive", "ns/call", "budget");
+    for (size_t c = 0; c < sizeof(perf_cases) / sizeof(perf_cases[0]); c++)
+    {
+        double budget = perf_cases[c].budget_ns * scale;
+        double best = 0;
+
+        // Best of three runs to reduce scheduler noise
+        for (int run = 0; run < 3; run++)
+        {
+            lcd_clear_buffer();
+            double t0 = now_ns();
+            for (int i = 0; i < perf_cases[c].iterations; i++)
+                perf_cases[c].fn(i);
+            double t = (now_ns() - t0) / perf_cases[c].iterations;
+            if (run == 0 || t < best)
+                best = t;
+        }
+
+        bool over = best > budget;
+        printf("%-28s %12.0f %12.0f%s\n", perf_cases[c].name, best, budget, over ? "  FAIL" : "");
+        if (timings != NULL)
+            fprintf(timings, "%s,%.0f,%.0f\n", perf_cases[c].name, best, budget);
+        if (over)
+            failures++;
+    }
+
+    if (timings != NULL)
+        fclose(timings);
+}
+
+int main(int argc, char **argv)
+{
+    const char *timings_path = NULL;
+    int arg = 1;
+
+    for (; arg < argc && argv[arg][0] == '-'; arg++)
+    {
+        if (strcmp(argv[arg], "--update") == 0)
+            update = true;
+        else if (strcmp(argv[arg], "--timings") == 0 && arg + 1 < argc)
+            timings_path = argv[++arg];
+        else
+            break;
+    }
+    if (arg >= argc)
+    {
+        fprintf(stderr, "usage: test_graphics [--update] [--timings FILE] GOLDEN_DIR [OUT_DIR]\n");
+        return 2;
+    }
+    golden_dir = argv[arg];
+    out_dir = arg + 1 < argc ? argv[arg + 1] : ".";
+
+    orcos_init();
+    LCD_power_on();
+
+    run_golden();
+    run_fonts();
+    if (!update)
+        run_perf(timings_path);
+
+    printf("\n%s: %d failure(s)\n", failures ? "FAILED" : "PASSED", failures);
+    return failures ? 1 : 0;
+}
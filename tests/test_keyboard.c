@@ -0,0 +1,870 @@
+/*
+ * test_keyboard.c
+ *
+ * Behavioural tests for the keyboard layer, run against the host build of
+ * liborcos with the simulated key matrix from host/Src/hal_shim.c.
+ *
+ *   test_keyboard
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "host.h"
+#include "keyboard.h"
+#include "orcos.h"
+#include "pin_definitions.h"
+#include "sharp_lowlevel.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+static int failures;
+
+static void expect(const char *what, long actual, long expected)
+{
+    if (actual != expected)
+    {
+        printf("FAIL %-28s got %ld, expected %ld\n", what, actual, expected);
+        failures++;
+    }
+}
+
+static void report(const char *name, int failed_before)
+{
+    if (failures == failed_before)
+        printf("ok   %s\n", name);
+}
+
+/* Key queue -----------------------------------------------------------------*/
+
+static void test_queue(void)
+{
+    int failed = failures;
+
+    key_pop_all();
+    expect("key_empty initially", key_empty(), 1);
+    expect("key_pop empty", key_pop(), 0);
+    expect("key_tail empty", key_tail(), -1);
+    expect("key_pop_last empty", key_pop_last(), -1);
+
+    // Every slot is usable; the first key past the depth is dropped
+    uint32_t overflows = key_overflows();
+    for (int i = 1; i <= KEY_QUEUE_SIZE + 1; i++)
+        key_push(i);
+    expect("key_overflows", key_overflows() - overflows, 1);
+    expect("key_tail full", key_tail(), KEY_QUEUE_SIZE);
+    for (int i = 1; i <= KEY_QUEUE_SIZE; i++)
+        expect("key_pop order", key_pop(), i);
+    expect("key_empty drained", key_empty(), 1);
+
+    key_push(7);
+    key_push(8);
+    key_push(9);
+    expect("key_tail", key_tail(), 9);
+    expect("key_empty after key_tail", key_empty(), 0);
+    expect("key_pop_last", key_pop_last(), 9);
+    expect("key_empty after key_pop_last", key_empty(), 1);
+
+    key_push(1);
+    key_push(2);
+    key_pop_all();
+    expect("key_empty after key_pop_all", key_empty(), 1);
+
+    // Run the indices well past any narrow counter width
+    for (int i = 0; i < 1000; i++)
+    {
+        key_push(i & 0x3ff);
+        key_push((i + 1) & 0x3ff);
+        expect("key_pop wrap", key_pop(), i & 0x3ff);
+        expect("key_pop wrap", key_pop(), (i + 1) & 0x3ff);
+    }
+
+    report("key queue", failed);
+}
+
+/*
+ * Producer and consumer on separate threads stand in for the scan interrupt
+ * and the main loop: every key must arrive exactly once or be counted as an
+ * overflow.
+ */
+#define STRESS_KEYS 2000000
+
+static volatile bool producer_done;
+
+static void *producer(void *arg)
+{
+    (void)arg;
+    for (uint32_t i = 1; i <= STRESS_KEYS; i++)
+        key_push(i & 0xffff);
+    producer_done = true;
+    return NULL;
+}
+
+static void test_queue_concurrent(void)
+{
+    int failed = failures;
+    pthread_t thread;
+    uint32_t received = 0;
+    uint32_t last = 0;
+    uint32_t overflows = key_overflows();
+
+    key_pop_all();
+    producer_done = false;
+    pthread_create(&thread, NULL, producer, NULL);
+    for (;;)
+    {
+        bool done = producer_done;
+        while (!key_empty())
+        {
+            // Keys arrive in push order, possibly with gaps from overflows
+            uint16_t key = key_pop();
+            if (key == (uint16_t)last)
+            {
+                printf("FAIL %-28s %u repeated\n", "concurrent order", key);
+                failures++;
+                break;
+            }
+            last = key;
+            received++;
+        }
+        if (done || failures != failed)
+            break;
+    }
+    pthread_join(thread, NULL);
+    while (!key_empty())
+    {
+        key_pop();
+        received++;
+    }
+
+    expect("concurrent keys accounted", received + (key_overflows() - overflows), STRESS_KEYS);
+    report("key queue, concurrent producer", failed);
+}
+
+/* Matrix scan ---------------------------------------------------------------*/
+
+static void test_scan(void)
+{
+    int failed = failures;
+
+    host_key_up_all();
+    expect("key_scan idle", key_scan(), 0);
+    expect("scan_keyboard idle", scan_keyboard(), 0);
+
+    host_key_down(KEY_F);
+    expect("key_scan one key", key_scan(), KEY_BIT(KEY_F));
+    expect("key_pressed", key_pressed(), KEY_BIT(KEY_F));
+    expect("key_released", key_released(), 0);
+
+    // Held keys are state, not edges
+    host_key_down(KEY_SIGN);
+    expect("key_scan two keys", key_scan(), KEY_BIT(KEY_F) | KEY_BIT(KEY_SIGN));
+    expect("key_pressed second", key_pressed(), KEY_BIT(KEY_SIGN));
+    expect("scan_keyboard two keys", scan_keyboard(), KEY_F << 8 | KEY_SIGN);
+
+    host_key_up(KEY_F);
+    expect("key_scan release", key_scan(), KEY_BIT(KEY_SIGN));
+    expect("key_released", key_released(), KEY_BIT(KEY_F));
+    expect("key_pressed none", key_pressed(), 0);
+
+    // Every key, including corners of the matrix and N-key rollover
+    uint64_t all = 0;
+    for (int k = 1; k <= NUM_ROW_PINS * NUM_COLUMN_PINS; k++)
+    {
+        host_key_up_all();
+        host_key_down(k);
+        expect("key_scan each key", key_scan(), KEY_BIT(k));
+        all |= KEY_BIT(k);
+    }
+    for (int k = 1; k <= NUM_ROW_PINS * NUM_COLUMN_PINS; k++)
+        host_key_down(k);
+    expect("key_scan all keys", key_scan(), all);
+    expect("scan_keyboard too many", scan_keyboard(), 0xFFFF);
+
+    host_key_up_all();
+    expect("key_scan all released", key_scan(), 0);
+    expect("key_released all", key_released(), all);
+
+    // Column probes: none with no key down, a binary search within the
+    // rows held low otherwise, where a full walk pulses all six columns
+    GPIO_TypeDef *columns = column_pin_array[0].port;
+    uint32_t probes = host_port_resets(columns);
+    key_scan();
+    expect("no probes idle", host_port_resets(columns) - probes, 0);
+    uint32_t most = 0, total = 0;
+    for (int k = 1; k <= NUM_ROW_PINS * NUM_COLUMN_PINS; k++)
+    {
+        host_key_up_all();
+        host_key_down(k);
+        probes = host_port_resets(columns);
+        key_scan();
+        probes = host_port_resets(columns) - probes - 1; // Less the return to idle
+        total += probes;
+        if (probes > most)
+            most = probes;
+    }
+    expect("most probes one key", most, 5);
+    expect("probes all single keys", total, 23 * NUM_ROW_PINS);
+    host_key_up_all();
+    host_key_down(KEY_0);
+    host_key_down(KEY_SIGN);
+    expect("key_scan chord in one row", key_scan(), KEY_BIT(KEY_0) | KEY_BIT(KEY_SIGN));
+    host_key_up_all();
+    key_scan();
+
+    // Columns are left low so a key press can pull its row low for EXTI
+    host_key_down(KEY_ON);
+    expect("idle columns wake rows", HAL_GPIO_ReadPin(row_pin_array[8].port, row_pin_array[8].pin), GPIO_PIN_RESET);
+    host_key_up_all();
+
+    // A row edge with nothing down, a bounce or a glitch, is no key
+    HAL_GPIO_EXTI_Falling_Callback(row_pin_array[0].pin);
+    expect("key_scan edge, no key", key_scan(), 0);
+    HAL_GPIO_EXTI_Falling_Callback(row_pin_array[NUM_ROW_PINS - 1].pin);
+    expect("scan_keyboard edge, no key", scan_keyboard(), 0);
+    HAL_Delay(100); // Let the tick the edges started run down
+    expect("no key queued", key_pop(), KEY_NONE);
+
+    report("matrix scan", failed);
+}
+
+/* Row modes -----------------------------------------------------------------*/
+
+static void test_row_modes(void)
+{
+    int failed = failures;
+    uint32_t rows = 0, pullups = 0, nvic = 0;
+
+    for (int row = 0; row < NUM_ROW_PINS; row++)
+    {
+        int line = __builtin_ctz(row_pin_array[row].pin);
+        rows |= row_pin_array[row].pin;
+        pullups |= GPIO_PULLUP << (2 * line);
+        nvic |= 1U << (EXTI0_IRQn + line);
+    }
+    int on_line = __builtin_ctz(row_pin_array[NUM_ROW_PINS - 1].pin);
+    GPIO_TypeDef *port = row_pin_array[0].port;
+
+    host_key_up_all();
+    key_arm_wakeup(0);
+    expect("any key: EXTI unmasked", EXTI->IMR1 & rows, rows);
+    expect("any key: falling edges", EXTI->FTSR1 & rows, rows);
+    expect("any key: no rising edges", EXTI->RTSR1 & rows, 0);
+    expect("any key: no pull-ups", port->PUPDR & pullups, 0);
+    expect("any key: NVIC enabled", NVIC->ISER[0] & nvic, nvic);
+
+    key_arm_wakeup(1);
+    expect("ON only: EXTI", EXTI->IMR1 & rows, 1U << on_line);
+    expect("ON only: falling edge", EXTI->FTSR1 & rows, 1U << on_line);
+    expect("ON only: NVIC", NVIC->ISER[0] & nvic, 1U << (EXTI0_IRQn + on_line));
+
+    // Awake, rows stay armed for background reading unless suspended
+    key_disarm_wakeup();
+    expect("awake: EXTI unmasked", EXTI->IMR1 & rows, rows);
+    expect("awake: NVIC enabled", NVIC->ISER[0] & nvic, nvic);
+
+    suspended_bg_key_read();
+    expect("scan: EXTI masked", EXTI->IMR1 & rows, 0);
+    expect("scan: no edges", (EXTI->FTSR1 | EXTI->RTSR1) & rows, 0);
+    expect("scan: pull-ups", port->PUPDR & (pullups | pullups << 1), pullups);
+    expect("scan: NVIC disabled", NVIC->ISER[0] & nvic, 0);
+    expect("rows stay inputs", port->MODER & (pullups | pullups << 1), 0);
+    resume_bg_key_read();
+    expect("resumed: EXTI unmasked", EXTI->IMR1 & rows, rows);
+
+    report("row register images", failed);
+}
+
+/* Debounce ------------------------------------------------------------------*/
+
+/*
+ * Key contact scripts replayed by the idle hook while the firmware sleeps.
+ * Times are in microseconds from script_start().
+ */
+typedef struct
+{
+    uint32_t at_us;
+    uint16_t keycode;
+    bool down;
+} key_step_t;
+
+static const key_step_t *script;
+static size_t script_len;
+static size_t script_pos;
+static uint32_t script_t0;
+
+static void script_hook(uint32_t now_us)
+{
+    while (script_pos < script_len && now_us - script_t0 >= script[script_pos].at_us)
+    {
+        const key_step_t *step = &script[script_pos++];
+        if (step->down)
+            host_key_down(step->keycode);
+        else
+            host_key_up(step->keycode);
+    }
+}
+
+static void script_start(const key_step_t *steps, size_t len)
+{
+    host_key_up_all();
+    script = steps;
+    script_len = len;
+    script_pos = 0;
+    script_t0 = host_time_us();
+    host_set_idle_hook(script_hook);
+}
+
+// Wait for the next key press, returns it and its time from script start
+static uint16_t next_key(uint32_t *at_us)
+{
+    key_event_t event;
+    do
+    {
+        wait_for_key_press();
+        *at_us = host_time_us() - script_t0;
+        key_pop_event(&event);
+    } while (event.flags & KEY_FLAG_RELEASE);
+    return event.code;
+}
+
+// Expect the next queued event to be the release of keycode, and no more
+static void expect_release(const char *what, uint16_t keycode)
+{
+    key_event_t event = {0};
+    key_pop_event(&event);
+    expect(what, event.code, keycode);
+    expect(what, event.flags, KEY_FLAG_RELEASE);
+    expect(what, key_empty(), 1);
+}
+
+// Let the keyboard tick run until all keys are up and settled
+static void settle(void)
+{
+    while (key_scan_active())
+    {
+        HAL_PWR_DisableSleepOnExit();
+        HAL_PWR_EnterSTOPMode(PWR_LOWPOWERMODE_STOP2, PWR_STOPENTRY_WFI);
+    }
+}
+
+// Keyboard ticks between a contact closing at from_us and an event at at_us
+static uint32_t ticks(uint32_t from_us, uint32_t at_us)
+{
+    return ((uint64_t)(at_us - from_us) * KEY_TICK_HZ + 500000) / 1000000;
+}
+
+#define TICK_US (1000000 / KEY_TICK_HZ)
+
+static void test_debounce(void)
+{
+    int failed = failures;
+    uint32_t at;
+
+    key_set_debounce(KEY_DEBOUNCE_PRESS, KEY_DEBOUNCE_RELEASE);
+
+    // A clean press registers after the press threshold
+    static const key_step_t clean[] = {
+        {1000, KEY_F, true},
+        {30000, KEY_F, false},
+    };
+    script_start(clean, 2);
+    expect("clean press", next_key(&at), KEY_F);
+    expect("clean press latency ticks", ticks(1000, at), KEY_DEBOUNCE_PRESS);
+    expect("tick runs while held", key_scan_active(), 1);
+    settle();
+    expect("tick stops after release", key_scan_active(), 0);
+    expect_release("one release per press", KEY_F);
+
+    // Contact chatter on press and release gives one event
+    static const key_step_t bouncy[] = {
+        {1000, KEY_SIGN, true},
+        {1300, KEY_SIGN, false},
+        {1700, KEY_SIGN, true},
+        {2100, KEY_SIGN, false},
+        {2300, KEY_SIGN, true},
+        {20000, KEY_SIGN, false},
+        {20400, KEY_SIGN, true},
+        {20800, KEY_SIGN, false},
+    };
+    script_start(bouncy, 8);
+    expect("bouncy press", next_key(&at), KEY_SIGN);
+    settle();
+    expect_release("bouncy single release", KEY_SIGN);
+
+    // A glitch shorter than the threshold is ignored, the later press is not
+    static const key_step_t glitch[] = {
+        {1000, KEY_0, true},
+        {1000 + TICK_US * (KEY_DEBOUNCE_PRESS - 2), KEY_0, false},
+        {50000, KEY_ENTER, true},
+        {80000, KEY_ENTER, false},
+    };
+    script_start(glitch, 4);
+    expect("glitch ignored", next_key(&at), KEY_ENTER);
+    expect("glitch, real press time", at > 50000, 1);
+    settle();
+    expect_release("glitch, real release", KEY_ENTER);
+
+    // Two keys held together are reported as one chord
+    static const key_step_t chord[] = {
+        {1000, KEY_F, true},
+        {1200, KEY_0, true},
+        {30000, KEY_F, false},
+        {30000, KEY_0, false},
+    };
+    script_start(chord, 4);
+    expect("chord", next_key(&at), KEY_F << 8 | KEY_0);
+    settle();
+    expect_release("chord single release", KEY_F << 8 | KEY_0);
+
+    // Going back to sleep with a key still held waits for the next press
+    static const key_step_t held[] = {
+        {1000, KEY_F, true},
+        {40000, KEY_F, false},
+        {90000, KEY_SIGN, true},
+        {120000, KEY_SIGN, false},
+    };
+    script_start(held, 4);
+    expect("held first", next_key(&at), KEY_F);
+    expect("held then next", next_key(&at), KEY_SIGN);
+    expect("held, next press time", at > 90000, 1);
+    settle();
+    expect_release("held, next release", KEY_SIGN);
+
+    // ON-only sleep ignores other keys, even F on the ON key row
+    static const key_step_t off[] = {
+        {1000, KEY_F, true},
+        {20000, KEY_F, false},
+        {50000, KEY_ON, true},
+        {80000, KEY_ON, false},
+    };
+    script_start(off, 4);
+    sys_sleep(1);
+    expect("off wakes on ON", key_pop(), KEY_ON);
+    expect("off, ON press time", host_time_us() - script_t0 > 50000, 1);
+    settle();
+    expect_release("off, ON release", KEY_ON);
+
+    // Thresholds are configurable
+    key_set_debounce(1, 1);
+    script_start(clean, 2);
+    next_key(&at);
+    expect("threshold 1 latency ticks", ticks(1000, at), 1);
+    settle();
+    key_set_debounce(KEY_DEBOUNCE_PRESS, KEY_DEBOUNCE_RELEASE);
+
+    host_set_idle_hook(NULL);
+    key_pop_all();
+    report("debounce", failed);
+}
+
+/* Autorepeat ----------------------------------------------------------------*/
+
+// Repeat times are whole keyboard ticks, rounded up
+#define MS_TICKS(ms) (((ms) * KEY_TICK_HZ + 999) / 1000)
+
+// Collect events until the keyboard has been idle for a second
+static int collect(int *repeats, uint32_t *last_us)
+{
+    int presses = 0;
+    int repeat;
+
+    *repeats = 0;
+    for (;;)
+    {
+        int key = runner_get_key_delay(&repeat, 1000, 0, 0, 0);
+        if (key < 0)
+            break;
+        if (key == KEY_NONE)
+            continue; // Release
+        *last_us = host_time_us() - script_t0;
+        if (repeat)
+            (*repeats)++;
+        else
+            presses++;
+    }
+    return presses;
+}
+
+static void test_autorepeat(void)
+{
+    int failed = failures;
+    int repeats;
+    uint32_t last;
+
+    // Held for 1 s: press at ~5 ms, repeats at ~505, 605, 705, 805, 905 ms
+    static const key_step_t hold[] = {
+        {1000, KEY_SIGN, true},
+        {1001000, KEY_SIGN, false},
+    };
+    script_start(hold, 2);
+    expect("hold presses", collect(&repeats, &last), 1);
+    expect("hold repeats", repeats, 5);
+    expect("last repeat ticks", ticks(1000, last),
+           KEY_DEBOUNCE_PRESS + MS_TICKS(KEY_REPEAT_DELAY_MS) + 4 * MS_TICKS(KEY_REPEAT_PERIOD_MS));
+
+    // A release before the delay gives no repeats
+    static const key_step_t tap[] = {
+        {1000, KEY_SIGN, true},
+        {400000, KEY_SIGN, false},
+    };
+    script_start(tap, 2);
+    expect("tap presses", collect(&repeats, &last), 1);
+    expect("tap repeats", repeats, 0);
+
+    // Slow autorepeat doubles the period
+    toggle_slow_autorepeat();
+    expect("is_slow_autorepeat", is_slow_autorepeat(), 1);
+    script_start(hold, 2);
+    collect(&repeats, &last);
+    expect("slow repeats", repeats, 3);
+    toggle_slow_autorepeat();
+    expect("is_slow_autorepeat off", is_slow_autorepeat(), 0);
+
+    // F does not repeat by default, a fast key repeats sooner and faster
+    static const key_step_t hold_f[] = {
+        {1000, KEY_F, true},
+        {1001000, KEY_F, false},
+    };
+    script_start(hold_f, 2);
+    collect(&repeats, &last);
+    expect("F repeats", repeats, 0);
+
+    key_set_repeat_class(KEY_SIGN, KEY_REPEAT_FAST);
+    key_set_repeat(KEY_REPEAT_FAST, 200, 50);
+    script_start(hold, 2);
+    collect(&repeats, &last);
+    expect("fast repeats", repeats, 16); // 205, 255 ... 955 ms
+    key_set_repeat(KEY_REPEAT_FAST, KEY_REPEAT_FAST_DELAY_MS, KEY_REPEAT_FAST_PERIOD_MS);
+    key_set_repeat_class(KEY_SIGN, KEY_REPEAT_NORMAL);
+
+    // Overrides from runner_get_key_delay(), with a repeat time limit
+    script_start(hold, 2);
+    int repeat;
+    expect("override press", runner_get_key_delay(&repeat, 0, 100, 100, 450), KEY_SIGN);
+    expect("override press flag", repeat, 0);
+    repeats = 0;
+    while (runner_get_key_delay(&repeat, 1000, 100, 100, 450) >= 0)
+        repeats += repeat;
+    expect("override repeats", repeats, 4); // 105, 205, 305, 405 ms
+
+    // Timeout with no key
+    host_set_idle_hook(NULL);
+    uint32_t t0 = host_time_us();
+    expect("timeout", runner_get_key_delay(&repeat, 50, 0, 0, 0), -1);
+    expect("timeout ms", (host_time_us() - t0) / 1000, 50);
+    expect("tick stops after timeout", key_scan_active(), 0);
+
+    key_pop_all();
+    report("autorepeat", failed);
+}
+
+/* Key release ---------------------------------------------------------------*/
+
+static bool tick_seen;
+
+// Script hook that also notes whether the keyboard tick ran while held
+static void release_hook(uint32_t now_us)
+{
+    script_hook(now_us);
+    if (now_us - script_t0 > 100000 && now_us - script_t0 < 500000)
+        tick_seen |= key_scan_active();
+}
+
+static void test_release(void)
+{
+    int failed = failures;
+    uint32_t at;
+
+    // Held for half a second, the tick stops until the rising edge
+    static const key_step_t hold[] = {
+        {1000, KEY_SIGN, true},
+        {500000, KEY_SIGN, false},
+        {500200, KEY_SIGN, true},
+        {500400, KEY_SIGN, false},
+    };
+    script_start(hold, 4);
+    expect("press", next_key(&at), KEY_SIGN);
+    expect("sys_last_key", sys_last_key(), KEY_SIGN);
+    int k2 = -1;
+    expect("sys_last_scan held", sys_last_scan(&k2), KEY_SIGN);
+    expect("sys_last_scan k2", k2, 0);
+
+    tick_seen = false;
+    host_set_idle_hook(release_hook);
+    wait_for_key_release();
+    at = host_time_us() - script_t0;
+    expect("released after contact opens", at > 500400, 1);
+    expect("released latency ticks", ticks(500400, at), KEY_DEBOUNCE_RELEASE);
+    expect("no tick while held", tick_seen, 0);
+    expect("no repeats while waiting", key_pop(), KEY_NONE); // The release
+    expect("sys_last_scan released", sys_last_scan(&k2), 0);
+    settle();
+    expect("single release", key_empty(), 1);
+
+    // A chord is released as one event, even from the same row
+    static const key_step_t chord[] = {
+        {1000, KEY_0, true},
+        {1200, KEY_SIGN, true},
+        {300000, KEY_0, false},
+        {300000, KEY_SIGN, false},
+    };
+    script_start(chord, 4);
+    expect("chord press", next_key(&at), KEY_SIGN << 8 | KEY_0);
+    expect("sys_last_scan chord", sys_last_scan(&k2), KEY_0);
+    expect("sys_last_scan chord k2", k2, KEY_SIGN);
+    wait_for_key_release();
+    expect_release("chord release", KEY_SIGN << 8 | KEY_0);
+
+    // Without waiting, a release is queued after the press
+    static const key_step_t tap[] = {
+        {1000, KEY_ENTER, true},
+        {20000, KEY_ENTER, false},
+    };
+    script_start(tap, 2);
+    next_key(&at);
+    settle();
+    expect_release("tap release", KEY_ENTER);
+    expect("key_pop release", (key_push_event(KEY_ENTER, KEY_FLAG_RELEASE), key_pop()), KEY_NONE);
+
+    host_set_idle_hook(NULL);
+    key_pop_all();
+    report("key release", failed);
+}
+
+/* Latency probes ------------------------------------------------------------*/
+
+static uint32_t hist_total(int stage, int *bucket)
+{
+    const uint32_t *hist = key_latency_histogram(stage);
+    uint32_t total = 0;
+    for (int b = 0; b < KEY_LAT_BUCKETS; b++)
+    {
+        if (hist[b])
+            *bucket = b;
+        total += hist[b];
+    }
+    return total;
+}
+
+static void test_latency(void)
+{
+    int failed = failures;
+    int bucket = -1;
+
+    key_latency_reset();
+    expect("histogram bad stage", key_latency_histogram(KEY_LAT_STAGES) == NULL, 1);
+
+    static const key_step_t tap[] = {
+        {1000, KEY_SIGN, true},
+        {40000, KEY_SIGN, false},
+    };
+    script_start(tap, 2);
+    wait_for_key_press();
+    uint32_t clock_at_wake = key_clock();
+    key_event_t event;
+    key_pop_event(&event);
+    expect("press popped", event.code, KEY_SIGN);
+    expect("press stamped at scan", clock_at_wake - event.time, 0);
+    lcd_refresh();
+
+    // EXTI to debounced press is the press threshold in LSE cycles
+    expect("EXTI to scan count", hist_total(KEY_LAT_EXTI_SCAN, &bucket), 1);
+    uint32_t cycles = KEY_DEBOUNCE_PRESS * (KEY_TICK_PERIOD + 1);
+    expect("EXTI to scan bucket", bucket, 31 - __builtin_clz(cycles));
+    // The first scan is the first tick: its phase is the window that puts
+    // keys pressed together in one chord
+    expect("EXTI to first scan count", hist_total(KEY_LAT_EXTI_FIRST, &bucket), 1);
+    expect("EXTI to first scan bucket", bucket, 31 - __builtin_clz(KEY_TICK_PERIOD + 1));
+    expect("scan to wake count", hist_total(KEY_LAT_SCAN_WAKE, &bucket), 1);
+    expect("wake to pop count", hist_total(KEY_LAT_WAKE_POP, &bucket), 1);
+    expect("pop to refresh count", hist_total(KEY_LAT_POP_REFRESH, &bucket), 1);
+
+    // Only the first refresh after a press is counted; the clock runs with the tick
+    lcd_refresh();
+    expect("one refresh per press", hist_total(KEY_LAT_POP_REFRESH, &bucket), 1);
+    uint32_t before = key_clock();
+    HAL_PWR_DisableSleepOnExit();
+    HAL_PWR_EnterSTOPMode(PWR_LOWPOWERMODE_STOP2, PWR_STOPENTRY_WFI);
+    expect("key_clock one tick", key_clock() - before, KEY_TICK_PERIOD + 1);
+    settle();
+    expect_release("tap release", KEY_SIGN);
+
+    // Releases and repeats are not probed
+    expect("releases not counted", hist_total(KEY_LAT_WAKE_POP, &bucket), 1);
+    key_latency_reset();
+    expect("reset", hist_total(KEY_LAT_EXTI_SCAN, &bucket), 0);
+
+    host_set_idle_hook(NULL);
+    report("latency probes", failed);
+}
+
+/* Recorder and replay -------------------------------------------------------*/
+
+// Pop n events as they arrive, noting their arrival time in ms
+static int receive(key_event_t *events, uint32_t *at_ms, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        if (key_empty())
+            wait_for_key_press();
+        key_pop_event(&events[i]);
+        at_ms[i] = host_time_us() / 1000;
+    }
+    return n;
+}
+
+static void test_record_replay(void)
+{
+    int failed = failures;
+    key_event_t live[6], replayed[6];
+    uint32_t live_ms[6], replayed_ms[6];
+    key_record_t rec[8];
+
+    static const key_step_t session[] = {
+        {1000, KEY_SIGN, true},
+        {50000, KEY_SIGN, false},
+        {300000, KEY_ENTER, true},
+        {350000, KEY_ENTER, false},
+        {700000, KEY_0, true},
+        {720000, KEY_0, false},
+    };
+    key_pop_all();
+    key_record_start();
+    script_start(session, 6);
+    receive(live, live_ms, 6);
+    settle();
+    key_record_stop();
+    host_set_idle_hook(NULL);
+
+    expect("recorded", key_record_count(), 6);
+    int n = key_record_copy(rec, 8);
+    expect("copied", n, 6);
+    for (int i = 0; i < n; i++)
+    {
+        expect("recorded code", rec[i].code, live[i].code);
+        expect("recorded flags", rec[i].flags, live[i].flags);
+    }
+    // RTC sub-seconds are 4 ms steps
+    expect("recorded gap", (rec[2].ms - rec[0].ms + 2) / 4, (live_ms[2] - live_ms[0] + 2) / 4);
+
+    // Same events, same spacing to the RTC and keyboard tick resolution
+    expect("replay start", key_replay_start(rec, n, 100), 0);
+    receive(replayed, replayed_ms, 6);
+    expect("replay done", key_replay_active(), 0);
+    for (int i = 0; i < n; i++)
+    {
+        expect("replayed code", replayed[i].code, live[i].code);
+        expect("replayed flags", replayed[i].flags, live[i].flags);
+        long drift = (long)(replayed_ms[i] - replayed_ms[0]) - (long)(live_ms[i] - live_ms[0]);
+        expect("replayed time within 8 ms", drift >= -8 && drift <= 8, 1);
+    }
+    expect("nothing extra", key_empty(), 1);
+
+    // Ten times as fast, then flat out
+    key_replay_start(rec, n, 1000);
+    receive(replayed, replayed_ms, 6);
+    long span = replayed_ms[5] - replayed_ms[0];
+    long expected = (rec[5].ms - rec[0].ms) / 10;
+    expect("10x pace", span >= expected - 8 && span <= expected + 8, 1);
+
+    key_replay_start(rec, n, 0);
+    receive(replayed, replayed_ms, 6);
+    expect("flat out", replayed_ms[5] - replayed_ms[0] <= 6, 1);
+
+    // Stopping leaves the rest out
+    key_replay_start(rec, n, 100);
+    receive(replayed, replayed_ms, 1);
+    key_replay_stop();
+    settle();
+    expect("stopped", key_empty(), 1);
+
+    // Replay does not record unless asked to
+    expect("not recording", key_record_count(), 6);
+    expect("empty replay", key_replay_start(rec, 0, 100), -1);
+
+    report("record and replay", failed);
+}
+
+/* Background reading --------------------------------------------------------*/
+
+static void test_background(void)
+{
+    int failed = failures;
+    int polls = 0;
+
+    // Keys pressed while the main loop computes are queued meanwhile
+    static const key_step_t busy[] = {
+        {1000, KEY_SIGN, true},
+        {50000, KEY_SIGN, false},
+        {200000, KEY_ON, true},
+        {230000, KEY_ON, false},
+    };
+    key_pop_all();
+    script_start(busy, 4);
+    HAL_Delay(100);
+    expect("press queued while busy", key_pop(), KEY_SIGN);
+    expect("release queued while busy", key_pop_last(), KEY_NONE);
+    expect("no abort yet", key_abort_requested(), 0);
+    while (!key_abort_requested() && polls < 1000)
+    {
+        HAL_Delay(1);
+        polls++;
+    }
+    expect("abort requested", key_abort_requested(), 1);
+    expect("abort latency ms", polls >= 100 && polls <= 100 + 2 * KEY_DEBOUNCE_PRESS, 1); // ON at 200 ms
+    expect("abort key queued", key_pop(), KEY_ON);
+    expect("abort cleared by pop", key_abort_requested(), 0);
+    HAL_Delay(100);
+    expect("tick stopped", key_scan_active(), 0);
+    key_pop_all();
+
+    // Suspended, the keys wait for the next sleep or scan
+    suspended_bg_key_read();
+    suspended_bg_key_read();
+    script_start(busy, 2);
+    HAL_Delay(20);
+    resume_bg_key_read();
+    HAL_Delay(20);
+    expect("suspended nests", key_empty(), 1);
+    expect("still visible to scan", scan_keyboard(), KEY_SIGN);
+    resume_bg_key_read();
+    HAL_Delay(100);
+    expect("nothing queued", key_empty(), 1);
+
+    // Another abort key
+    key_set_abort_key(KEY_ENTER);
+    static const key_step_t enter[] = {
+        {1000, KEY_ENTER, true},
+        {30000, KEY_ENTER, false},
+    };
+    script_start(enter, 2);
+    HAL_Delay(50);
+    expect("abort key configurable", key_abort_requested(), 1);
+    key_set_abort_key(KEY_ON);
+    expect("abort reset", key_abort_requested(), 0);
+
+    host_set_idle_hook(NULL);
+    key_pop_all();
+    report("background reading", failed);
+}
+
+int main(void)
+{
+    orcos_init();
+
+    test_queue();
+    test_queue_concurrent();
+    test_scan();
+    test_row_modes();
+    test_debounce();
+    test_autorepeat();
+    test_release();
+    test_latency();
+    test_record_replay();
+    test_background();
+
+    printf("\n%s: %d failure(s)\n", failures ? "FAILED" : "PASSED", failures);
+    return failures ? 1 : 0;
+}
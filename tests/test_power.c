@@ -0,0 +1,793 @@
+/*
+ * test_power.c
+ *
+ * Behavioural tests for the low-power time base, the timer and delay
+ * services, the performance levels, the residency accounting and auto-off,
+ * run against the host build of liborcos with virtual time from
+ * host/Src/hal_shim.c.
+ *
+ *   test_power
+ */
+
+#include "host.h"
+#include "io.h"
+#include "keyboard.h"
+#include "orcos.h"
+#include "pin_definitions.h"
+#include "power.h"
+#include "sharp_lowlevel.h"
+#include "timer.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+
+static int failures;
+
+static void expect(const char *what, long actual, long expected)
+{
+    if (actual != expected)
+    {
+        printf("FAIL %-28s got %ld, expected %ld\n", what, actual, expected);
+        failures++;
+    }
+}
+
+static void expect_range(const char *what, long actual, long low, long high)
+{
+    if (actual < low || actual > high)
+    {
+        printf("FAIL %-28s got %ld, expected %ld..%ld\n", what, actual, low, high);
+        failures++;
+    }
+}
+
+static void report(const char *name, int failed_before)
+{
+    if (failures == failed_before)
+        printf("ok   %s\n", name);
+}
+
+/* Timers --------------------------------------------------------------------*/
+
+// One LSE cycle, the resolution of the time base, rounded up
+#define CYCLE_US 31
+
+static void test_one_shot(void)
+{
+    int failed = failures;
+
+    expect("inactive initially", sys_timer_active(0), 0);
+    expect("no timeout initially", sys_timer_timeout(0), 0);
+
+    sys_timer_start(0, 100);
+    expect("active", sys_timer_active(0), 1);
+    uint32_t t0 = host_time_us();
+    uint32_t irqs = host_lptim_interrupts();
+    sys_sleep(0);
+    expect_range("wakes on expiry", host_time_us() - t0, 100000, 100000 + CYCLE_US);
+    expect("one interrupt", host_lptim_interrupts() - irqs, 1);
+    expect("timeout", sys_timer_timeout(0), 1);
+    expect("timeout stays", sys_timer_timeout(0), 1);
+    expect("inactive after expiry", sys_timer_active(0), 0);
+
+    // Restart clears the expiry; disable stops it and the time base
+    sys_timer_start(0, 100);
+    expect("restart clears timeout", sys_timer_timeout(0), 0);
+    sys_timer_disable(0);
+    expect("disabled", sys_timer_active(0), 0);
+    uint32_t clock = key_clock();
+    irqs = host_lptim_interrupts();
+    HAL_Delay(200);
+    expect("time base stopped", key_clock() - clock, 0);
+    expect("no interrupts stopped", host_lptim_interrupts() - irqs, 0);
+    expect("no timeout disabled", sys_timer_timeout(0), 0);
+
+    // Longer than the 16-bit counter: periods of its full range
+    sys_timer_start(1, 5000);
+    t0 = host_time_us();
+    irqs = host_lptim_interrupts();
+    sys_sleep(0);
+    expect_range("long timer", host_time_us() - t0, 5000000, 5000000 + CYCLE_US);
+    expect("long timer interrupts", host_lptim_interrupts() - irqs, 3);
+    expect("long timer timeout", sys_timer_timeout(1), 1);
+
+    // The earliest of several timers ends the sleep
+    sys_timer_start(2, 300);
+    sys_timer_start(3, 120);
+    t0 = host_time_us();
+    sys_sleep(0);
+    expect_range("earliest first", host_time_us() - t0, 120000, 120000 + CYCLE_US);
+    expect("earliest timeout", sys_timer_timeout(3), 1);
+    expect("later still active", sys_timer_active(2), 1);
+    sys_sleep(0);
+    expect_range("later next", host_time_us() - t0, 300000, 300000 + CYCLE_US);
+    expect("later timeout", sys_timer_timeout(2), 1);
+
+    // Out of range timers are ignored
+    sys_timer_start(SYS_TIMER_COUNT, 10);
+    expect("out of range", sys_timer_active(SYS_TIMER_COUNT), 0);
+
+    for (int i = 0; i < SYS_TIMER_COUNT; i++)
+        sys_timer_disable(i);
+    report("one-shot timers", failed);
+}
+
+static void test_periodic(void)
+{
+    int failed = failures;
+
+    sys_timer_start_periodic(0, 500);
+    uint32_t t0 = host_time_us();
+    uint32_t irqs = host_lptim_interrupts();
+    for (int i = 1; i <= 4; i++)
+    {
+        sys_sleep(0);
+        expect_range("periodic pace", host_time_us() - t0, i * 500000, i * 500000 + CYCLE_US);
+        expect("periodic timeout", sys_timer_timeout(0), 1);
+        expect("reported once", sys_timer_timeout(0), 0);
+        expect("still active", sys_timer_active(0), 1);
+    }
+    // Tickless: one interrupt per expiry, no 1 kHz tick in between
+    expect("one interrupt per period", host_lptim_interrupts() - irqs, 4);
+
+    sys_timer_disable(0);
+    report("periodic timers", failed);
+}
+
+/*
+ * Short delays busy-wait on the cycle counter and take no virtual time in the
+ * shim; long ones sleep on the time base, which stops again afterwards.
+ */
+static void test_delays(void)
+{
+    int failed = failures;
+
+    uint32_t t0 = host_time_us();
+    uint32_t cycles = DWT->CYCCNT;
+    delay_us(DELAY_SLEEP_MIN_US - 1);
+    expect("short busy-waits", host_time_us() - t0, 0);
+    expect_range("short counts cycles", DWT->CYCCNT - cycles, (DELAY_SLEEP_MIN_US - 1) * 16,
+                 (DELAY_SLEEP_MIN_US - 1) * 16 + 2 * HOST_DWT_CYCLES_PER_READ);
+
+    for (uint32_t us = DELAY_SLEEP_MIN_US; us <= 100000; us *= 10)
+    {
+        t0 = host_time_us();
+        uint32_t irqs = host_lptim_interrupts();
+        delay_us(us);
+        expect_range("long sleeps", host_time_us() - t0, us, us + 2 * CYCLE_US);
+        expect("one interrupt", host_lptim_interrupts() - irqs, 1);
+    }
+    uint32_t clock = key_clock();
+    HAL_Delay(10);
+    expect("time base stopped", key_clock() - clock, 0);
+
+    // Alongside a timer, which keeps its own expiry
+    sys_timer_start(0, 20);
+    t0 = host_time_us();
+    delay_us(5000);
+    expect_range("delay with timer", host_time_us() - t0, 5000, 5000 + 2 * CYCLE_US);
+    expect("timer not yet", sys_timer_timeout(0), 0);
+    expect("timer running", sys_timer_active(0), 1);
+    sys_sleep(0);
+    expect_range("timer after delay", host_time_us() - t0, 20000, 20000 + CYCLE_US);
+    expect("timer timeout", sys_timer_timeout(0), 1);
+
+    report("delays", failed);
+}
+
+/*
+ * A key press in the middle of a timer period starts the keyboard tick on
+ * the same counter: the timer still expires on time, to within a tick, and
+ * once the key is up the time base is back to a single interrupt per expiry.
+ */
+static uint32_t key_at_us;
+static int key_to_press = KEY_SIGN;
+
+static void press_hook(uint32_t now_us)
+{
+    if (now_us >= key_at_us + 220000)
+        host_key_up_all();
+    else if (now_us >= key_at_us)
+        host_key_down(key_to_press);
+}
+
+static void test_with_keyboard(void)
+{
+    int failed = failures;
+    uint32_t tick_us = (KEY_TICK_PERIOD + 1) * 1000000 / KEY_LPTIM_CLOCK_HZ + 1;
+
+    key_pop_all();
+    sys_timer_start_periodic(0, 200);
+    uint32_t t0 = host_time_us();
+    key_at_us = t0 + 30000;
+    host_set_idle_hook(press_hook);
+
+    uint32_t clock = key_clock();
+    sys_sleep(0);
+    expect_range("key wakes first", host_time_us() - t0, 30000, 40000);
+    expect("key press", key_pop(), KEY_SIGN);
+    expect("timer not yet", sys_timer_timeout(0), 0);
+    expect("clock follows time", (key_clock() - clock) * 1000000ULL / KEY_LPTIM_CLOCK_HZ / 1000,
+           (host_time_us() - t0) / 1000);
+
+    // Key still held: the timer expires on a keyboard tick
+    expect("tick running", key_scan_active(), 1);
+    sys_sleep(0);
+    expect_range("timer during tick", host_time_us() - t0, 200000, 200000 + tick_us);
+    expect("timeout during tick", sys_timer_timeout(0), 1);
+
+    // Release event, then the tick stops once the key has settled
+    sys_sleep(0);
+    expect_range("release wakes", host_time_us() - t0, 250000, 260000);
+    host_set_idle_hook(NULL);
+    key_pop_all();
+    HAL_Delay(10);
+    expect("tick stopped", key_scan_active(), 0);
+
+    uint32_t irqs = host_lptim_interrupts();
+    sys_sleep(0);
+    expect("tickless again", host_lptim_interrupts() - irqs, 1);
+    expect_range("pace kept", host_time_us() - t0, 400000, 400000 + tick_us);
+    expect("timeout after tick", sys_timer_timeout(0), 1);
+
+    sys_timer_disable(0);
+    report("timers with keyboard tick", failed);
+}
+
+/* Performance levels --------------------------------------------------------*/
+
+static void expect_retimed(const char *level, uint32_t hclk_hz)
+{
+    char what[40];
+
+    // Power domains not in use are retimed by their next user
+    power_domain_get(POWER_DOMAIN_DISPLAY);
+    power_domain_get(POWER_DOMAIN_ADC);
+    uint32_t sclk_hz = hclk_hz / (2U << (hspi2.Init.BaudRatePrescaler >> 28));
+
+    snprintf(what, sizeof(what), "%s HCLK", level);
+    expect(what, HAL_RCC_GetHCLKFreq(), hclk_hz);
+    snprintf(what, sizeof(what), "%s delay cycles", level);
+    uint32_t start = DWT->CYCCNT;
+    delay_us(10);
+    expect_range(what, DWT->CYCCNT - start, 10 * (hclk_hz / 1000000),
+                 10 * (hclk_hz / 1000000) + 2 * HOST_DWT_CYCLES_PER_READ);
+    snprintf(what, sizeof(what), "%s SPI2 SCLK", level);
+    expect_range(what, sclk_hz, 1000000, 2000000);
+    snprintf(what, sizeof(what), "%s ADC clock", level);
+    expect_range(what, hclk_hz / host_adcdac_div, 500000, 1000000);
+    power_domain_put(POWER_DOMAIN_ADC);
+    power_domain_put(POWER_DOMAIN_DISPLAY);
+}
+
+static void test_perf_levels(void)
+{
+    int failed = failures;
+    static const uint32_t hclk_hz[SYS_PERF_LEVELS] = {12000000, 16000000, 96000000};
+    static const char *const names[SYS_PERF_LEVELS] = {"low", "normal", "boost"};
+
+    expect("normal at start-up", sys_get_perf_level(), SYS_PERF_NORMAL);
+    expect("bad level", sys_set_perf_level(SYS_PERF_LEVELS), -1);
+    expect("negative level", sys_set_perf_level(-1), -1);
+    expect("level kept", sys_get_perf_level(), SYS_PERF_NORMAL);
+
+    // Every transition, each checked against the datasheet limits on the way
+    for (int from = 0; from < SYS_PERF_LEVELS; from++)
+    {
+        for (int to = 0; to < SYS_PERF_LEVELS; to++)
+        {
+            sys_set_perf_level(from);
+            expect("set level", sys_set_perf_level(to), 0);
+            expect("get level", sys_get_perf_level(), to);
+            expect_retimed(names[to], hclk_hz[to]);
+        }
+    }
+    expect("within limits", host_clock_violations(), 0);
+
+    // STOP2 at each level: the level, and everything timed from it, is back
+    for (int level = 0; level < SYS_PERF_LEVELS; level++)
+    {
+        sys_set_perf_level(level);
+        sys_timer_start(0, 10);
+        sys_sleep(0);
+        expect("timeout in sleep", sys_timer_timeout(0), 1);
+        expect("level after sleep", sys_get_perf_level(), level);
+        expect_retimed(names[level], hclk_hz[level]);
+    }
+    expect("within limits in sleep", host_clock_violations(), 0);
+
+    // BOOST kept through STOP2: a wakeup restarts the MSIS, not the booster
+    sys_set_perf_level(SYS_PERF_BOOST);
+    uint32_t starts = host_booster_starts();
+    for (int sleep = 0; sleep < 3; sleep++)
+    {
+        sys_timer_start(0, 10);
+        sys_sleep(0);
+        expect("boost after sleep", HAL_RCC_GetHCLKFreq(), 96000000);
+    }
+    expect("booster kept in sleep", host_booster_starts() - starts, 0);
+    expect("MSIS restarted", host_clock_violations(), 0);
+
+    sys_set_perf_level(SYS_PERF_NORMAL);
+    report("performance levels", failed);
+}
+
+/* Power domains and the wake path -------------------------------------------*/
+
+static void test_power_domains(void)
+{
+    int failed = failures;
+    uint32_t violations = host_clock_violations();
+
+    // Gated once initialized, and after every use
+    expect("gated at start-up", host_rcc_clocks, 0);
+    lcd_refresh();
+    vbat_sample();
+    expect("gated after use", host_rcc_clocks, 0);
+
+    // Held until the last user lets go
+    power_domain_get(POWER_DOMAIN_DISPLAY);
+    power_domain_get(POWER_DOMAIN_DISPLAY);
+    expect("two users", power_domain_users(POWER_DOMAIN_DISPLAY), 2);
+    power_domain_put(POWER_DOMAIN_DISPLAY);
+    expect("held by one", host_rcc_clocks, HOST_CLK_SPI2);
+    power_domain_put(POWER_DOMAIN_DISPLAY);
+    power_domain_put(POWER_DOMAIN_DISPLAY);
+    expect("unbalanced put", power_domain_users(POWER_DOMAIN_DISPLAY), 0);
+    expect("released", host_rcc_clocks, 0);
+
+    // A level change leaves idle domains to their next user
+    uint32_t prescaler = hspi2.Init.BaudRatePrescaler;
+    uint32_t adc_div = host_adcdac_div;
+    sys_set_perf_level(SYS_PERF_BOOST);
+    expect("SPI2 not retimed yet", hspi2.Init.BaudRatePrescaler, prescaler);
+    expect("ADC not retimed yet", host_adcdac_div, adc_div);
+    lcd_refresh();
+    expect("SPI2 retimed by refresh", hspi2.Init.BaudRatePrescaler, SPI_BAUDRATEPRESCALER_64);
+    expect("ADC still not retimed", host_adcdac_div, adc_div);
+    vbat_sample();
+    expect("ADC retimed by sample", host_adcdac_div, RCC_ADCDACCLK_DIV128);
+
+    // A sleep at BOOST: no retiming unless the domains are used
+    power_domain_get(POWER_DOMAIN_ADC);
+    prescaler = hspi2.Init.BaudRatePrescaler;
+    sys_timer_start(0, 10);
+    sys_sleep(0);
+    expect("ADC in use retimed at once", host_adcdac_div, RCC_ADCDACCLK_DIV128);
+    expect("SPI2 idle left alone", hspi2.Init.BaudRatePrescaler, prescaler);
+    power_domain_put(POWER_DOMAIN_ADC);
+
+    // The clock tree is checked after a wakeup, not assumed
+    sys_set_perf_level(SYS_PERF_LOW);
+    HAL_RCCEx_StopWakeupSysclkConfig(RCC_STOP_WKUP_SYSCLK_HSI);
+    sys_timer_start(0, 10);
+    sys_sleep(0);
+    expect("woke on the level's clock", HAL_RCC_GetHCLKFreq(), 12000000);
+    expect("in use from now on", HAL_RCC_GetSysClockFreq(), 12000000);
+    lcd_refresh();
+    expect_range("SPI2 follows", 12000000 / (2U << (hspi2.Init.BaudRatePrescaler >> 28)), 1000000, 2000000);
+
+    sys_set_perf_level(SYS_PERF_NORMAL);
+    expect("no gated access", host_clock_violations() - violations, 0);
+    report("power domains", failed);
+}
+
+/* Residency and wakeups -----------------------------------------------------*/
+
+// One RTC sub-second step, the resolution of the residency times
+#define RTC_STEP_MS 4
+
+static void test_residency(void)
+{
+    int failed = failures;
+    sys_power_stats_t stats;
+
+    sys_power_stats_reset();
+    HAL_Delay(100);
+    sys_power_stats(&stats);
+    expect_range("run while busy", stats.ms[SYS_POWER_RUN], 100 - RTC_STEP_MS, 100 + RTC_STEP_MS);
+    expect("no stop2 while busy", stats.ms[SYS_POWER_STOP2], 0);
+    expect("no sleeps", stats.sleeps, 0);
+
+    // A periodic timer: one LPTIM wakeup per period, sleep-on-exit between
+    sys_power_stats_reset();
+    sys_timer_start_periodic(0, 250);
+    sys_sleep(0);
+    sys_sleep(0);
+    sys_power_stats(&stats);
+    expect("sleeps", stats.sleeps, 2);
+    expect("lptim wakeups", stats.wakeups[SYS_WAKE_LPTIM], 2);
+    expect_range("stop2 while sleeping", stats.ms[SYS_POWER_STOP2], 500 - RTC_STEP_MS, 500 + RTC_STEP_MS);
+    expect_range("run while sleeping", stats.ms[SYS_POWER_RUN], 0, RTC_STEP_MS);
+    sys_timer_disable(0);
+
+    // A key press: the row EXTI wakes the core, the keyboard tick follows
+    key_pop_all();
+    sys_power_stats_reset();
+    uint32_t rtc_reads = host_rtc_hal_reads();
+    key_at_us = host_time_us() + 50000;
+    host_set_idle_hook(press_hook);
+    sys_sleep(0);
+    expect("key press", key_pop(), KEY_SIGN);
+    sys_sleep(0);
+    host_set_idle_hook(NULL);
+    key_pop_all();
+    HAL_Delay(10);
+    sys_power_stats(&stats);
+
+    uint32_t exti = 0;
+    for (int line = 0; line < 16; line++)
+        exti += stats.wakeups[SYS_WAKE_EXTI(line)];
+    expect("one row wakeup", exti, 1);
+    // About one per millisecond while the key is held and settles
+    expect_range("tick wakeups", stats.wakeups[SYS_WAKE_LPTIM], 200, 260);
+    expect("no rtc wakeups", stats.wakeups[SYS_WAKE_RTC_WAKEUP] + stats.wakeups[SYS_WAKE_RTC_ALARM], 0);
+    // Timestamped from the RTC counters, not the HAL calendar
+    expect("no HAL calendar reads", host_rtc_hal_reads() - rtc_reads, 0);
+    uint64_t total = stats.ms[SYS_POWER_RUN] + stats.ms[SYS_POWER_IRQ] + stats.ms[SYS_POWER_STOP2];
+    expect_range("modes add up", total, 280 - RTC_STEP_MS, 290 + RTC_STEP_MS);
+
+    sys_power_stats_dump();
+    report("residency and wakeups", failed);
+}
+
+/* Auto-off ------------------------------------------------------------------*/
+
+static void test_auto_off(void)
+{
+    int failed = failures;
+    sys_power_stats_t stats;
+
+    // One RTC alarm at the deadline, only the EXTCOMIN second ticks before it
+    LCD_power_on();
+    sys_power_stats_reset();
+    uint32_t t0 = host_time_us();
+    sys_sleep(0);
+    expect_range("off after 5 min", host_time_us() - t0, 299000000, 300000000);
+    expect("auto off", is_auto_off(), 1);
+    expect("auto off count", sys_auto_off_cnt(), 1);
+    expect("display off", LCD_is_on(), 0);
+    sys_power_stats(&stats);
+    expect("alarm wakeup", stats.wakeups[SYS_WAKE_RTC_ALARM], 1);
+    expect_range("extcomin wakeups", stats.wakeups[SYS_WAKE_RTC_WAKEUP], 299, 300);
+    expect("no tick wakeups", stats.wakeups[SYS_WAKE_LPTIM], 0);
+
+    // A key press restarts the timeout
+    LCD_power_on();
+    expect("cleared on power on", is_auto_off(), 0);
+    key_pop_all();
+    t0 = host_time_us();
+    key_at_us = t0 + 100000000;
+    host_set_idle_hook(press_hook);
+    while (!is_auto_off())
+        sys_sleep(0);
+    host_set_idle_hook(NULL);
+    expect_range("off 5 min after key", host_time_us() - t0, 399000000, 400300000);
+    expect("key seen", key_pop(), KEY_SIGN);
+    expect("auto off count 2", sys_auto_off_cnt(), 2);
+
+    // An RTC found locked is no error: the alarm is set on the next pass,
+    // within a second even if the one on entering sys_sleep() fails too
+    host_set_rtc_busy(2);
+    LCD_power_on();
+    t0 = host_time_us();
+    sys_sleep(0);
+    expect_range("retried within a second", host_time_us() - t0, 1, 1000000);
+    expect("display still on", LCD_is_on(), 1);
+    t0 = host_time_us();
+    while (!is_auto_off())
+        sys_sleep(0);
+    expect_range("off 5 min after retry", host_time_us() - t0, 299000000, 300000000);
+    expect("auto off count 3", sys_auto_off_cnt(), 3);
+
+    // Nothing left armed while the display is off
+    reset_auto_off();
+    sys_timer_start(0, 400000);
+    sys_sleep(0);
+    expect("timer, not alarm", sys_timer_timeout(0), 1);
+    expect("no auto off when off", is_auto_off(), 0);
+    expect("auto off count kept", sys_auto_off_cnt(), 3);
+
+    report("auto-off", failed);
+}
+
+static void test_battery(void)
+{
+    int failed = failures;
+
+    // Seeded at start-up, reading it converts nothing
+    uint32_t conversions = host_adc_conversions();
+    expect_range("initial vbat", get_vbat(), 3290, 3310);
+    expect("ok", get_lowbat_state(), LOWBAT_STATE_OK);
+    expect("read from cache", host_adc_conversions() - conversions, 0);
+
+    // One conversion every 10 RTC wakeups
+    for (int i = 0; i < 30; i++)
+        vbat_tick();
+    expect("sampled every 10 s", host_adc_conversions() - conversions, 3);
+
+    // The filter takes a few samples to follow a drop
+    host_set_vdda_mv(2400);
+    vbat_sample();
+    expect("filtered", get_lowbat_state(), LOWBAT_STATE_OK);
+    for (int i = 0; i < 20; i++)
+        vbat_sample();
+    expect_range("vbat follows", get_vbat(), 2395, 2430);
+    expect("low", get_lowbat_state(), LOWBAT_STATE_LOW);
+
+    // Within the hysteresis band the state holds, in both directions
+    host_set_vdda_mv(2550);
+    for (int i = 0; i < 20; i++)
+        vbat_sample();
+    expect("still low", get_lowbat_state(), LOWBAT_STATE_LOW);
+    host_set_vdda_mv(2100);
+    for (int i = 0; i < 20; i++)
+        vbat_sample();
+    expect("critical", get_lowbat_state(), LOWBAT_STATE_CRITICAL);
+    host_set_vdda_mv(2250);
+    for (int i = 0; i < 20; i++)
+        vbat_sample();
+    expect("still critical", get_lowbat_state(), LOWBAT_STATE_CRITICAL);
+    host_set_vdda_mv(2700);
+    for (int i = 0; i < 20; i++)
+        vbat_sample();
+    expect("ok again", get_lowbat_state(), LOWBAT_STATE_OK);
+
+    host_set_vdda_mv(3300);
+    for (int i = 0; i < 20; i++)
+        vbat_sample();
+
+    // From the RTC wakeup in STOP2 the tick only starts the conversion: the
+    // core waits in SLEEP for the ADC interrupt that ends it
+    uint32_t violations = host_clock_violations();
+    host_set_vdda_mv(3000);
+    conversions = host_adc_conversions();
+    LCD_power_on();
+    sys_timer_start(0, 10500);
+    while (!sys_timer_timeout(0))
+        sys_sleep(0);
+    LCD_power_off(1);
+    expect("sampled from the wakeup", host_adc_conversions() - conversions, 1);
+    expect_range("read in the interrupt", get_vbat(), 3215, 3235);
+    expect("not left running in STOP2", host_clock_violations() - violations, 0);
+
+    host_set_vdda_mv(3300);
+    report("battery", failed);
+}
+
+/*
+ * Power-off: Stop 3 with only the RTC running.  Other keys do not wake the
+ * core, the ON key does, through WKUP7, and it resumes where it stopped with
+ * the ON key press queued.
+ */
+static uint32_t on_at_us;
+
+static void power_off_hook(uint32_t now_us)
+{
+    if (now_us >= on_at_us + 220000)
+        host_key_up_all();
+    else if (now_us >= on_at_us)
+        host_key_down(KEY_ON);
+    else if (now_us >= key_at_us + 220000)
+        host_key_up_all();
+    else if (now_us >= key_at_us)
+        host_key_down(KEY_SIGN);
+}
+
+static void test_power_off(void)
+{
+    int failed = failures;
+    sys_power_stats_t stats;
+
+    LCD_power_off(1);
+    key_pop_all();
+    sys_timer_start(0, 2000);
+    sys_power_stats_reset();
+    uint32_t t0 = host_time_us();
+    key_at_us = t0 + 5000000;
+    on_at_us = t0 + 10000000;
+    host_set_idle_hook(power_off_hook);
+    sys_power_off();
+    uint32_t woke_us = host_time_us();
+    expect_range("woken by ON", woke_us - t0, 10000000, 10005000);
+    sys_power_stats(&stats);
+    expect("one power-off", stats.offs, 1);
+    expect_range("off residency", stats.ms[SYS_POWER_OFF], 10000 - RTC_STEP_MS, 10000 + RTC_STEP_MS);
+    expect("wkup wakeup", stats.wakeups[SYS_WAKE_WKUP], 1);
+    uint32_t exti = 0;
+    for (int line = 0; line < 16; line++)
+        exti += stats.wakeups[SYS_WAKE_EXTI(line)];
+    expect("no row wakeup", exti, 0);
+    expect("no lptim wakeup", stats.wakeups[SYS_WAKE_LPTIM], 0);
+
+    // The time base stood still: the timer still has its 2 s to run
+    expect("timer held", sys_timer_timeout(0), 0);
+    expect("timer running", sys_timer_active(0), 1);
+    sys_timer_disable(0);
+
+    // The key that woke it is scanned as a normal press
+    HAL_Delay(300);
+    host_set_idle_hook(NULL);
+    expect("ON key", key_pop(), KEY_ON);
+    expect("nothing else", key_pop(), KEY_NONE);
+
+    // Resume latency: ON edge to the first frame on the panel
+    LCD_power_on();
+    lcd_refresh();
+    sys_power_stats(&stats);
+    expect_range("resume latency", stats.resume_ms, 300, 320);
+    LCD_power_off(1);
+
+    report("power-off", failed);
+}
+
+/*
+ * Power-off image: the panel holds it on the booster and EXTCOMIN alone,
+ * toggled once a second by the RTC through Stop 3, with nothing sent to it.
+ */
+static uint32_t extcomin_edges;
+static uint32_t extcomin_level;
+
+static void off_image_hook(uint32_t now_us)
+{
+    uint32_t level = extcomin.port->ODR & extcomin.pin;
+    if (level != extcomin_level)
+        extcomin_edges++;
+    extcomin_level = level;
+    power_off_hook(now_us);
+}
+
+static uint32_t panel_hash(void)
+{
+    uint32_t hash = 0;
+    for (int line = 1; line <= SHARP_PANEL_HEIGHT; line++)
+        for (int i = 0; i < SHARP_PANEL_LINE_SIZE; i++)
+            hash = hash * 31 + sharp_panel_line(line)[i];
+    return hash;
+}
+
+static void test_off_image(void)
+{
+    int failed = failures;
+    sys_power_stats_t stats;
+
+    LCD_power_off(1);
+    key_pop_all();
+    reset_off_image_cycle();
+    expect("drawn", draw_power_off_image(1), 0);
+    expect("display not on", LCD_is_on(), 0);
+    uint32_t first = panel_hash();
+    uint32_t bytes = sharp_panel_bytes_received();
+    uint32_t conversions = host_adc_conversions();
+
+    sys_power_stats_reset();
+    uint32_t t0 = host_time_us();
+    on_at_us = t0 + 10000000;
+    key_at_us = on_at_us; // No other key
+    extcomin_edges = 0;
+    extcomin_level = extcomin.port->ODR & extcomin.pin;
+    host_set_idle_hook(off_image_hook);
+    sys_power_off();
+    expect_range("woken by ON", host_time_us() - t0, 10000000, 10005000);
+    sys_power_stats(&stats);
+    expect("one power-off", stats.offs, 1);
+    expect_range("extcomin wakeups", stats.wakeups[SYS_WAKE_RTC_WAKEUP], 9, 10);
+    expect_range("extcomin edges", extcomin_edges, 9, 10);
+    expect("no lptim wakeup", stats.wakeups[SYS_WAKE_LPTIM], 0);
+    expect("nothing sent", sharp_panel_bytes_received() - bytes, 0);
+    expect("no battery samples", host_adc_conversions() - conversions, 0);
+    expect("image held", panel_hash(), first);
+    expect("booster on", (v5_en.port->ODR & v5_en.pin) != 0, 1);
+    expect("display enabled", (disp.port->ODR & disp.pin) != 0, 1);
+    HAL_Delay(300);
+    host_set_idle_hook(NULL);
+    expect("ON key", key_pop(), KEY_ON);
+
+    // Each power-off shows the next image, until the cycle is reset
+    draw_power_off_image(1);
+    expect("next image", panel_hash() != first, 1);
+    reset_off_image_cycle();
+    draw_power_off_image(1);
+    expect("first image again", panel_hash(), first);
+
+    LCD_power_on();
+    expect("display on", LCD_is_on(), 1);
+    LCD_power_off(1);
+    expect("booster off", (v5_en.port->ODR & v5_en.pin) != 0, 0);
+
+    report("power-off image", failed);
+}
+
+/*
+ * Energy model: residency by perf level and with the display on, the bytes
+ * the panel received and the ADC conversions, priced from a table of round
+ * figures.
+ */
+static void test_energy(void)
+{
+    int failed = failures;
+    sys_power_stats_t stats;
+    sys_energy_t energy;
+    sys_energy_table_t saved;
+    const sys_energy_table_t table = {
+        .run_na = {[SYS_PERF_LOW] = 1000, [SYS_PERF_NORMAL] = 2000, [SYS_PERF_BOOST] = 10000},
+        .stop2_na = 100,
+        .off_na = 10,
+        .display_na = 5000,
+        .spi_pc_per_byte = 1000,
+        .adc_pc_per_conversion = 50000,
+        .battery_mah = 100,
+    };
+
+    sys_energy_table(&saved);
+    sys_energy_set_table(&table);
+    LCD_power_off(1);
+    sys_set_perf_level(SYS_PERF_NORMAL);
+    uint32_t bytes = sharp_panel_bytes_received();
+    uint32_t conversions = host_adc_conversions();
+    sys_power_stats_reset();
+
+    HAL_Delay(1000);
+    sys_set_perf_level(SYS_PERF_LOW);
+    HAL_Delay(500);
+    sys_set_perf_level(SYS_PERF_NORMAL);
+    LCD_power_on();
+    lcd_refresh();
+    vbat_sample();
+    HAL_Delay(2000);
+    LCD_power_off(1);
+    sys_timer_start(0, 3000);
+    while (!sys_timer_timeout(0))
+        sys_sleep(0);
+
+    sys_power_stats(&stats);
+    expect_range("normal awake", stats.awake_ms[SYS_PERF_NORMAL], 3000 - RTC_STEP_MS, 3010 + RTC_STEP_MS);
+    expect_range("low awake", stats.awake_ms[SYS_PERF_LOW], 500 - RTC_STEP_MS, 500 + RTC_STEP_MS);
+    expect("boost awake", stats.awake_ms[SYS_PERF_BOOST], 0);
+    expect_range("display on", stats.display_ms, 2000 - RTC_STEP_MS, 2010 + RTC_STEP_MS);
+    expect("spi bytes", stats.spi_bytes, sharp_panel_bytes_received() - bytes);
+    expect("adc conversions", stats.adc_conversions, host_adc_conversions() - conversions);
+
+    // One frame of 240 lines, 52 bytes each with the address and trailer
+    expect_range("frame sent", stats.spi_bytes, 1 + 240 * 52 + 2, 1 + 240 * 52 + 2 + 60 * 54);
+
+    sys_energy(&energy);
+    expect("run charge", energy.nc[SYS_ENERGY_RUN],
+           (stats.awake_ms[SYS_PERF_LOW] * 1000 + stats.awake_ms[SYS_PERF_NORMAL] * 2000) / 1000);
+    expect_range("stop2 charge", energy.nc[SYS_ENERGY_STOP2], 290, 310);
+    expect("off charge", energy.nc[SYS_ENERGY_OFF], 0);
+    expect_range("display charge", energy.nc[SYS_ENERGY_DISPLAY], 9980, 10070);
+    expect("spi charge", energy.nc[SYS_ENERGY_SPI], stats.spi_bytes);
+    expect("adc charge", energy.nc[SYS_ENERGY_ADC], stats.adc_conversions * 50);
+    uint64_t total = 0;
+    for (int part = 0; part < SYS_ENERGY_PARTS; part++)
+        total += energy.nc[part];
+    expect_range("time", energy.ms, 6500 - RTC_STEP_MS, 6510 + RTC_STEP_MS);
+    expect("average", energy.avg_na, total * 1000 / energy.ms);
+    expect("battery life", energy.life_hours, 100000000 / energy.avg_na);
+    sys_energy_dump();
+
+    sys_energy_set_table(&saved);
+    report("energy model", failed);
+}
+
+int main(void)
+{
+    orcos_init();
+
+    test_one_shot();
+    test_periodic();
+    test_delays();
+    test_with_keyboard();
+    test_perf_levels();
+    test_power_domains();
+    test_residency();
+    test_auto_off();
+    test_battery();
+    test_power_off();
+    test_off_image();
+    test_energy();
+
+    printf("\n%s: %d failure(s)\n", failures ? "FAILED" : "PASSED", failures);
+    return failures ? 1 : 0;
+}